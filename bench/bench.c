@@ -0,0 +1,1382 @@
+/*
+ * bench.c
+ *
+ * Microbenchmarks for every function in lib.h.
+ * Results of the math kernels are first checked against
+ * the original scalar code, then each function is timed
+ * over a large batch of random inputs and the mean,
+ * spread and throughput are reported as a table, CSV,
+ * or JSON so they can be compared between revisions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/lib.h"
+#include "../lib/objFile.h"
+#include "../lib/plyFile.h"
+#include "../lib/textureFile.h"
+#include "../lib/mipmap.h"
+#include "../lib/bcEncode.h"
+#include "../lib/cubeState.h"
+#include "../lib/libSimd.h"
+
+#define DEFAULT_INPUTS 65536
+#define DEFAULT_SAMPLES 20
+#define SAMPLE_NS 2e6 // Aim for samples of at least 2ms
+#define TOLERANCE 1e-4
+// Most a BC1 gradient may be off once decoded, as RMSE
+// over the 8 bit channels
+#define BC1_MAX_RMSE 5.0
+
+// Output formats
+typedef enum
+{
+	TABLE,
+	CSV,
+	JSON
+} Format;
+
+int num_inputs = DEFAULT_INPUTS;
+int num_samples = DEFAULT_SAMPLES;
+
+// Random inputs shared by every benchmark
+vec4 *vecs;
+mat4 *mats;
+quat *quats;
+camera *cams;
+// Random rotate/scale/translate and rotate/translate matrices
+mat4 *affines;
+mat4 *rigids;
+// A random scramble of 3x3x3 cube moves
+int *cube_moves;
+
+// Results are written here so the compiler can't throw work away
+GLfloat *fout;
+GLfloat *fout4;
+vec2 *v2out;
+vec4 *vout;
+mat4 *mout;
+quat *qout;
+volatile GLfloat sink;
+
+// REFERENCE SCALAR CODE
+// Scalar versions of the original lib.c functions, used to check
+// the results of whichever backend lib.c was built with
+
+float refDotVec(vec4 *v, vec4 *u)
+{
+	return (v->x * u->x) + (v->y * u->y) + (v->z * u->z) + (v->w * u->w);
+}
+
+vec4 refNormalize(vec4 *v)
+{
+	GLfloat s = 1 / sqrtf(refDotVec(v, v));
+	return v4(v->x * s, v->y * s, v->z * s, v->w * s);
+}
+
+vec4 refCrossVec(vec4 *v, vec4 *u)
+{
+	return (vec4){
+		(v->y * u->z - v->z * u->y),
+		(v->z * u->x - v->x * u->z),
+		(v->x * u->y - v->y * u->x),
+		0.0};
+}
+
+mat4 refTranspose(mat4 *m)
+{
+	mat4 temp = {
+		{m->x.x, m->y.x, m->z.x, m->w.x},
+		{m->x.y, m->y.y, m->z.y, m->w.y},
+		{m->x.z, m->y.z, m->z.z, m->w.z},
+		{m->x.w, m->y.w, m->z.w, m->w.w},
+	};
+	return temp;
+}
+
+vec4 refMultMatVec(mat4 *m, vec4 *v)
+{
+	mat4 t = refTranspose(m);
+	vec4 r = {
+		refDotVec(&t.x, v),
+		refDotVec(&t.y, v),
+		refDotVec(&t.z, v),
+		refDotVec(&t.w, v),
+	};
+	return r;
+}
+
+mat4 refMultMat(mat4 *m, mat4 *n)
+{
+	mat4 r = {
+		refMultMatVec(m, &n->x),
+		refMultMatVec(m, &n->y),
+		refMultMatVec(m, &n->z),
+		refMultMatVec(m, &n->w),
+	};
+	return r;
+}
+
+/**
+ * The original inverse: matrix of minors, cofactors,
+ * transpose and divide by the determinant
+ */
+mat4 refInvMat(mat4 *m)
+{
+	mat4 minor = minorMat(m);
+	mat4 cofac = cofactor(&minor);
+	mat4 t = transpose(&cofac);
+	GLfloat det = m->x.x * minor.x.x - m->y.x * minor.y.x + m->z.x * minor.z.x - m->w.x * minor.w.x;
+	return multScalMat(&t, 1 / det);
+}
+
+// lib/mipmap.c and lib/bcEncode.c built with LIB_NO_SIMD,
+// by scalarMipmap.c and scalarBcEncode.c
+void scalarMipBuild(mipChain *mips, const textureFile *tex, int num_threads);
+void scalarMipFree(mipChain *mips);
+void scalarBcEncode(const GLubyte *texels, int width, int height, int bpp, bcFormat format,
+					GLubyte *out, int num_threads);
+
+/**
+ * Decode one BC1 block to 16 RGB texels, as the GL
+ * would when sampling it
+ */
+void refDecodeBC1(const GLubyte *block, GLubyte *rgb)
+{
+	int ends[2] = {block[0] | block[1] << 8, block[2] | block[3] << 8};
+	int colors[4][3];
+	for (int k = 0; k < 2; k++)
+	{
+		int r = ends[k] >> 11 & 31, g = ends[k] >> 5 & 63, b = ends[k] & 31;
+		colors[k][0] = r << 3 | r >> 2;
+		colors[k][1] = g << 2 | g >> 4;
+		colors[k][2] = b << 3 | b >> 2;
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		if (ends[0] > ends[1])
+		{
+			colors[2][c] = (2 * colors[0][c] + colors[1][c]) / 3;
+			colors[3][c] = (colors[0][c] + 2 * colors[1][c]) / 3;
+		}
+		else
+		{
+			colors[2][c] = (colors[0][c] + colors[1][c]) / 2;
+			colors[3][c] = 0;
+		}
+	}
+	unsigned bits = block[4] | block[5] << 8 | block[6] << 16 | (unsigned)block[7] << 24;
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			rgb[3 * i + c] = colors[bits >> 2 * i & 3][c];
+		}
+	}
+}
+
+// HELPERS
+
+/**
+ * Random float in [-1, 1]
+ */
+GLfloat randFloat(void)
+{
+	return 2.0f * (GLfloat)rand() / (GLfloat)RAND_MAX - 1.0f;
+}
+
+/**
+ * Largest difference between the elements of two vectors,
+ * relative to the size of the expected value
+ */
+double vecError(vec4 *got, vec4 *want)
+{
+	GLfloat *g = &got->x;
+	GLfloat *w = &want->x;
+	double err = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		double e = fabs(g[i] - w[i]) / (fabs(w[i]) > 1 ? fabs(w[i]) : 1);
+		err = e > err ? e : err;
+	}
+	return err;
+}
+
+double matError(mat4 *got, mat4 *want)
+{
+	double err = 0, e;
+	e = vecError(&got->x, &want->x);
+	err = e > err ? e : err;
+	e = vecError(&got->y, &want->y);
+	err = e > err ? e : err;
+	e = vecError(&got->z, &want->z);
+	err = e > err ? e : err;
+	e = vecError(&got->w, &want->w);
+	err = e > err ? e : err;
+	return err;
+}
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Print one result line and keep track of failures.
+ * Failures are always printed.
+ */
+int checkBound(const char *name, double err, double bound, int verbose)
+{
+	int ok = err <= bound;
+	if (verbose || !ok)
+	{
+		fprintf(ok ? stdout : stderr, "%-12s max error %.3g  %s\n", name, err, ok ? "OK" : "FAIL");
+	}
+	return ok;
+}
+
+int check(const char *name, double err, int verbose)
+{
+	return checkBound(name, err, TOLERANCE, verbose);
+}
+
+/**
+ * Allocate and fill the random inputs and output arrays
+ */
+void allocInputs(void)
+{
+	vecs = (vec4 *)malloc(sizeof(vec4) * num_inputs);
+	mats = (mat4 *)malloc(sizeof(mat4) * num_inputs);
+	quats = (quat *)malloc(sizeof(quat) * num_inputs);
+	cams = (camera *)malloc(sizeof(camera) * num_inputs);
+	affines = (mat4 *)malloc(sizeof(mat4) * num_inputs);
+	rigids = (mat4 *)malloc(sizeof(mat4) * num_inputs);
+	fout = (GLfloat *)malloc(sizeof(GLfloat) * num_inputs);
+	fout4 = (GLfloat *)malloc(sizeof(GLfloat) * 4 * num_inputs);
+	v2out = (vec2 *)malloc(sizeof(vec2) * num_inputs);
+	vout = (vec4 *)malloc(sizeof(vec4) * num_inputs);
+	mout = (mat4 *)malloc(sizeof(mat4) * num_inputs);
+	qout = (quat *)malloc(sizeof(quat) * num_inputs);
+	cube_moves = (int *)malloc(sizeof(int) * num_inputs);
+	if (!vecs || !mats || !quats || !cams || !affines || !rigids ||
+		!fout || !fout4 || !v2out || !vout || !mout || !qout || !cube_moves)
+	{
+		printf("Error allocating memory for inputs\n");
+		exit(1);
+	}
+
+	srand(1566);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		vecs[i] = v4(randFloat(), randFloat(), randFloat(), randFloat());
+		mats[i] = m4(
+			v4(randFloat(), randFloat(), randFloat(), randFloat()),
+			v4(randFloat(), randFloat(), randFloat(), randFloat()),
+			v4(randFloat(), randFloat(), randFloat(), randFloat()),
+			v4(randFloat(), randFloat(), randFloat(), randFloat()));
+
+		mat4 r = x_rotate(3 * randFloat());
+		mat4 t = y_rotate(3 * randFloat());
+		r = multMat(&t, &r);
+		t = translate(10 * randFloat(), 10 * randFloat(), 10 * randFloat());
+		rigids[i] = multMat(&t, &r);
+		mat4 sc = scale(1.5 + randFloat(), 1.5 + randFloat(), 1.5 + randFloat());
+		affines[i] = multMat(&rigids[i], &sc);
+
+		quats[i] = quatAxisAngle(vecs[i], 3 * randFloat());
+		cams[i] = (camera){vecs[i], 3 * randFloat(), 1.5 * randFloat()};
+		v2out[i] = v2(randFloat(), randFloat());
+		cube_moves[i] = rand() % CUBE_MOVES;
+	}
+}
+
+// VERIFICATION
+
+// An RGB texture of random bytes, from its own generator
+// so the shared inputs stay the same
+GLubyte *noiseTexels(int width, int height)
+{
+	GLubyte *texels = (GLubyte *)malloc(3L * width * height);
+	if (!texels)
+	{
+		printf("Error allocating memory for inputs\n");
+		exit(1);
+	}
+	unsigned state = 2463534242u ^ (width * 31 + height);
+	for (long i = 0; i < 3L * width * height; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		texels[i] = state >> 24;
+	}
+	return texels;
+}
+
+/**
+ * Bytes that differ between the SIMD and scalar builds
+ * of mipBuild, and of bcEncode in both formats on every
+ * level, for a random texture of the given size
+ */
+void textureMismatches(int width, int height, double *mip_err, double *bc_err)
+{
+	textureFile tex = {noiseTexels(width, height), width, height, NULL, 0};
+	mipChain mips, ref_mips;
+	mipBuild(&mips, &tex, 0);
+	scalarMipBuild(&ref_mips, &tex, 1);
+	for (int i = 1; i < mips.num_levels; i++)
+	{
+		size_t n = 3 * (size_t)mips.width[i] * mips.height[i];
+		for (size_t k = 0; k < n; k++)
+		{
+			*mip_err += mips.levels[i][k] != ref_mips.levels[i][k];
+		}
+	}
+	*mip_err += mips.num_levels != ref_mips.num_levels;
+
+	for (int format = BC1; format <= BC3; format++)
+	{
+		for (int i = 0; i < mips.num_levels; i++)
+		{
+			const GLubyte *texels = i == 0 ? tex.texels : mips.levels[i];
+			size_t n = bcLevelSize(format, mips.width[i], mips.height[i]);
+			GLubyte *out = (GLubyte *)malloc(n);
+			GLubyte *ref = (GLubyte *)malloc(n);
+			bcEncode(texels, mips.width[i], mips.height[i], 3, format, out, 0);
+			scalarBcEncode(texels, mips.width[i], mips.height[i], 3, format, ref, 1);
+			for (size_t k = 0; k < n; k++)
+			{
+				*bc_err += out[k] != ref[k];
+			}
+			free(out);
+			free(ref);
+		}
+	}
+	mipFree(&mips);
+	scalarMipFree(&ref_mips);
+	free((void *)tex.texels);
+}
+
+/**
+ * RMSE of a smooth 64x64 gradient after BC1 encoding and
+ * decoding, the kind of image BC1 should keep close
+ */
+double bc1GradientError(void)
+{
+	int w = 64, h = 64;
+	GLubyte texels[3 * 64 * 64], block[8 * 16 * 16], rgb[48];
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			GLubyte *p = texels + 3 * (y * w + x);
+			p[0] = 4 * x;
+			p[1] = 4 * y;
+			p[2] = 2 * (x + y);
+		}
+	}
+	bcEncode(texels, w, h, 3, BC1, block, 1);
+	double sum = 0;
+	for (int by = 0; by < h / 4; by++)
+	{
+		for (int bx = 0; bx < w / 4; bx++)
+		{
+			refDecodeBC1(block + 8 * (by * (w / 4) + bx), rgb);
+			for (int i = 0; i < 16; i++)
+			{
+				const GLubyte *p = texels + 3 * ((4 * by + i / 4) * w + 4 * bx + i % 4);
+				for (int c = 0; c < 3; c++)
+				{
+					double d = rgb[3 * i + c] - p[c];
+					sum += d * d;
+				}
+			}
+		}
+	}
+	return sqrt(sum / (3.0 * w * h));
+}
+
+/**
+ * Compare every kernel to the reference code.
+ * Returns 1 if all are within TOLERANCE.
+ */
+int verify(int verbose)
+{
+	mat4 identity4 = identity();
+	double err[14] = {0};
+	for (int i = 0; i < num_inputs; i++)
+	{
+		int j = (i + 1) % num_inputs;
+		double e;
+
+		GLfloat d = dotVec(&vecs[i], &vecs[j]);
+		e = fabs(d - refDotVec(&vecs[i], &vecs[j]));
+		err[0] = e > err[0] ? e : err[0];
+
+		vec4 v = crossVec(&vecs[i], &vecs[j]);
+		vec4 rv = refCrossVec(&vecs[i], &vecs[j]);
+		e = vecError(&v, &rv);
+		err[1] = e > err[1] ? e : err[1];
+
+		v = normalize(&vecs[i]);
+		rv = refNormalize(&vecs[i]);
+		e = vecError(&v, &rv);
+		err[2] = e > err[2] ? e : err[2];
+
+		mat4 m = transpose(&mats[i]);
+		mat4 rm = refTranspose(&mats[i]);
+		e = matError(&m, &rm);
+		err[3] = e > err[3] ? e : err[3];
+
+		v = multMatVec(&mats[i], &vecs[j]);
+		rv = refMultMatVec(&mats[i], &vecs[j]);
+		e = vecError(&v, &rv);
+		err[4] = e > err[4] ? e : err[4];
+
+		m = multMat(&mats[i], &mats[j]);
+		rm = refMultMat(&mats[i], &mats[j]);
+		e = matError(&m, &rm);
+		err[5] = e > err[5] ? e : err[5];
+
+		// Keep away from nearly singular matrices, where
+		// both methods are dominated by rounding
+		mat4 wellCond = multScalMat(&identity4, 4);
+		wellCond = addMat(&mats[i], &wellCond);
+		m = invMat(&wellCond);
+		rm = refInvMat(&wellCond);
+		e = matError(&m, &rm);
+		err[7] = e > err[7] ? e : err[7];
+
+		m = invAffine(&affines[i]);
+		rm = refInvMat(&affines[i]);
+		e = matError(&m, &rm);
+		err[8] = e > err[8] ? e : err[8];
+
+		m = invRigid(&rigids[i]);
+		rm = refInvMat(&rigids[i]);
+		e = matError(&m, &rm);
+		err[9] = e > err[9] ? e : err[9];
+	}
+
+	// Whole array at once, including in place
+	transformVec4Array(&mats[0], vecs, vout, num_inputs);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		vec4 rv = refMultMatVec(&mats[0], &vecs[i]);
+		double e = vecError(&vout[i], &rv);
+		err[6] = e > err[6] ? e : err[6];
+	}
+	transformVec4ArrayInPlace(&mats[1], vout, num_inputs);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		vec4 rv = refMultMatVec(&mats[0], &vecs[i]);
+		rv = refMultMatVec(&mats[1], &rv);
+		double e = vecError(&vout[i], &rv);
+		err[6] = e > err[6] ? e : err[6];
+	}
+
+	// The scramble and then each move undone, last first,
+	// should leave the cube solved, and a possible cube
+	// all the way
+	cubeState c;
+	cubeSolved(&c);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		cubeMove(&c, cube_moves[i]);
+		err[10] += !cubeCheck(&c);
+	}
+	for (int i = num_inputs - 1; i >= 0; i--)
+	{
+		int m = cube_moves[i];
+		cubeMove(&c, m - m % 3 + 2 - m % 3);
+	}
+	err[10] += !cubeIsSolved(&c);
+
+	// The SIMD texture paths have to give the scalar
+	// code's bytes exactly, at sizes with partial blocks
+	// and odd levels, and BC1 has to stay close
+	static const int sizes[][2] = {{1, 1}, {5, 3}, {37, 19}, {13, 200}, {64, 64}, {1024, 512}};
+	for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		textureMismatches(sizes[i][0], sizes[i][1], &err[11], &err[12]);
+	}
+	err[13] = bc1GradientError();
+
+	int ok = 1;
+	ok &= check("dotVec", err[0], verbose);
+	ok &= check("crossVec", err[1], verbose);
+	ok &= check("normalize", err[2], verbose);
+	ok &= check("transpose", err[3], verbose);
+	ok &= check("multMatVec", err[4], verbose);
+	ok &= check("multMat", err[5], verbose);
+	ok &= check("transformArr", err[6], verbose);
+	ok &= check("invMat", err[7], verbose);
+	ok &= check("invAffine", err[8], verbose);
+	ok &= check("invRigid", err[9], verbose);
+	ok &= check("cubeMove", err[10], verbose);
+	ok &= check("mipBuild", err[11], verbose);
+	ok &= check("bcEncode", err[12], verbose);
+	ok &= checkBound("bc1 RMSE", err[13], BC1_MAX_RMSE, verbose);
+	return ok;
+}
+
+// TIMING
+
+// Times one batch of work over the inputs
+typedef struct
+{
+	const char *name;
+	void (*run)(void);
+} Bench;
+
+// Summary of the samples taken for one benchmark
+typedef struct
+{
+	const char *name;
+	double mean;   // ns/op
+	double stddev; // ns/op
+	double min;    // ns/op
+	double mops;   // Millions of ops per second
+} Result;
+
+/**
+ * Defines bench_<name>, which does one op per input
+ */
+#define BENCH(name, body)                          \
+	void bench_##name(void)                        \
+	{                                              \
+		for (int i = 0; i < num_inputs; i++)       \
+		{                                          \
+			int j = (i + 1) & (num_inputs - 1);    \
+			(void)j;                               \
+			body;                                  \
+		}                                          \
+	}
+
+// VECTORS
+BENCH(v2, v2out[i] = v2(vecs[i].x, vecs[j].y))
+BENCH(v4, vout[i] = v4(vecs[i].x, vecs[j].y, vecs[i].z, vecs[j].w))
+BENCH(vecToArr, vecToArr(&vecs[i], &fout4[4 * i]))
+BENCH(arrToVec, arrToVec((GLfloat *)&vecs[j], &vout[i]))
+BENCH(equalVecs, fout[i] = equalVecs(&vecs[i], &vecs[j]))
+BENCH(multScalVec, vout[i] = multScalVec(&vecs[j], 1.5f))
+BENCH(addVec, vout[i] = addVec(&vecs[i], &vecs[j]))
+BENCH(subVec, vout[i] = subVec(&vecs[i], &vecs[j]))
+BENCH(magnitude, fout[i] = magnitude(&vecs[j]))
+BENCH(normalize, vout[i] = normalize(&vecs[j]))
+BENCH(dotVec, fout[i] = dotVec(&vecs[i], &vecs[j]))
+BENCH(crossVec, vout[i] = crossVec(&vecs[i], &vecs[j]))
+BENCH(angleBetween, fout[i] = angleBetween(&vecs[i], &vecs[j]))
+BENCH(product, vout[i] = product(&vecs[i], &vecs[j]))
+
+// MATRICES
+BENCH(m4, mout[i] = m4(vecs[i], vecs[j], vecs[i], vecs[j]))
+BENCH(equalMats, fout[i] = equalMats(&mats[i], &mats[j]))
+BENCH(matToArr, matToArr(&mats[j], &fout4[4 * (i & ~3)]))
+BENCH(arrToMat, mout[i] = arrToMat((GLfloat *)&mats[j]))
+BENCH(identity, mout[i] = identity())
+BENCH(multScalMat, mout[i] = multScalMat(&mats[j], 1.5f))
+BENCH(addMat, mout[i] = addMat(&mats[i], &mats[j]))
+BENCH(subMat, mout[i] = subMat(&mats[i], &mats[j]))
+BENCH(multMat, mout[i] = multMat(&mats[i], &mats[j]))
+BENCH(transpose, mout[i] = transpose(&mats[j]))
+BENCH(invMat, mout[i] = invMat(&mats[j]))
+BENCH(invAffine, mout[i] = invAffine(&affines[j]))
+BENCH(invRigid, mout[i] = invRigid(&rigids[j]))
+BENCH(minorMat, mout[i] = minorMat(&mats[j]))
+BENCH(cofactor, mout[i] = cofactor(&mats[j]))
+BENCH(det3x3, fout[i] = det3x3((GLfloat *)&mats[j]))
+BENCH(multMatVec, vout[i] = multMatVec(&mats[i], &vecs[j]))
+
+// Batched transform. One op is one vertex
+void bench_transformVec4Array(void)
+{
+	transformVec4Array(&mats[0], vecs, vout, num_inputs);
+}
+
+// AFFINE TRANSFORMATIONS AND ROTATIONS
+BENCH(translate, mout[i] = translate(vecs[j].x, vecs[j].y, vecs[j].z))
+BENCH(scale, mout[i] = scale(vecs[j].x, vecs[j].y, vecs[j].z))
+BENCH(x_rotate, mout[i] = x_rotate(vecs[j].x))
+BENCH(y_rotate, mout[i] = y_rotate(vecs[j].y))
+BENCH(z_rotate, mout[i] = z_rotate(vecs[j].z))
+
+// QUATERNIONS AND CAMERA
+BENCH(quatAxisAngle, qout[i] = quatAxisAngle(vecs[j], vecs[i].x))
+BENCH(quatMult, qout[i] = quatMult(&quats[i], &quats[j]))
+BENCH(quatConj, qout[i] = quatConj(&quats[j]))
+BENCH(quatNormalize, qout[i] = quatNormalize(&quats[j]))
+BENCH(quatSlerp, qout[i] = quatSlerp(&quats[i], &quats[j], 0.3f))
+BENCH(quatToMat, mout[i] = quatToMat(&quats[j]))
+BENCH(quatRotateVec, vout[i] = quatRotateVec(&quats[i], &vecs[j]))
+BENCH(cameraOrientation, qout[i] = cameraOrientation(&cams[j]))
+BENCH(cameraForward, vout[i] = cameraForward(&cams[j]))
+BENCH(cameraRight, vout[i] = cameraRight(&cams[j]))
+BENCH(cameraView, mout[i] = cameraView(&cams[j]))
+
+// PERSPECTIVE FUNCTIONS
+BENCH(look_at, mout[i] = look_at(vecs[i], vecs[j], v4(0, 1, 0, 0)))
+BENCH(perspective, mout[i] = perspective(-0.5, 0.5, -0.5, 0.5, vecs[j].x - 2, -100))
+
+// DYNAMIC LISTS
+// One op is one push onto a list that starts empty,
+// so this includes the cost of growing
+void bench_v4ListPush(void)
+{
+	v4List list;
+	v4ListNew(&list);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		v4ListPush(&list, vecs[i]);
+	}
+	vout[0] = list.items[list.length - 1];
+	v4ListFree(&list);
+}
+
+void bench_v2ListPush(void)
+{
+	v2List list;
+	v2ListNew(&list);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		v2ListPush(&list, v2out[i]);
+	}
+	v2out[0] = list.items[list.length - 1];
+	v2ListFree(&list);
+}
+
+// Same pushes into a list reserved up front
+void bench_v4ListReserve(void)
+{
+	v4List list;
+	v4ListNew(&list);
+	v4ListReserve(&list, num_inputs);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		v4ListPush(&list, vecs[i]);
+	}
+	vout[0] = list.items[list.length - 1];
+	v4ListFree(&list);
+}
+
+// Same pushes into a list backed by an arena
+void bench_v4ListArena(void)
+{
+	arena a;
+	arenaNew(&a, sizeof(vec4) * num_inputs * 2 + 64);
+	v4List list;
+	v4ListNewArena(&list, &a);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		v4ListPush(&list, vecs[i]);
+	}
+	vout[0] = list.items[list.length - 1];
+	arenaFree(&a);
+}
+
+// One op is one corner welded, with each distinct
+// vertex showing up about 6 times like a closed mesh
+void bench_welderAdd(void)
+{
+	welder w;
+	welderNew(&w, num_inputs / 6, GL_FALSE, GL_FALSE);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		welderAdd(&w, vecs[(i * 7) % (num_inputs / 6 + 1)], v2(0, 0), vecs[0]);
+	}
+	vout[0] = w.positions.items[w.indices.items[num_inputs - 1]];
+	welderFree(&w);
+}
+
+// One op is one index written and then narrowed to 16 bits
+void bench_packIndices(void)
+{
+	GLuint *idx = (GLuint *)fout4;
+	for (int i = 0; i < num_inputs; i++)
+	{
+		idx[i] = i & 0xffff;
+	}
+	packIndices(idx, num_inputs, 65536);
+	sink = ((GLushort *)idx)[num_inputs - 1];
+}
+
+// One op is one index of a 64 quad wide grid, reordered
+// for the vertex cache and then for fetching. The grid
+// goes in row order, which is already decent, so this
+// is close to the cost of a real mesh
+void bench_optimizeVertexCache(void)
+{
+	GLuint *idx = (GLuint *)fout4;
+	int n = num_inputs / 6 * 6;
+	for (int q = 0; q < n / 6; q++)
+	{
+		GLuint a = q / 64 * 65 + q % 64;
+		GLuint quad[6] = {a, a + 1, a + 66, a, a + 66, a + 65};
+		memcpy(&idx[6 * q], quad, sizeof(quad));
+	}
+	int num_vertices = (n / 6 / 64 + 2) * 65;
+	vec4 *positions = (vec4 *)calloc(num_vertices, sizeof(vec4));
+	optimizeVertexCache(idx, n, num_vertices);
+	sink = optimizeVertexFetch(idx, n, positions, NULL, NULL, num_vertices);
+	free(positions);
+}
+
+// One op is one index of a field of separate boxes, like
+// the proj3 city. Every box empties the cache, which is
+// where a rescan of the whole mesh would show up
+void bench_vertexCacheBoxes(void)
+{
+	// Corners of a box are numbered x + 2y + 4z
+	static const int box[6][4] = {
+		{0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+	GLuint *idx = (GLuint *)fout4;
+	int num_boxes = num_inputs / 36;
+	int n = 36 * num_boxes;
+	for (int b = 0; b < num_boxes; b++)
+	{
+		for (int f = 0; f < 6; f++)
+		{
+			const int *q = box[f];
+			GLuint quad[6] = {8 * b + q[0], 8 * b + q[1], 8 * b + q[2],
+							  8 * b + q[0], 8 * b + q[2], 8 * b + q[3]};
+			memcpy(&idx[36 * b + 6 * f], quad, sizeof(quad));
+		}
+	}
+	optimizeVertexCache(idx, n, 8 * num_boxes);
+	sink = n ? idx[n - 1] : 0;
+}
+
+// OBJ LOADING
+// A city of num_inputs box buildings, written to a temporary
+// file the first time it's needed. Odd buildings use
+// negative (relative) indices like some exporters write
+char city_file[] = "/tmp/benchCityXXXXXX";
+int city_written = 0;
+
+void removeCity(void)
+{
+	unlink(city_file);
+}
+
+void writeCity(void)
+{
+	if (city_written)
+		return;
+	int fd = mkstemp(city_file);
+	FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f)
+	{
+		printf("Error creating %s\n", city_file);
+		exit(1);
+	}
+	atexit(removeCity);
+
+	// Corners of a box are numbered x + 2y + 4z
+	static const int box[6][4] = {
+		{0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+	int side = (int)sqrt(num_inputs);
+	fprintf(f, "# Generated city, %d buildings\n", num_inputs);
+	for (int b = 0; b < num_inputs; b++)
+	{
+		GLfloat x = 3.0f * (b % side), z = -3.0f * (b / side);
+		GLfloat h = 1 + (b * 37 % 11) * 0.75f;
+		for (int c = 0; c < 8; c++)
+		{
+			fprintf(f, "v %.4f %.4f %.4f\n", x + 2 * (c & 1), h * ((c >> 1) & 1), z - 2 * (c >> 2));
+		}
+		fprintf(f, "vt 0.0 0.0\nvt 1.0 0.0\nvt 1.0 %.3f\nvt 0.0 %.3f\n", h / 8, h / 8);
+		for (int q = 0; q < 6; q++)
+		{
+			fprintf(f, "f");
+			for (int k = 0; k < 4; k++)
+			{
+				if (b & 1)
+					fprintf(f, " %d/%d", box[q][k] - 8, k - 4);
+				else
+					fprintf(f, " %d/%d", 8 * b + box[q][k] + 1, 4 * b + k + 1);
+			}
+			fprintf(f, "\n");
+		}
+	}
+	fclose(f);
+	city_written = 1;
+}
+
+// One op is one building of the generated city, which
+// is 8 v, 4 vt and 6 f lines
+void bench_objLoad(void)
+{
+	writeCity();
+	objMesh mesh;
+	objLoad(&mesh, city_file, 0);
+	vout[0] = mesh.positions[mesh.num_positions - 1];
+	objFree(&mesh);
+}
+
+// Same on one thread
+void bench_objLoad1(void)
+{
+	writeCity();
+	objMesh mesh;
+	objLoad(&mesh, city_file, 1);
+	vout[0] = mesh.positions[mesh.num_positions - 1];
+	objFree(&mesh);
+}
+
+// PLY LOADING
+// A colored grid of num_inputs triangles, written once
+// per format to a temporary file when first needed
+char ply_files[3][32] = {"/tmp/benchPlyXXXXXX", "/tmp/benchPlyXXXXXX", "/tmp/benchPlyXXXXXX"};
+int ply_written[3];
+u32List ply_faces;
+
+void removePly(void)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		if (ply_written[i])
+			unlink(ply_files[i]);
+	}
+}
+
+void writePly(plyFormat format)
+{
+	if (ply_written[format])
+		return;
+	int fd = mkstemp(ply_files[format]);
+	FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f)
+	{
+		printf("Error creating %s\n", ply_files[format]);
+		exit(1);
+	}
+	if (!ply_written[0] && !ply_written[1] && !ply_written[2])
+		atexit(removePly);
+	ply_written[format] = 1;
+
+	// num_inputs is a power of two, so w * h quads make
+	// exactly num_inputs triangles
+	int w = 1, h = num_inputs / 2;
+	while (w < h)
+	{
+		w *= 2;
+		h /= 2;
+	}
+	const char *names[] = {"ascii", "binary_little_endian", "binary_big_endian"};
+	fprintf(f, "ply\nformat %s 1.0\nelement vertex %d\n", names[format], (w + 1) * (h + 1));
+	fprintf(f, "property float x\nproperty float y\nproperty float z\n");
+	fprintf(f, "property uchar red\nproperty uchar green\nproperty uchar blue\n");
+	fprintf(f, "element face %d\nproperty list uchar int vertex_indices\nend_header\n", num_inputs);
+
+	const int one = 1;
+	int swap = (format == PLY_BINARY_BIG_ENDIAN) == (*(const char *)&one == 1);
+	for (int y = 0; y <= h; y++)
+	{
+		for (int x = 0; x <= w; x++)
+		{
+			GLfloat pos[3] = {(GLfloat)x / w, (GLfloat)y / h, randFloat()};
+			unsigned char color[3] = {x & 255, y & 255, (x ^ y) & 255};
+			if (format == PLY_ASCII)
+			{
+				fprintf(f, "%g %g %g %d %d %d\n", pos[0], pos[1], pos[2], color[0], color[1], color[2]);
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint bits;
+				memcpy(&bits, &pos[k], 4);
+				bits = swap ? __builtin_bswap32(bits) : bits;
+				fwrite(&bits, 4, 1, f);
+			}
+			fwrite(color, 1, 3, f);
+		}
+	}
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			GLuint a = y * (w + 1) + x;
+			GLuint tris[2][3] = {{a, a + 1, a + w + 2}, {a, a + w + 2, a + w + 1}};
+			for (int t = 0; t < 2; t++)
+			{
+				if (format == PLY_ASCII)
+				{
+					fprintf(f, "3 %u %u %u\n", tris[t][0], tris[t][1], tris[t][2]);
+					continue;
+				}
+				fputc(3, f);
+				for (int k = 0; k < 3; k++)
+				{
+					GLuint index = swap ? __builtin_bswap32(tris[t][k]) : tris[t][k];
+					fwrite(&index, 4, 1, f);
+				}
+			}
+		}
+	}
+	fclose(f);
+}
+
+// Read positions, colors and faces the way proj2 does
+void loadPly(plyFormat format)
+{
+	writePly(format);
+	plyFile ply;
+	plyOpen(&ply, ply_files[format]);
+	plyElement *e = plyFindElement(&ply, "vertex");
+	vec4 *positions = vout;
+	vec4 *colors = (vec4 *)mout;
+	plyReadFloats(&ply, e, "x", 1, &positions[0].x, 4);
+	plyReadFloats(&ply, e, "y", 1, &positions[0].y, 4);
+	plyReadFloats(&ply, e, "z", 1, &positions[0].z, 4);
+	plyReadFloats(&ply, e, "red", 1 / 255.0, &colors[0].x, 4);
+	plyReadFloats(&ply, e, "green", 1 / 255.0, &colors[0].y, 4);
+	plyReadFloats(&ply, e, "blue", 1 / 255.0, &colors[0].z, 4);
+	u32ListClear(&ply_faces);
+	plyReadFaces(&ply, plyFindElement(&ply, "face"), NULL, e->count, &ply_faces);
+	plyClose(&ply);
+}
+
+// One op is one triangle of the grid, with about half
+// a vertex to go with it
+void bench_plyLoad(void)
+{
+	loadPly(PLY_BINARY_LITTLE_ENDIAN);
+}
+
+void bench_plyLoadBigEndian(void)
+{
+	loadPly(PLY_BINARY_BIG_ENDIAN);
+}
+
+void bench_plyLoadAscii(void)
+{
+	loadPly(PLY_ASCII);
+}
+
+// TEXTURE LOADING
+// A headerless RGB8 texture, 16 texels per input so the
+// default is the size of proj3's city.data, written to
+// a temporary file the first time it's needed
+#define TEXELS_PER_INPUT 16
+char texture_file[] = "/tmp/benchTexXXXXXX";
+int texture_written = 0;
+
+void removeTexture(void)
+{
+	unlink(texture_file);
+}
+
+void writeTexture(void)
+{
+	if (texture_written)
+		return;
+	int fd = mkstemp(texture_file);
+	FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!f)
+	{
+		printf("Error creating %s\n", texture_file);
+		exit(1);
+	}
+	atexit(removeTexture);
+	texture_written = 1;
+	for (long i = 0; i < 3L * TEXELS_PER_INPUT * num_inputs; i++)
+	{
+		fputc(i * 7 & 255, f);
+	}
+	fclose(f);
+}
+
+// Width and height of the texture, as square as the
+// power of two texel count allows
+void textureSize(int *width, int *height)
+{
+	int w = 1, h = TEXELS_PER_INPUT * num_inputs;
+	while (w < h)
+	{
+		w *= 2;
+		h /= 2;
+	}
+	*width = w;
+	*height = h;
+}
+
+// Stand in for glTexImage2D reading every texel
+GLfloat sumTexels(const GLubyte *texels, size_t n)
+{
+	unsigned sum = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		sum += texels[i];
+	}
+	return sum;
+}
+
+// One op is 16 texels, read into a buffer the way
+// the projects used to load textures
+void bench_textureRead(void)
+{
+	writeTexture();
+	size_t size = 3L * TEXELS_PER_INPUT * num_inputs;
+	GLubyte *texels = (GLubyte *)malloc(size);
+	FILE *f = fopen(texture_file, "r");
+	fread(texels, size, 1, f);
+	fclose(f);
+	sink = sumTexels(texels, size);
+	free(texels);
+}
+
+// Same through lib/textureFile.c
+void bench_textureMap(void)
+{
+	writeTexture();
+	textureFile tex;
+	int w, h;
+	textureSize(&w, &h);
+	textureOpen(&tex, texture_file, w, h);
+	sink = sumTexels(tex.texels, 3L * tex.width * tex.height);
+	textureClose(&tex);
+}
+
+// One op is 16 texels of level 0, made into every
+// level below it
+void bench_mipBuild(void)
+{
+	writeTexture();
+	textureFile tex;
+	int w, h;
+	textureSize(&w, &h);
+	textureOpen(&tex, texture_file, w, h);
+	mipChain mips;
+	mipBuild(&mips, &tex, 0);
+	sink = mips.levels[mips.num_levels - 1][0];
+	mipFree(&mips);
+	textureClose(&tex);
+}
+
+// Same on one thread
+void bench_mipBuild1(void)
+{
+	writeTexture();
+	textureFile tex;
+	int w, h;
+	textureSize(&w, &h);
+	textureOpen(&tex, texture_file, w, h);
+	mipChain mips;
+	mipBuild(&mips, &tex, 1);
+	sink = mips.levels[mips.num_levels - 1][0];
+	mipFree(&mips);
+	textureClose(&tex);
+}
+
+// One op is 16 texels of level 0 block compressed
+// to BC1, on every core
+void bench_bcEncode(void)
+{
+	writeTexture();
+	textureFile tex;
+	int w, h;
+	textureSize(&w, &h);
+	textureOpen(&tex, texture_file, w, h);
+	GLubyte *out = (GLubyte *)malloc(bcLevelSize(BC1, tex.width, tex.height));
+	bcEncode(tex.texels, tex.width, tex.height, 3, BC1, out, 0);
+	sink = out[0];
+	free(out);
+	textureClose(&tex);
+}
+
+// One op is one move of the scramble applied to a 3x3x3
+// cube, each waiting on the last
+void bench_cubeMove(void)
+{
+	cubeState c;
+	cubeSolved(&c);
+	for (int i = 0; i < num_inputs; i++)
+	{
+		cubeMove(&c, cube_moves[i]);
+	}
+	sink = c.corners ^ c.edges[0] ^ c.edges[1];
+}
+
+// One op is one 64 byte allocation, rolled back
+// to a mark every 64 allocations
+void bench_arenaAlloc(void)
+{
+	arena a;
+	arenaNew(&a, 64 * 80);
+	arenaPos start = arenaMark(&a);
+	vec4 *v = NULL;
+	for (int i = 0; i < num_inputs; i++)
+	{
+		if ((i & 63) == 0)
+			arenaReset(&a, start);
+		v = (vec4 *)arenaAlloc(&a, 64);
+		v[0] = vecs[i];
+	}
+	vout[0] = v[0];
+	arenaFree(&a);
+}
+
+// One op is one vec4 copied by a bulk append
+void bench_v4ListAppend(void)
+{
+	v4List list;
+	v4ListNew(&list);
+	v4ListAppend(&list, vecs, num_inputs);
+	vout[0] = list.items[list.length - 1];
+	v4ListFree(&list);
+}
+
+Bench benches[] = {
+	{"v2", bench_v2},
+	{"v4", bench_v4},
+	{"vecToArr", bench_vecToArr},
+	{"arrToVec", bench_arrToVec},
+	{"equalVecs", bench_equalVecs},
+	{"multScalVec", bench_multScalVec},
+	{"addVec", bench_addVec},
+	{"subVec", bench_subVec},
+	{"magnitude", bench_magnitude},
+	{"normalize", bench_normalize},
+	{"dotVec", bench_dotVec},
+	{"crossVec", bench_crossVec},
+	{"angleBetween", bench_angleBetween},
+	{"product", bench_product},
+	{"m4", bench_m4},
+	{"equalMats", bench_equalMats},
+	{"matToArr", bench_matToArr},
+	{"arrToMat", bench_arrToMat},
+	{"identity", bench_identity},
+	{"multScalMat", bench_multScalMat},
+	{"addMat", bench_addMat},
+	{"subMat", bench_subMat},
+	{"multMat", bench_multMat},
+	{"transpose", bench_transpose},
+	{"invMat", bench_invMat},
+	{"invAffine", bench_invAffine},
+	{"invRigid", bench_invRigid},
+	{"minorMat", bench_minorMat},
+	{"cofactor", bench_cofactor},
+	{"det3x3", bench_det3x3},
+	{"multMatVec", bench_multMatVec},
+	{"transformVec4Array", bench_transformVec4Array},
+	{"translate", bench_translate},
+	{"scale", bench_scale},
+	{"x_rotate", bench_x_rotate},
+	{"y_rotate", bench_y_rotate},
+	{"z_rotate", bench_z_rotate},
+	{"quatAxisAngle", bench_quatAxisAngle},
+	{"quatMult", bench_quatMult},
+	{"quatConj", bench_quatConj},
+	{"quatNormalize", bench_quatNormalize},
+	{"quatSlerp", bench_quatSlerp},
+	{"quatToMat", bench_quatToMat},
+	{"quatRotateVec", bench_quatRotateVec},
+	{"cameraOrientation", bench_cameraOrientation},
+	{"cameraForward", bench_cameraForward},
+	{"cameraRight", bench_cameraRight},
+	{"cameraView", bench_cameraView},
+	{"look_at", bench_look_at},
+	{"perspective", bench_perspective},
+	{"v4ListPush", bench_v4ListPush},
+	{"v2ListPush", bench_v2ListPush},
+	{"v4ListReserve", bench_v4ListReserve},
+	{"v4ListArena", bench_v4ListArena},
+	{"v4ListAppend", bench_v4ListAppend},
+	{"arenaAlloc", bench_arenaAlloc},
+	{"welderAdd", bench_welderAdd},
+	{"packIndices", bench_packIndices},
+	{"optimizeVertexCache", bench_optimizeVertexCache},
+	{"vertexCacheBoxes", bench_vertexCacheBoxes},
+	{"objLoad", bench_objLoad},
+	{"objLoad1", bench_objLoad1},
+	{"plyLoad", bench_plyLoad},
+	{"plyLoadBigEndian", bench_plyLoadBigEndian},
+	{"plyLoadAscii", bench_plyLoadAscii},
+	{"textureRead", bench_textureRead},
+	{"textureMap", bench_textureMap},
+	{"mipBuild", bench_mipBuild},
+	{"mipBuild1", bench_mipBuild1},
+	{"bcEncode", bench_bcEncode},
+	{"cubeMove", bench_cubeMove},
+};
+
+/**
+ * Take num_samples timings of a benchmark. Each sample
+ * repeats the batch enough times to run for at least
+ * SAMPLE_NS so the clock resolution doesn't matter.
+ */
+Result runBench(Bench *b)
+{
+	Result r = {b->name, 0, 0, 1e30, 0};
+
+	// Warm up caches and find how many batches fill a sample
+	int reps = 1;
+	double t = now();
+	b->run();
+	double batch = now() - t;
+	if (batch < SAMPLE_NS)
+	{
+		reps = (int)(SAMPLE_NS / (batch > 1 ? batch : 1)) + 1;
+	}
+
+	double sum = 0, sum_sq = 0;
+	for (int s = 0; s < num_samples; s++)
+	{
+		t = now();
+		for (int k = 0; k < reps; k++)
+		{
+			b->run();
+		}
+		double ns = (now() - t) / ((double)reps * num_inputs);
+		sum += ns;
+		sum_sq += ns * ns;
+		r.min = ns < r.min ? ns : r.min;
+	}
+
+	r.mean = sum / num_samples;
+	double var = sum_sq / num_samples - r.mean * r.mean;
+	r.stddev = var > 0 ? sqrt(var) : 0;
+	r.mops = 1e3 / r.mean;
+	sink = fout[1] + vout[2].x + mout[3].y.z + qout[4].w + v2out[5].x + fout4[6];
+	return r;
+}
+
+/**
+ * Name of the backend lib.c was most likely built with
+ */
+const char *backend(void)
+{
+#if !LIB_SSE
+	return "scalar";
+#elif LIB_AVX
+	return "avx";
+#else
+	return "sse";
+#endif
+}
+
+void printResults(Result *res, int n, Format format)
+{
+	switch (format)
+	{
+	case CSV:
+		printf("name,mean_ns,stddev_ns,min_ns,mops_per_s,backend,inputs,samples\n");
+		for (int i = 0; i < n; i++)
+		{
+			printf("%s,%.3f,%.3f,%.3f,%.2f,%s,%d,%d\n", res[i].name, res[i].mean,
+				   res[i].stddev, res[i].min, res[i].mops, backend(), num_inputs, num_samples);
+		}
+		break;
+	case JSON:
+		printf("{\n  \"backend\": \"%s\",\n  \"inputs\": %d,\n  \"samples\": %d,\n  \"results\": [\n",
+			   backend(), num_inputs, num_samples);
+		for (int i = 0; i < n; i++)
+		{
+			printf("    {\"name\": \"%s\", \"mean_ns\": %.3f, \"stddev_ns\": %.3f, "
+				   "\"min_ns\": %.3f, \"mops_per_s\": %.2f}%s\n",
+				   res[i].name, res[i].mean, res[i].stddev, res[i].min, res[i].mops,
+				   i < n - 1 ? "," : "");
+		}
+		printf("  ]\n}\n");
+		break;
+	case TABLE:
+	default:
+		printf("\nTiming (%s backend, %d inputs, %d samples)\n", backend(), num_inputs, num_samples);
+		printf("--------------------------------------------------------------------\n");
+		printf("%-20s %10s %10s %10s %12s\n", "function", "ns/op", "stddev", "min", "Mops/s");
+		for (int i = 0; i < n; i++)
+		{
+			printf("%-20s %10.2f %10.2f %10.2f %12.1f\n", res[i].name, res[i].mean,
+				   res[i].stddev, res[i].min, res[i].mops);
+		}
+		printf("\n");
+		break;
+	}
+}
+
+void usage(const char *prog)
+{
+	printf("Usage: %s [--csv | --json] [-n inputs] [-s samples] [name ...]\n", prog);
+	printf("  --csv, --json  Print results as CSV or JSON instead of a table\n");
+	printf("  -n inputs      Batch size, rounded up to a power of two (default %d)\n", DEFAULT_INPUTS);
+	printf("  -s samples     Timed samples per function (default %d)\n", DEFAULT_SAMPLES);
+	printf("  name ...       Only run functions whose names contain one of these\n");
+}
+
+int main(int argc, char **argv)
+{
+	Format format = TABLE;
+	char **filters = (char **)malloc(sizeof(char *) * argc);
+	int num_filters = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--csv"))
+			format = CSV;
+		else if (!strcmp(argv[i], "--json"))
+			format = JSON;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			num_inputs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			num_samples = atoi(argv[++i]);
+		else if (argv[i][0] == '-')
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		else
+			filters[num_filters++] = argv[i];
+	}
+
+	// Inputs are indexed with a mask so keep to a power of two
+	int n = 16;
+	while (n < num_inputs)
+		n *= 2;
+	num_inputs = n;
+	if (num_samples < 2)
+		num_samples = 2;
+
+	allocInputs();
+
+	// Only print the check in table mode so CSV/JSON
+	// output can be piped straight into a file
+	if (format == TABLE)
+	{
+		printf("\nChecking against scalar reference\n");
+		printf("------------------------------------------------\n");
+	}
+	if (!verify(format == TABLE))
+	{
+		fprintf(stderr, "\nResults don't match the reference code\n");
+		return 1;
+	}
+
+	int num_benches = sizeof(benches) / sizeof(benches[0]);
+	Result *results = (Result *)malloc(sizeof(Result) * num_benches);
+	int num_results = 0;
+	for (int i = 0; i < num_benches; i++)
+	{
+		int selected = (num_filters == 0);
+		for (int f = 0; f < num_filters; f++)
+		{
+			selected |= strstr(benches[i].name, filters[f]) != NULL;
+		}
+		if (selected)
+		{
+			results[num_results++] = runBench(&benches[i]);
+		}
+	}
+
+	printResults(results, num_results, format);
+
+	free(results);
+	free(filters);
+	return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * scalarBcEncode.c
+ *
+ * lib/bcEncode.c again with LIB_NO_SIMD, its functions
+ * renamed so they link next to the SIMD build. bench
+ * checks the SIMD path's output against this one.
+ */
+
+#ifndef LIB_NO_SIMD
+#define LIB_NO_SIMD
+#endif
+#define bcLevelSize scalarBcLevelSize
+#define bcEncode scalarBcEncode
+#define bcBuild scalarBcBuild
+#define bcLoad scalarBcLoad
+#define bcSave scalarBcSave
+#define bcTextureFor scalarBcTextureFor
+#define bcFree scalarBcFree
+
+#include "../lib/bcEncode.c"
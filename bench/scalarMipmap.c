@@ -0,0 +1,19 @@
+/*
+ * scalarMipmap.c
+ *
+ * lib/mipmap.c again with LIB_NO_SIMD, its functions
+ * renamed so they link next to the SIMD build. bench
+ * checks the SIMD path's output against this one.
+ */
+
+#ifndef LIB_NO_SIMD
+#define LIB_NO_SIMD
+#endif
+#define mipLevelDims scalarMipLevelDims
+#define mipBuild scalarMipBuild
+#define mipLoad scalarMipLoad
+#define mipSave scalarMipSave
+#define mipChainFor scalarMipChainFor
+#define mipFree scalarMipFree
+
+#include "../lib/mipmap.c"
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <time.h>
 #include "../lib/initShader.h"
+#include "../lib/textureFile.h"
+#include "../lib/textureUpload.h"
 
 #define BUFFER_OFFSET( offset )   ((GLvoid*) (offset))
 
@@ -50,14 +52,10 @@ vec2 tex_coords[6] = {{0.0, 1.0}, {1.0, 1.0}, {1.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}
 
 void init(void)
 {
-    int width = 320;
-    int height = 320;
-    GLubyte my_texels[width][height][3];
-
-    // FILE *fp = fopen("texture01.raw", "r");
-    FILE *fp = fopen("wall.raw", "r");
-    fread(my_texels, width * height * 3, 1, fp);
-    fclose(fp);
+    // Uploaded straight from the file mapping
+    // textureOpen(&tex, "texture01.raw", 320, 320);
+    textureFile tex;
+    textureOpen(&tex, "wall.raw", 320, 320);
 
     GLuint program = initShader("vshader.glsl", "fshader.glsl");
     glUseProgram(program);
@@ -65,14 +63,17 @@ void init(void)
     GLuint mytex[1];
     glGenTextures(1, mytex);
     glBindTexture(GL_TEXTURE_2D, mytex[0]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, my_texels);
+    // Mip levels from the cache next to the texture,
+    // or made now and cached, compressed if the GL can
+    textureUpload(&tex, "wall.raw");
     glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
     glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
     int param;
     glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &param);
+    textureClose(&tex);
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
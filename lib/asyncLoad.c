@@ -0,0 +1,52 @@
+// CLOCK_MONOTONIC is POSIX, not C99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include "asyncLoad.h"
+
+// Thread body: run the load, then publish that it's done.
+// The release store makes everything the load wrote
+// visible to whoever sees done set
+static void *runLoad(void *arg)
+{
+	asyncLoad *l = (asyncLoad *)arg;
+	l->load();
+	l->elapsed = msSince(&l->start);
+	__atomic_store_n(&l->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+ * Start running load on a new thread. Exits with a
+ * message if the thread can't be started
+ */
+void asyncLoadStart(asyncLoad *l, void (*load)(void))
+{
+	l->load = load;
+	l->done = 0;
+	l->joined = GL_FALSE;
+	l->elapsed = 0;
+	clock_gettime(CLOCK_MONOTONIC, &l->start);
+	if (pthread_create(&l->thread, NULL, runLoad, l))
+	{
+		printf("Error starting loading thread\n");
+		exit(1);
+	}
+}
+
+/**
+ * Whether the load has finished. Never blocks, so it can
+ * be polled from a GLUT callback. The thread is joined
+ * the first time this sees it done
+ */
+int asyncLoadDone(asyncLoad *l)
+{
+	if (!__atomic_load_n(&l->done, __ATOMIC_ACQUIRE))
+		return 0;
+	if (!l->joined)
+	{
+		pthread_join(l->thread, NULL);
+		l->joined = GL_TRUE;
+	}
+	return 1;
+}
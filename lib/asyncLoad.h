@@ -0,0 +1,24 @@
+#ifndef ASYNC_LOAD_H
+#define ASYNC_LOAD_H
+
+#include <pthread.h>
+#include "lib.h"
+#include "msClock.h"
+
+// A load running on its own thread. Whatever it writes
+// belongs to it until asyncLoadDone says it's finished,
+// after which the main thread can use it
+typedef struct
+{
+	pthread_t thread;
+	void (*load)(void);
+	int done;
+	GLboolean joined;
+	struct timespec start;
+	double elapsed; // ms the load took, set when done
+} asyncLoad;
+
+void asyncLoadStart(asyncLoad *l, void (*load)(void));
+int asyncLoadDone(asyncLoad *l);
+
+#endif
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bcEncode.h"
+#include "cacheFile.h"
+#include "libSimd.h"
+
+// Levels with fewer blocks than this are encoded on
+// one thread
+#define MIN_THREADED_BLOCKS 4096
+#define MAX_THREADS 16
+
+// Bump when the layout below changes
+#define BC_CACHE_VERSION 1
+#define BC_CACHE_MAGIC 0x58544342 // "BCTX" when little endian
+
+// The cache file is this header followed by every level,
+// back to back. It's tied to its source by the source's
+// size and modification time, like the mip cache
+typedef struct
+{
+	GLuint magic;
+	GLuint version;
+	GLint format;
+	GLint pad;
+	cacheStamp source;
+	GLint width;
+	GLint height;
+	GLint num_levels;
+	GLint pad2;
+	unsigned long long file_size;
+} bcCacheHeader;
+
+// Rows of blocks [first_row, last_row) of one level
+typedef struct
+{
+	const GLubyte *texels;
+	int width, height, bpp;
+	bcFormat format;
+	GLubyte *out;
+	int first_row, last_row;
+} bcJob;
+
+/**
+ * Bytes in one level of a block compressed texture.
+ * Partial blocks at the edges take a whole block
+ */
+size_t bcLevelSize(bcFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * (format == BC1 ? 8 : 16);
+}
+
+// Copy a 4x4 block to RGBA. Texels past the edge
+// repeat the last row or column
+static void loadBlock(const bcJob *job, int bx, int by, GLubyte *block)
+{
+	for (int y = 0; y < 4; y++)
+	{
+		int sy = 4 * by + y < job->height ? 4 * by + y : job->height - 1;
+		for (int x = 0; x < 4; x++)
+		{
+			int sx = 4 * bx + x < job->width ? 4 * bx + x : job->width - 1;
+			const GLubyte *p = job->texels + ((size_t)sy * job->width + sx) * job->bpp;
+			GLubyte *q = block + 4 * (4 * y + x);
+			q[0] = p[0];
+			q[1] = p[1];
+			q[2] = p[2];
+			q[3] = job->bpp == 4 ? p[3] : 255;
+		}
+	}
+}
+
+// 8 bit color to 5:6:5 with rounding, and back the way
+// the hardware expands it
+static int to565(const int *c)
+{
+	return ((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | (c[2] * 31 + 127) / 255;
+}
+
+static void from565(int v, int *c)
+{
+	int r = v >> 11 & 31, g = v >> 5 & 63, b = v & 31;
+	c[0] = r << 3 | r >> 2;
+	c[1] = g << 2 | g >> 4;
+	c[2] = b << 3 | b >> 2;
+}
+
+// Ends of the color line: the bounding box of the block,
+// along whichever diagonal follows how the channels vary
+// together, pulled in by 1/16 of its size. min and max
+// are found 4 texels at a time
+static void colorEndpoints(const GLubyte *block, int *lo, int *hi)
+{
+	int mn[3], mx[3];
+#if LIB_SSE
+	__m128i vmin = _mm_loadu_si128((const __m128i *)block);
+	__m128i vmax = vmin;
+	for (int i = 1; i < 4; i++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+		vmin = _mm_min_epu8(vmin, v);
+		vmax = _mm_max_epu8(vmax, v);
+	}
+	vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(1, 0, 3, 2)));
+	vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(2, 3, 0, 1)));
+	vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+	vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+	int min_bits = _mm_cvtsi128_si32(vmin), max_bits = _mm_cvtsi128_si32(vmax);
+	for (int c = 0; c < 3; c++)
+	{
+		mn[c] = min_bits >> (8 * c) & 255;
+		mx[c] = max_bits >> (8 * c) & 255;
+	}
+#else
+	for (int c = 0; c < 3; c++)
+	{
+		mn[c] = mx[c] = block[c];
+	}
+	for (int i = 1; i < 16; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int v = block[4 * i + c];
+			mn[c] = v < mn[c] ? v : mn[c];
+			mx[c] = v > mx[c] ? v : mx[c];
+		}
+	}
+#endif
+
+	// Flip any channel that falls while the widest one rises
+	int major = 0;
+	for (int c = 1; c < 3; c++)
+	{
+		major = mx[c] - mn[c] > mx[major] - mn[major] ? c : major;
+	}
+	int cov[3] = {0, 0, 0};
+	for (int i = 0; i < 16; i++)
+	{
+		int m = 2 * block[4 * i + major] - mn[major] - mx[major];
+		for (int c = 0; c < 3; c++)
+		{
+			cov[c] += m * (2 * block[4 * i + c] - mn[c] - mx[c]);
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		int inset = (mx[c] - mn[c]) >> 4;
+		lo[c] = mn[c] + inset;
+		hi[c] = mx[c] - inset;
+		if (cov[c] < 0)
+		{
+			int t = lo[c];
+			lo[c] = hi[c];
+			hi[c] = t;
+		}
+	}
+}
+
+// For each texel, which of 4 evenly spaced points from
+// e0 (0) to e1 (3) it's nearest along the line between
+// them. Written as one byte per texel
+static void colorSteps(const GLubyte *block, const int *e0, const int *e1, GLubyte *steps)
+{
+	int axis[3] = {e1[0] - e0[0], e1[1] - e0[1], e1[2] - e0[2]};
+	int len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	if (len2 == 0)
+	{
+		memset(steps, 0, 16);
+		return;
+	}
+	int start = e0[0] * axis[0] + e0[1] * axis[1] + e0[2] * axis[2];
+	float scale = 3.0f / len2;
+#if LIB_SSE
+	// Dot products of 4 texels at a time with the axis,
+	// in 16 bit multiplies summed to 32 bits
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ax = _mm_set_epi16(0, axis[2], axis[1], axis[0], 0, axis[2], axis[1], axis[0]);
+	const __m128i vstart = _mm_set1_epi32(start);
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128i t[4];
+	for (int i = 0; i < 4; i++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), ax);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), ax);
+		// Each texel's two halves are adjacent, add them
+		// and gather the sums into one vector
+		lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+		hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+		__m128i dots = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+										  _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+		__m128 f = _mm_cvtepi32_ps(_mm_sub_epi32(dots, vstart));
+		t[i] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, vscale), half));
+	}
+	__m128i t01 = _mm_packs_epi32(t[0], t[1]);
+	__m128i t23 = _mm_packs_epi32(t[2], t[3]);
+	t01 = _mm_min_epi16(_mm_max_epi16(t01, zero), _mm_set1_epi16(3));
+	t23 = _mm_min_epi16(_mm_max_epi16(t23, zero), _mm_set1_epi16(3));
+	_mm_storeu_si128((__m128i *)steps, _mm_packus_epi16(t01, t23));
+#else
+	for (int i = 0; i < 16; i++)
+	{
+		const GLubyte *p = block + 4 * i;
+		int d = p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2] - start;
+		int t = (int)((float)d * scale + 0.5f);
+		steps[i] = t < 0 ? 0 : t > 3 ? 3 : t;
+	}
+#endif
+}
+
+// 8 byte BC1 color block
+static void encodeColor(const GLubyte *block, GLubyte *out)
+{
+	int lo[3], hi[3];
+	colorEndpoints(block, lo, hi);
+	int c0 = to565(hi), c1 = to565(lo);
+	GLuint bits = 0;
+	if (c0 != c1)
+	{
+		// Palette order is c0, c1, 2/3 c0 + 1/3 c1,
+		// 1/3 c0 + 2/3 c1. It's only 4 colors when
+		// c0 > c1, so swap the ends if they're backwards
+		if (c0 < c1)
+		{
+			int t = c0;
+			c0 = c1;
+			c1 = t;
+		}
+		int e0[3], e1[3];
+		from565(c0, e0);
+		from565(c1, e1);
+		GLubyte steps[16];
+		colorSteps(block, e0, e1, steps);
+		static const GLubyte code[4] = {0, 2, 3, 1};
+		for (int i = 15; i >= 0; i--)
+		{
+			bits = bits << 2 | code[steps[i]];
+		}
+	}
+	out[0] = c0 & 255;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 255;
+	out[3] = c1 >> 8;
+	out[4] = bits & 255;
+	out[5] = bits >> 8 & 255;
+	out[6] = bits >> 16 & 255;
+	out[7] = bits >> 24;
+}
+
+// 8 byte BC3 alpha block, in the mode with 6 steps
+// between the min and max alpha
+static void encodeAlpha(const GLubyte *block, GLubyte *out)
+{
+	int a0 = block[3], a1 = block[3];
+	for (int i = 1; i < 16; i++)
+	{
+		int a = block[4 * i + 3];
+		a0 = a > a0 ? a : a0;
+		a1 = a < a1 ? a : a1;
+	}
+	unsigned long long bits = 0;
+	if (a0 != a1)
+	{
+		// Steps from a0 (0) to a1 (7), in palette order
+		static const GLubyte code[8] = {0, 2, 3, 4, 5, 6, 7, 1};
+		for (int i = 15; i >= 0; i--)
+		{
+			int t = ((a0 - block[4 * i + 3]) * 7 + (a0 - a1) / 2) / (a0 - a1);
+			bits = bits << 3 | code[t];
+		}
+	}
+	out[0] = a0;
+	out[1] = a1;
+	for (int i = 0; i < 6; i++)
+	{
+		out[2 + i] = bits >> (8 * i) & 255;
+	}
+}
+
+static void *runJob(void *arg)
+{
+	bcJob *job = (bcJob *)arg;
+	int blocks_wide = (job->width + 3) / 4;
+	int block_size = job->format == BC1 ? 8 : 16;
+	GLubyte block[64];
+	for (int by = job->first_row; by < job->last_row; by++)
+	{
+		GLubyte *out = job->out + (size_t)by * blocks_wide * block_size;
+		for (int bx = 0; bx < blocks_wide; bx++)
+		{
+			loadBlock(job, bx, by, block);
+			if (job->format == BC3)
+			{
+				encodeAlpha(block, out);
+				out += 8;
+			}
+			encodeColor(block, out);
+			out += 8;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Block compress one RGB (bpp 3) or RGBA (bpp 4) image
+ * into out, which needs bcLevelSize bytes. Rows of
+ * blocks are split between threads, num_threads of 0
+ * using one per core
+ */
+void bcEncode(const GLubyte *texels, int width, int height, int bpp, bcFormat format,
+			  GLubyte *out, int num_threads)
+{
+	int rows = (height + 3) / 4;
+	if (num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+	if (num_threads < 1 || (size_t)rows * ((width + 3) / 4) < MIN_THREADED_BLOCKS)
+		num_threads = 1;
+	if (num_threads > rows)
+		num_threads = rows;
+
+	bcJob jobs[MAX_THREADS];
+	pthread_t ids[MAX_THREADS];
+	for (int t = 0; t < num_threads; t++)
+	{
+		jobs[t] = (bcJob){texels, width, height, bpp, format, out,
+						  rows * t / num_threads, rows * (t + 1) / num_threads};
+		if (t > 0 && pthread_create(&ids[t], NULL, runJob, &jobs[t]))
+		{
+			printf("Error starting block compression thread\n");
+			exit(1);
+		}
+	}
+	runJob(&jobs[0]);
+	for (int t = 1; t < num_threads; t++)
+	{
+		pthread_join(ids[t], NULL);
+	}
+}
+
+// Levels the same sizes as the mip chain's, and the
+// bytes they need in all
+static size_t levelSizes(bcTexture *bc, bcFormat format, int width, int height)
+{
+	size_t size = 0;
+	bc->format = format;
+	bc->num_levels = mipLevelDims(width, height, bc->width, bc->height);
+	for (int i = 0; i < bc->num_levels; i++)
+	{
+		bc->level_size[i] = bcLevelSize(format, bc->width[i], bc->height[i]);
+		size += bc->level_size[i];
+	}
+	return size;
+}
+
+static void placeLevels(bcTexture *bc, const GLubyte *data)
+{
+	for (int i = 0; i < bc->num_levels; i++)
+	{
+		bc->levels[i] = data;
+		data += bc->level_size[i];
+	}
+}
+
+/**
+ * Block compress a texture and every level of its mip
+ * chain. Exits with a message if there isn't memory
+ */
+void bcBuild(bcTexture *bc, const textureFile *tex, const mipChain *mips, bcFormat format, int num_threads)
+{
+	bc->size = levelSizes(bc, format, tex->width, tex->height);
+	bc->data = malloc(bc->size);
+	bc->mapped = GL_FALSE;
+	if (!bc->data)
+	{
+		printf("Error allocating memory for compressed texture\n");
+		exit(1);
+	}
+	placeLevels(bc, (const GLubyte *)bc->data);
+	bcEncode(tex->texels, tex->width, tex->height, 3, format, (GLubyte *)bc->levels[0], num_threads);
+	for (int i = 1; i < bc->num_levels; i++)
+	{
+		bcEncode(mips->levels[i], mips->width[i], mips->height[i], 3, format, (GLubyte *)bc->levels[i], num_threads);
+	}
+}
+
+/**
+ * Map a texture saved by bcSave for the file source.
+ * Returns 0 and leaves bc alone if the cache is missing,
+ * damaged, in another format, or source has changed
+ */
+int bcLoad(bcTexture *bc, const char *filename, const char *source, bcFormat format)
+{
+	cacheStamp stamp;
+	size_t size;
+	if (!cacheStampOf(source, &stamp))
+		return 0;
+	char *data = (char *)cacheMap(filename, sizeof(bcCacheHeader), &size);
+	if (!data)
+		return 0;
+
+	const bcCacheHeader *h = (const bcCacheHeader *)data;
+	bcTexture b;
+	int ok = h->magic == BC_CACHE_MAGIC && h->version == BC_CACHE_VERSION && h->format == format &&
+			 cacheStampEqual(&h->source, &stamp) &&
+			 h->width > 0 && h->height > 0 && h->file_size == size &&
+			 levelSizes(&b, format, h->width, h->height) == size - sizeof(bcCacheHeader) &&
+			 b.num_levels == h->num_levels;
+	if (!ok)
+	{
+		cacheUnmap(data, size);
+		return 0;
+	}
+	*bc = b;
+	placeLevels(bc, (const GLubyte *)data + sizeof(bcCacheHeader));
+	bc->data = data;
+	bc->size = size;
+	bc->mapped = GL_TRUE;
+	return 1;
+}
+
+/**
+ * Write a compressed texture to a cache file tied to the
+ * file source, through cacheWrite. Returns 0 if it
+ * couldn't be written
+ */
+int bcSave(const bcTexture *bc, const char *filename, const char *source)
+{
+	bcCacheHeader h = {0};
+	if (!cacheStampOf(source, &h.source))
+		return 0;
+	size_t levels_size = 0;
+	for (int i = 0; i < bc->num_levels; i++)
+	{
+		levels_size += bc->level_size[i];
+	}
+	h.magic = BC_CACHE_MAGIC;
+	h.version = BC_CACHE_VERSION;
+	h.format = bc->format;
+	h.width = bc->width[0];
+	h.height = bc->height[0];
+	h.num_levels = bc->num_levels;
+	h.file_size = sizeof(h) + levels_size;
+
+	cacheSection sections[] = {{&h, sizeof(h), 0}, {bc->levels[0], levels_size, sizeof(h)}};
+	return cacheWrite(filename, sections, 2, h.file_size);
+}
+
+/**
+ * Block compressed mip chain of a texture opened from
+ * source, mapped from source.bc1 or source.bc3 if that's
+ * up to date, otherwise built on every core and saved
+ * there for next time. Returns 1 if it came from the cache
+ */
+int bcTextureFor(bcTexture *bc, const textureFile *tex, const char *source, bcFormat format)
+{
+	size_t name_len = strlen(source) + 5;
+	char *cache_name = (char *)malloc(name_len);
+	if (!cache_name)
+	{
+		printf("Error allocating memory for compressed texture\n");
+		exit(1);
+	}
+	snprintf(cache_name, name_len, "%s.bc%d", source, format == BC1 ? 1 : 3);
+
+	int cached = bcLoad(bc, cache_name, source, format);
+	if (cached && (bc->width[0] != tex->width || bc->height[0] != tex->height))
+	{
+		bcFree(bc);
+		cached = 0;
+	}
+	if (!cached)
+	{
+		// The uncompressed levels are only needed to
+		// compress, so they aren't cached
+		mipChain mips;
+		mipBuild(&mips, tex, 0);
+		bcBuild(bc, tex, &mips, format, 0);
+		mipFree(&mips);
+		if (!bcSave(bc, cache_name, source))
+			printf("Couldn't write %s, the texture will be compressed again next time\n", cache_name);
+	}
+	free(cache_name);
+	return cached;
+}
+
+/**
+ * Free or unmap a texture from bcBuild or bcLoad
+ */
+void bcFree(bcTexture *bc)
+{
+	if (bc->mapped)
+		cacheUnmap(bc->data, bc->size);
+	else
+		free(bc->data);
+	bc->data = NULL;
+	bc->size = 0;
+	bc->num_levels = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef BC_ENCODE_H
+#define BC_ENCODE_H
+
+#include "mipmap.h"
+
+// BC1 (DXT1) is 8 bytes per 4x4 block of opaque color,
+// BC3 (DXT5) is 16, with an alpha block before the color
+typedef enum
+{
+	BC1,
+	BC3
+} bcFormat;
+
+// A block compressed texture and its mip levels, each
+// stored whole in the layout glCompressedTexImage2D takes
+typedef struct
+{
+	bcFormat format;
+	int num_levels;
+	int width[MIP_MAX_LEVELS];
+	int height[MIP_MAX_LEVELS];
+	size_t level_size[MIP_MAX_LEVELS];
+	const GLubyte *levels[MIP_MAX_LEVELS];
+	void *data;
+	size_t size;
+	GLboolean mapped;
+} bcTexture;
+
+size_t bcLevelSize(bcFormat format, int width, int height);
+void bcEncode(const GLubyte *texels, int width, int height, int bpp, bcFormat format,
+			  GLubyte *out, int num_threads);
+void bcBuild(bcTexture *bc, const textureFile *tex, const mipChain *mips, bcFormat format, int num_threads);
+int bcLoad(bcTexture *bc, const char *filename, const char *source, bcFormat format);
+int bcSave(const bcTexture *bc, const char *filename, const char *source);
+int bcTextureFor(bcTexture *bc, const textureFile *tex, const char *source, bcFormat format);
+void bcFree(bcTexture *bc);
+
+#endif
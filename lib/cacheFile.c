@@ -0,0 +1,118 @@
+// For st_mtim under -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cacheFile.h"
+
+/**
+ * Size and modification time of a file, to tell whether
+ * a cache made from it is still good. Returns 0 if the
+ * file can't be found
+ */
+int cacheStampOf(const char *filename, cacheStamp *stamp)
+{
+	struct stat st;
+	if (stat(filename, &st) < 0)
+		return 0;
+	stamp->size = st.st_size;
+	stamp->sec = st.st_mtim.tv_sec;
+	stamp->nsec = st.st_mtim.tv_nsec;
+	return 1;
+}
+
+/**
+ * Whether two stamps are of the same version of a file
+ */
+int cacheStampEqual(const cacheStamp *a, const cacheStamp *b)
+{
+	return a->size == b->size && a->sec == b->sec && a->nsec == b->nsec;
+}
+
+/**
+ * Map a whole cache file read only, setting size to its
+ * length. Returns NULL if it's missing, can't be mapped,
+ * or is too short to hold header_size bytes. Checking
+ * the header is left to the caller
+ */
+void *cacheMap(const char *filename, size_t header_size, size_t *size)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < header_size || st.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+	return data;
+}
+
+/**
+ * Unmap a file mapped by cacheMap
+ */
+void cacheUnmap(void *data, size_t size)
+{
+	munmap(data, size);
+}
+
+/**
+ * Write sections, in increasing order of offset, to a
+ * cache file file_size bytes long. It's written next to
+ * its final name and renamed into place, so a crash
+ * can't leave a half written cache behind. Returns 0 if
+ * it couldn't be written
+ */
+int cacheWrite(const char *filename, const cacheSection *sections, int num_sections,
+			   unsigned long long file_size)
+{
+	size_t name_len = strlen(filename) + 5;
+	char *temp_name = (char *)malloc(name_len);
+	if (!temp_name)
+		return 0;
+	snprintf(temp_name, name_len, "%s.tmp", filename);
+
+	static const char zeros[64] = {0};
+	unsigned long long pos = 0;
+	FILE *f = fopen(temp_name, "wb");
+	int ok = f != NULL;
+	for (int i = 0; ok && i <= num_sections; i++)
+	{
+		unsigned long long start = i < num_sections ? sections[i].offset : file_size;
+		if (start < pos)
+		{
+			ok = 0;
+			break;
+		}
+		while (ok && pos < start)
+		{
+			size_t n = start - pos < sizeof(zeros) ? start - pos : sizeof(zeros);
+			ok = fwrite(zeros, 1, n, f) == n;
+			pos += n;
+		}
+		if (ok && i < num_sections && sections[i].size)
+		{
+			ok = fwrite(sections[i].data, 1, sections[i].size, f) == sections[i].size;
+			pos += sections[i].size;
+		}
+	}
+	if (f && fclose(f) != 0)
+		ok = 0;
+	if (ok)
+		ok = rename(temp_name, filename) == 0;
+	if (!ok)
+		remove(temp_name);
+	free(temp_name);
+	return ok;
+}
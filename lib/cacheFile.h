@@ -0,0 +1,31 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <stddef.h>
+
+// One piece of a cache file and where it goes. Gaps
+// before and between pieces are zero filled
+typedef struct
+{
+	const void *data;
+	size_t size;
+	unsigned long long offset;
+} cacheSection;
+
+// What a cache made from a file is tied to: the file's
+// size and modification time, as cache headers hold them
+typedef struct
+{
+	unsigned long long size;
+	long long sec;
+	long long nsec;
+} cacheStamp;
+
+int cacheStampOf(const char *filename, cacheStamp *stamp);
+int cacheStampEqual(const cacheStamp *a, const cacheStamp *b);
+void *cacheMap(const char *filename, size_t header_size, size_t *size);
+void cacheUnmap(void *data, size_t size);
+int cacheWrite(const char *filename, const cacheSection *sections, int num_sections,
+			   unsigned long long file_size);
+
+#endif
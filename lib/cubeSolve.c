@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cubeSolve.h"
+#include "cacheFile.h"
+
+// Bump when the coordinates or the layout below change
+#define TABLES_VERSION 1
+#define TABLES_MAGIC 0x42554343 // "CCUB" when little endian
+// Sections start on cache line boundaries
+#define SECTION_ALIGN 64
+
+// Phase 2 is cut off this deep, so a long phase 2 is
+// traded for a longer phase 1 with a short one after it
+#define MAX_PHASE2 12
+
+// The file is this header then each table, in the order
+// of cubeTables. Everything in it is worked out from the
+// moves alone, so only the version ties it to this code
+typedef struct
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long size;
+	unsigned long long pad[6];
+} tablesHeader;
+
+// Phase 2 only turns U and D freely, the rest by halves
+static const int phase2_moves[] = {0, 1, 2, 4, 7, 9, 10, 11, 13, 16};
+#define PHASE2_MOVES 10
+
+static size_t alignUp(size_t n)
+{
+	return (n + SECTION_ALIGN - 1) & ~(size_t)(SECTION_ALIGN - 1);
+}
+
+// Lay the tables out after the header, returning the
+// total size. data can be NULL just to get the size
+static size_t placeTables(cubeTables *t, char *data)
+{
+	size_t offset = alignUp(sizeof(tablesHeader));
+	const void **sections[] = {
+		(const void **)&t->twist_move, (const void **)&t->flip_move, (const void **)&t->slice_move,
+		(const void **)&t->corner_move, (const void **)&t->edge_move,
+		(const void **)&t->twist_prune, (const void **)&t->flip_prune,
+		(const void **)&t->corner_prune, (const void **)&t->edge_prune};
+	size_t sizes[] = {
+		sizeof(unsigned short) * TWISTS * CUBE_MOVES, sizeof(unsigned short) * FLIPS * CUBE_MOVES,
+		sizeof(unsigned short) * SLICES * SLICE_ORDERS * CUBE_MOVES,
+		sizeof(unsigned short) * CORNER_PERMS * CUBE_MOVES, sizeof(unsigned short) * EDGE_PERMS * CUBE_MOVES,
+		TWISTS * SLICES, FLIPS * SLICES, CORNER_PERMS * SLICE_ORDERS, EDGE_PERMS * SLICE_ORDERS};
+	for (int i = 0; i < 9; i++)
+	{
+		if (data)
+			*sections[i] = data + offset;
+		offset = alignUp(offset + sizes[i]);
+	}
+	return offset;
+}
+
+// COORDINATES
+
+// Slot by slot cubies and their twists or flips
+static void unpack(const cubeState *c, int cp[8], int co[8], int ep[12], int eo[12])
+{
+	for (int i = 0; i < 8; i++)
+	{
+		unsigned b = c->corners >> 8 * i & 0xff;
+		cp[i] = b & 15;
+		co[i] = b >> 4;
+	}
+	for (int i = 0; i < 12; i++)
+	{
+		unsigned b = c->edges[i / 8] >> 8 * (i % 8) & 0xff;
+		ep[i] = b & 15;
+		eo[i] = b >> 4;
+	}
+}
+
+static int choose(int n, int k)
+{
+	if (k > n)
+		return 0;
+	int r = 1;
+	for (int i = 1; i <= k; i++)
+	{
+		r = r * (n - k + i) / i;
+	}
+	return r;
+}
+
+// Rank of a permutation of n, 0 for the identity
+static int permRank(const int *perm, int n)
+{
+	int rank = 0;
+	for (int i = 0; i < n; i++)
+	{
+		int smaller = 0;
+		for (int j = i + 1; j < n; j++)
+		{
+			smaller += perm[j] < perm[i];
+		}
+		rank = rank * (n - i) + smaller;
+	}
+	return rank;
+}
+
+// Twist of the first 7 corners, the last follows
+static int twistCoord(const cubeState *c)
+{
+	int cp[8], co[8], ep[12], eo[12];
+	unpack(c, cp, co, ep, eo);
+	int t = 0;
+	for (int i = 0; i < 7; i++)
+	{
+		t = 3 * t + co[i];
+	}
+	return t;
+}
+
+// Flip of the first 11 edges, the last follows
+static int flipCoord(const cubeState *c)
+{
+	int cp[8], co[8], ep[12], eo[12];
+	unpack(c, cp, co, ep, eo);
+	int f = 0;
+	for (int i = 0; i < 11; i++)
+	{
+		f = 2 * f + eo[i];
+	}
+	return f;
+}
+
+// Where the FR, FL, BL and BR edges are, times 24, plus
+// the order they're in. 0 when they're home, and under
+// 24 whenever they're in the slice
+static int sliceCoord(const cubeState *c)
+{
+	int cp[8], co[8], ep[12], eo[12];
+	unpack(c, cp, co, ep, eo);
+	int places = 0, found = 0, order[4];
+	for (int j = BR; j >= UR; j--)
+	{
+		if (ep[j] >= FR)
+		{
+			places += choose(11 - j, found + 1);
+			order[3 - found++] = ep[j] - FR;
+		}
+	}
+	return SLICE_ORDERS * places + permRank(order, 4);
+}
+
+static int cornerCoord(const cubeState *c)
+{
+	int cp[8], co[8], ep[12], eo[12];
+	unpack(c, cp, co, ep, eo);
+	return permRank(cp, 8);
+}
+
+// Order of the U and D edges, once they're all in the
+// U and D layers
+static int edgeCoord(const cubeState *c)
+{
+	int cp[8], co[8], ep[12], eo[12];
+	unpack(c, cp, co, ep, eo);
+	return permRank(ep, 8);
+}
+
+// BUILDING
+
+// Fill in a move table by walking out from the solved
+// cube, keeping a cube for each coordinate found to try
+// the moves on
+static void buildMoves(unsigned short *table, int size, int (*coord)(const cubeState *),
+					   const int *moves, int num_moves)
+{
+	cubeState *cubes = (cubeState *)malloc(sizeof(cubeState) * size);
+	int *queue = (int *)malloc(sizeof(int) * size);
+	char *seen = (char *)calloc(size, 1);
+	if (!cubes || !queue || !seen)
+	{
+		printf("Error allocating memory for the solver's tables\n");
+		exit(1);
+	}
+	cubeState c;
+	cubeSolved(&c);
+	int start = coord(&c), head = 0, tail = 0;
+	cubes[start] = c;
+	seen[start] = 1;
+	queue[tail++] = start;
+	while (head < tail)
+	{
+		int x = queue[head++];
+		for (int i = 0; i < num_moves; i++)
+		{
+			c = cubes[x];
+			cubeMove(&c, moves[i]);
+			int y = coord(&c);
+			table[x * CUBE_MOVES + moves[i]] = y;
+			if (!seen[y])
+			{
+				seen[y] = 1;
+				cubes[y] = c;
+				queue[tail++] = y;
+			}
+		}
+	}
+	if (tail != size)
+	{
+		printf("Error: solver table reached %d of %d coordinates\n", tail, size);
+		exit(1);
+	}
+	free(cubes);
+	free(queue);
+	free(seen);
+}
+
+// Fill in a pruning table over pairs of a coordinate
+// and the slice coordinate, a layer of depth at a time.
+// Slice entries are slice_move entries divided by per,
+// so phase 1 can drop the edges' order
+static void buildPrune(signed char *prune, int size, const unsigned short *move, int slices,
+					   const unsigned short *slice_move, int per, const int *moves, int num_moves)
+{
+	int total = size * slices;
+	memset(prune, -1, total);
+	prune[0] = 0;
+	int done = 1;
+	for (int depth = 0; done < total; depth++)
+	{
+		for (int i = 0; i < total; i++)
+		{
+			if (prune[i] != depth)
+				continue;
+			int x = i / slices, s = i % slices;
+			for (int k = 0; k < num_moves; k++)
+			{
+				int m = moves[k];
+				int j = move[x * CUBE_MOVES + m] * slices + slice_move[s * per * CUBE_MOVES + m] / per;
+				if (prune[j] < 0)
+				{
+					prune[j] = depth + 1;
+					done++;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Work out every table in memory. Takes a second or so,
+ * so cubeTablesFor saves them to load next time
+ */
+void cubeTablesBuild(cubeTables *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->size = placeTables(t, NULL);
+	t->data = calloc(1, t->size);
+	if (!t->data)
+	{
+		printf("Error allocating memory for the solver's tables\n");
+		exit(1);
+	}
+	placeTables(t, (char *)t->data);
+	tablesHeader *h = (tablesHeader *)t->data;
+	h->magic = TABLES_MAGIC;
+	h->version = TABLES_VERSION;
+	h->size = t->size;
+
+	int all_moves[CUBE_MOVES];
+	for (int i = 0; i < CUBE_MOVES; i++)
+	{
+		all_moves[i] = i;
+	}
+	buildMoves((unsigned short *)t->twist_move, TWISTS, twistCoord, all_moves, CUBE_MOVES);
+	buildMoves((unsigned short *)t->flip_move, FLIPS, flipCoord, all_moves, CUBE_MOVES);
+	buildMoves((unsigned short *)t->slice_move, SLICES * SLICE_ORDERS, sliceCoord, all_moves, CUBE_MOVES);
+	buildMoves((unsigned short *)t->corner_move, CORNER_PERMS, cornerCoord, phase2_moves, PHASE2_MOVES);
+	buildMoves((unsigned short *)t->edge_move, EDGE_PERMS, edgeCoord, phase2_moves, PHASE2_MOVES);
+
+	buildPrune((signed char *)t->twist_prune, TWISTS, t->twist_move, SLICES,
+			   t->slice_move, SLICE_ORDERS, all_moves, CUBE_MOVES);
+	buildPrune((signed char *)t->flip_prune, FLIPS, t->flip_move, SLICES,
+			   t->slice_move, SLICE_ORDERS, all_moves, CUBE_MOVES);
+	buildPrune((signed char *)t->corner_prune, CORNER_PERMS, t->corner_move, SLICE_ORDERS,
+			   t->slice_move, 1, phase2_moves, PHASE2_MOVES);
+	buildPrune((signed char *)t->edge_prune, EDGE_PERMS, t->edge_move, SLICE_ORDERS,
+			   t->slice_move, 1, phase2_moves, PHASE2_MOVES);
+}
+
+/**
+ * Map tables saved by cubeTablesSave. Returns 0 and
+ * leaves t alone if the file is missing, damaged, or
+ * from another version
+ */
+int cubeTablesLoad(cubeTables *t, const char *filename)
+{
+	size_t size;
+	char *data = (char *)cacheMap(filename, sizeof(tablesHeader), &size);
+	if (!data)
+		return 0;
+
+	cubeTables m;
+	const tablesHeader *h = (const tablesHeader *)data;
+	if (h->magic != TABLES_MAGIC || h->version != TABLES_VERSION || h->size != size ||
+		placeTables(&m, data) != size)
+	{
+		cacheUnmap(data, size);
+		return 0;
+	}
+	*t = m;
+	t->data = data;
+	t->size = size;
+	t->mapped = 1;
+	return 1;
+}
+
+/**
+ * Write tables from cubeTablesBuild to a file through
+ * cacheWrite. Returns 0 if it couldn't be written
+ */
+int cubeTablesSave(const cubeTables *t, const char *filename)
+{
+	cacheSection all = {t->data, t->size, 0};
+	return cacheWrite(filename, &all, 1, t->size);
+}
+
+/**
+ * The solver's tables, mapped from filename if it was
+ * saved by this version, otherwise built and saved there
+ * for next time. Returns 1 if they came from the file
+ */
+int cubeTablesFor(cubeTables *t, const char *filename)
+{
+	if (cubeTablesLoad(t, filename))
+		return 1;
+	cubeTablesBuild(t);
+	if (!cubeTablesSave(t, filename))
+		printf("Couldn't write %s, the solver's tables will be built again next time\n", filename);
+	return 0;
+}
+
+/**
+ * Free or unmap tables from cubeTablesBuild or
+ * cubeTablesLoad
+ */
+void cubeTablesFree(cubeTables *t)
+{
+	if (t->mapped)
+		cacheUnmap(t->data, t->size);
+	else
+		free(t->data);
+	t->data = NULL;
+	t->size = 0;
+}
+
+// SEARCH
+
+typedef struct
+{
+	const cubeTables *t;
+	cubeState start;
+	int moves[64];
+	int max_moves;
+	int length;
+} search;
+
+// Whether a move may follow the last one. Turning the
+// same face twice is never needed, and of two opposite
+// faces only the lower numbered goes first
+static int allowed(const search *s, int depth, int move)
+{
+	if (depth == 0)
+		return 1;
+	int face = move / 3, last = s->moves[depth - 1] / 3;
+	return face != last && face != last - 3;
+}
+
+static int max(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+// Phase 2 to exactly togo more moves
+static int phase2(search *s, int corner, int edge, int slice, int depth, int togo)
+{
+	if (togo == 0)
+		return corner == 0 && edge == 0 && slice == 0;
+	const cubeTables *t = s->t;
+	for (int i = 0; i < PHASE2_MOVES; i++)
+	{
+		int m = phase2_moves[i];
+		if (!allowed(s, depth, m))
+			continue;
+		int c = t->corner_move[corner * CUBE_MOVES + m];
+		int e = t->edge_move[edge * CUBE_MOVES + m];
+		int sl = t->slice_move[slice * CUBE_MOVES + m];
+		if (max(t->corner_prune[c * SLICE_ORDERS + sl], t->edge_prune[e * SLICE_ORDERS + sl]) >= togo)
+			continue;
+		s->moves[depth] = m;
+		if (phase2(s, c, e, sl, depth + 1, togo - 1))
+			return 1;
+	}
+	return 0;
+}
+
+// A phase 1 solution of depth moves is in s->moves, so
+// try to finish from there within the moves left
+static int startPhase2(search *s, int depth)
+{
+	cubeState c = s->start;
+	cubeApply(&c, s->moves, depth);
+	int corner = cornerCoord(&c), edge = edgeCoord(&c), slice = sliceCoord(&c);
+	const cubeTables *t = s->t;
+	int least = max(t->corner_prune[corner * SLICE_ORDERS + slice], t->edge_prune[edge * SLICE_ORDERS + slice]);
+	int most = s->max_moves - depth < MAX_PHASE2 ? s->max_moves - depth : MAX_PHASE2;
+	for (int togo = least; togo <= most; togo++)
+	{
+		if (phase2(s, corner, edge, slice, depth, togo))
+		{
+			s->length = depth + togo;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Phase 1 to exactly togo more moves
+static int phase1(search *s, int twist, int flip, int slice, int depth, int togo)
+{
+	if (togo == 0)
+	{
+		// A phase 1 ending in a phase 2 move would have
+		// been tried a move shorter already
+		if (depth > 0)
+		{
+			int last = s->moves[depth - 1];
+			for (int i = 0; i < PHASE2_MOVES; i++)
+			{
+				if (phase2_moves[i] == last)
+					return 0;
+			}
+		}
+		return startPhase2(s, depth);
+	}
+	const cubeTables *t = s->t;
+	for (int m = 0; m < CUBE_MOVES; m++)
+	{
+		if (!allowed(s, depth, m))
+			continue;
+		int tw = t->twist_move[twist * CUBE_MOVES + m];
+		int fl = t->flip_move[flip * CUBE_MOVES + m];
+		int sl = t->slice_move[slice * CUBE_MOVES + m];
+		int places = sl / SLICE_ORDERS;
+		if (max(t->twist_prune[tw * SLICES + places], t->flip_prune[fl * SLICES + places]) >= togo)
+			continue;
+		s->moves[depth] = m;
+		if (phase1(s, tw, fl, sl, depth + 1, togo - 1))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Find moves that solve c, at most max_moves of them,
+ * with Kociemba's two phase search: longer and longer
+ * phase 1 solutions, each finished by the shortest
+ * phase 2 that fits. The first solution found is
+ * returned, so it's short but not always the shortest.
+ * Writes the moves to solution and returns how many
+ * there are, or -1 if none fit or c can't be solved
+ */
+int cubeSolve(const cubeTables *t, const cubeState *c, int max_moves, int *solution)
+{
+	if (!cubeCheck(c))
+		return -1;
+	search s;
+	s.t = t;
+	s.start = *c;
+	s.max_moves = max_moves < 64 ? max_moves : 64;
+	s.length = -1;
+
+	int twist = twistCoord(c), flip = flipCoord(c), slice = sliceCoord(c);
+	int places = slice / SLICE_ORDERS;
+	int least = max(t->twist_prune[twist * SLICES + places], t->flip_prune[flip * SLICES + places]);
+	for (int depth = least; depth <= s.max_moves; depth++)
+	{
+		if (phase1(&s, twist, flip, slice, 0, depth))
+		{
+			memcpy(solution, s.moves, sizeof(int) * s.length);
+			return s.length;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,50 @@
+#ifndef CUBE_SOLVE_H
+#define CUBE_SOLVE_H
+
+#include <stddef.h>
+#include "cubeState.h"
+
+// Sizes of the coordinates the search runs on. Phase 1
+// brings twists, flips and the slice edges' places to
+// solved, phase 2 finishes with the moves that keep them
+// there: corners, the 8 U and D edges, and the order of
+// the 4 slice edges
+#define TWISTS 2187	  // 3^7 corner twists
+#define FLIPS 2048	  // 2^11 edge flips
+#define SLICES 495	  // 12 choose 4 places for the slice edges
+#define SLICE_ORDERS 24 // 4! orders of them
+#define CORNER_PERMS 40320
+#define EDGE_PERMS 40320
+
+// Longest solution cubeSolve looks for unless told
+#define SOLVE_MAX_MOVES 24
+
+// The two phase solver's move and pruning tables. Move
+// tables give the coordinate after each of the 18 moves,
+// pruning tables the fewest moves to the phase's goal
+// from a pair of coordinates. They're either built in
+// memory or mapped straight from a file written before
+typedef struct
+{
+	const unsigned short *twist_move;
+	const unsigned short *flip_move;
+	const unsigned short *slice_move; // Places and order together
+	const unsigned short *corner_move;
+	const unsigned short *edge_move; // Phase 2 moves only
+	const signed char *twist_prune;	 // By twist and slice places
+	const signed char *flip_prune;	 // By flip and slice places
+	const signed char *corner_prune; // By corners and slice order
+	const signed char *edge_prune;	 // By edges and slice order
+	void *data;
+	size_t size;
+	int mapped;
+} cubeTables;
+
+void cubeTablesBuild(cubeTables *t);
+int cubeTablesLoad(cubeTables *t, const char *filename);
+int cubeTablesSave(const cubeTables *t, const char *filename);
+int cubeTablesFor(cubeTables *t, const char *filename);
+void cubeTablesFree(cubeTables *t);
+int cubeSolve(const cubeTables *t, const cubeState *c, int max_moves, int *solution);
+
+#endif
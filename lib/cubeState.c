@@ -0,0 +1,356 @@
+// rand_r is POSIX, hidden by -std=c99 without this
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cubeState.h"
+#include "libSimd.h"
+
+// One slot's byte: the cubie in it and its twist or flip
+#define SLOT(cubie, turn) ((uint64_t)((cubie) | (turn) << 4))
+#define SLOTS(a, b, c, d, e, f, g, h) \
+	(SLOT a | SLOT b << 8 | SLOT c << 16 | SLOT d << 24 | SLOT e << 32 | SLOT f << 40 | SLOT g << 48 | SLOT h << 56)
+#define SLOTS4(a, b, c, d) (SLOT a | SLOT b << 8 | SLOT c << 16 | SLOT d << 24)
+
+#define SOLVED_CORNERS 0x0706050403020100ULL
+#define SOLVED_EDGES_LO 0x0706050403020100ULL
+#define SOLVED_EDGES_HI 0x0b0a0908ULL
+
+// Each move as the state it takes the solved cube to.
+// Slot i holds the cubie the move brings there, and the
+// twist or flip the move gives it on the way
+static const cubeState moves[CUBE_MOVES] = {
+	// U
+	{SLOTS((UBR, 0), (URF, 0), (UFL, 0), (ULB, 0), (DFR, 0), (DLF, 0), (DBL, 0), (DRB, 0)),
+	 {SLOTS((UB, 0), (UR, 0), (UF, 0), (UL, 0), (DR, 0), (DF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BL, 0), (BR, 0))}},
+	// U2
+	{SLOTS((ULB, 0), (UBR, 0), (URF, 0), (UFL, 0), (DFR, 0), (DLF, 0), (DBL, 0), (DRB, 0)),
+	 {SLOTS((UL, 0), (UB, 0), (UR, 0), (UF, 0), (DR, 0), (DF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BL, 0), (BR, 0))}},
+	// U'
+	{SLOTS((UFL, 0), (ULB, 0), (UBR, 0), (URF, 0), (DFR, 0), (DLF, 0), (DBL, 0), (DRB, 0)),
+	 {SLOTS((UF, 0), (UL, 0), (UB, 0), (UR, 0), (DR, 0), (DF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BL, 0), (BR, 0))}},
+	// R
+	{SLOTS((DFR, 2), (UFL, 0), (ULB, 0), (URF, 1), (DRB, 1), (DLF, 0), (DBL, 0), (UBR, 2)),
+	 {SLOTS((FR, 0), (UF, 0), (UL, 0), (UB, 0), (BR, 0), (DF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((DR, 0), (FL, 0), (BL, 0), (UR, 0))}},
+	// R2
+	{SLOTS((DRB, 0), (UFL, 0), (ULB, 0), (DFR, 0), (UBR, 0), (DLF, 0), (DBL, 0), (URF, 0)),
+	 {SLOTS((DR, 0), (UF, 0), (UL, 0), (UB, 0), (UR, 0), (DF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((BR, 0), (FL, 0), (BL, 0), (FR, 0))}},
+	// R'
+	{SLOTS((UBR, 2), (UFL, 0), (ULB, 0), (DRB, 1), (URF, 1), (DLF, 0), (DBL, 0), (DFR, 2)),
+	 {SLOTS((BR, 0), (UF, 0), (UL, 0), (UB, 0), (FR, 0), (DF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((UR, 0), (FL, 0), (BL, 0), (DR, 0))}},
+	// F
+	{SLOTS((UFL, 1), (DLF, 2), (ULB, 0), (UBR, 0), (URF, 2), (DFR, 1), (DBL, 0), (DRB, 0)),
+	 {SLOTS((UR, 0), (FL, 1), (UL, 0), (UB, 0), (DR, 0), (FR, 1), (DL, 0), (DB, 0)),
+	  SLOTS4((UF, 1), (DF, 1), (BL, 0), (BR, 0))}},
+	// F2
+	{SLOTS((DLF, 0), (DFR, 0), (ULB, 0), (UBR, 0), (UFL, 0), (URF, 0), (DBL, 0), (DRB, 0)),
+	 {SLOTS((UR, 0), (DF, 0), (UL, 0), (UB, 0), (DR, 0), (UF, 0), (DL, 0), (DB, 0)),
+	  SLOTS4((FL, 0), (FR, 0), (BL, 0), (BR, 0))}},
+	// F'
+	{SLOTS((DFR, 1), (URF, 2), (ULB, 0), (UBR, 0), (DLF, 2), (UFL, 1), (DBL, 0), (DRB, 0)),
+	 {SLOTS((UR, 0), (FR, 1), (UL, 0), (UB, 0), (DR, 0), (FL, 1), (DL, 0), (DB, 0)),
+	  SLOTS4((DF, 1), (UF, 1), (BL, 0), (BR, 0))}},
+	// D
+	{SLOTS((URF, 0), (UFL, 0), (ULB, 0), (UBR, 0), (DLF, 0), (DBL, 0), (DRB, 0), (DFR, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (UL, 0), (UB, 0), (DF, 0), (DL, 0), (DB, 0), (DR, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BL, 0), (BR, 0))}},
+	// D2
+	{SLOTS((URF, 0), (UFL, 0), (ULB, 0), (UBR, 0), (DBL, 0), (DRB, 0), (DFR, 0), (DLF, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (UL, 0), (UB, 0), (DL, 0), (DB, 0), (DR, 0), (DF, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BL, 0), (BR, 0))}},
+	// D'
+	{SLOTS((URF, 0), (UFL, 0), (ULB, 0), (UBR, 0), (DRB, 0), (DFR, 0), (DLF, 0), (DBL, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (UL, 0), (UB, 0), (DB, 0), (DR, 0), (DF, 0), (DL, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BL, 0), (BR, 0))}},
+	// L
+	{SLOTS((URF, 0), (ULB, 1), (DBL, 2), (UBR, 0), (DFR, 0), (UFL, 2), (DLF, 1), (DRB, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (BL, 0), (UB, 0), (DR, 0), (DF, 0), (FL, 0), (DB, 0)),
+	  SLOTS4((FR, 0), (UL, 0), (DL, 0), (BR, 0))}},
+	// L2
+	{SLOTS((URF, 0), (DBL, 0), (DLF, 0), (UBR, 0), (DFR, 0), (ULB, 0), (UFL, 0), (DRB, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (DL, 0), (UB, 0), (DR, 0), (DF, 0), (UL, 0), (DB, 0)),
+	  SLOTS4((FR, 0), (BL, 0), (FL, 0), (BR, 0))}},
+	// L'
+	{SLOTS((URF, 0), (DLF, 1), (UFL, 2), (UBR, 0), (DFR, 0), (DBL, 2), (ULB, 1), (DRB, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (FL, 0), (UB, 0), (DR, 0), (DF, 0), (BL, 0), (DB, 0)),
+	  SLOTS4((FR, 0), (DL, 0), (UL, 0), (BR, 0))}},
+	// B
+	{SLOTS((URF, 0), (UFL, 0), (UBR, 1), (DRB, 2), (DFR, 0), (DLF, 0), (ULB, 2), (DBL, 1)),
+	 {SLOTS((UR, 0), (UF, 0), (UL, 0), (BR, 1), (DR, 0), (DF, 0), (DL, 0), (BL, 1)),
+	  SLOTS4((FR, 0), (FL, 0), (UB, 1), (DB, 1))}},
+	// B2
+	{SLOTS((URF, 0), (UFL, 0), (DRB, 0), (DBL, 0), (DFR, 0), (DLF, 0), (UBR, 0), (ULB, 0)),
+	 {SLOTS((UR, 0), (UF, 0), (UL, 0), (DB, 0), (DR, 0), (DF, 0), (DL, 0), (UB, 0)),
+	  SLOTS4((FR, 0), (FL, 0), (BR, 0), (BL, 0))}},
+	// B'
+	{SLOTS((URF, 0), (UFL, 0), (DBL, 1), (ULB, 2), (DFR, 0), (DLF, 0), (DRB, 2), (UBR, 1)),
+	 {SLOTS((UR, 0), (UF, 0), (UL, 0), (BL, 1), (DR, 0), (DF, 0), (DL, 0), (BR, 1)),
+	  SLOTS4((FR, 0), (FL, 0), (DB, 1), (UB, 1))}},
+};
+
+static const char *move_names[CUBE_MOVES] = {
+	"U", "U2", "U'", "R", "R2", "R'", "F", "F2", "F'",
+	"D", "D2", "D'", "L", "L2", "L'", "B", "B2", "B'"};
+
+/**
+ * Set c to the solved cube
+ */
+void cubeSolved(cubeState *c)
+{
+	c->corners = SOLVED_CORNERS;
+	c->edges[0] = SOLVED_EDGES_LO;
+	c->edges[1] = SOLVED_EDGES_HI;
+}
+
+/**
+ * out = a followed by b: slot i of out gets the cubie of
+ * a that b moves into slot i, turned by both. out can be
+ * a or b
+ */
+void cubeMultiply(const cubeState *a, const cubeState *b, cubeState *out)
+{
+	// pshufb is SSSE3. Without it the bytes move one at a time
+#if LIB_SSSE3
+	const __m128i slot_bits = _mm_set1_epi8(0x0f);
+	const __m128i twist_bits = _mm_set1_epi8(0x30);
+	const __m128i flip_bits = _mm_set1_epi8(0x10);
+	const __m128i three = _mm_set1_epi8(0x30);
+	const __m128i used_edges = _mm_set_epi32(0, -1, -1, -1);
+
+	// Twists add up to at most 4, and taking 3 off is
+	// only smaller when it doesn't wrap below 0
+	__m128i ac = _mm_loadl_epi64((const __m128i *)&a->corners);
+	__m128i bc = _mm_loadl_epi64((const __m128i *)&b->corners);
+	__m128i corners = _mm_shuffle_epi8(ac, _mm_and_si128(bc, slot_bits));
+	corners = _mm_add_epi8(corners, _mm_and_si128(bc, twist_bits));
+	corners = _mm_min_epu8(corners, _mm_sub_epi8(corners, three));
+
+	// Flips add mod 2, which is xor. The unused bytes
+	// pick up edge 0 in the shuffle, so they're cleared
+	__m128i ae = _mm_loadu_si128((const __m128i *)a->edges);
+	__m128i be = _mm_loadu_si128((const __m128i *)b->edges);
+	__m128i edges = _mm_shuffle_epi8(ae, _mm_and_si128(be, slot_bits));
+	edges = _mm_xor_si128(edges, _mm_and_si128(be, flip_bits));
+	edges = _mm_and_si128(edges, used_edges);
+
+	_mm_storel_epi64((__m128i *)&out->corners, corners);
+	_mm_storeu_si128((__m128i *)out->edges, edges);
+#else
+	uint64_t corners = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		unsigned bi = b->corners >> 8 * i & 0xff;
+		unsigned ai = a->corners >> 8 * (bi & 7) & 0xff;
+		unsigned twist = (ai >> 4) + (bi >> 4);
+		twist = twist >= 3 ? twist - 3 : twist;
+		corners |= SLOT((ai & 7), twist) << 8 * i;
+	}
+	uint64_t edges[2] = {0, 0};
+	for (int i = 0; i < 12; i++)
+	{
+		unsigned bi = b->edges[i / 8] >> 8 * (i % 8) & 0xff;
+		int from = bi & 15;
+		unsigned ai = a->edges[from / 8] >> 8 * (from % 8) & 0xff;
+		edges[i / 8] |= (uint64_t)(ai ^ (bi & 0x10)) << 8 * (i % 8);
+	}
+	out->corners = corners;
+	out->edges[0] = edges[0];
+	out->edges[1] = edges[1];
+#endif
+}
+
+/**
+ * Turn c by one of the 18 moves
+ */
+void cubeMove(cubeState *c, int move)
+{
+	cubeMultiply(c, &moves[move], c);
+}
+
+/**
+ * Turn c by each of a list of moves in turn
+ */
+void cubeApply(cubeState *c, const int *list, int num_moves)
+{
+	for (int i = 0; i < num_moves; i++)
+	{
+		cubeMultiply(c, &moves[list[i]], c);
+	}
+}
+
+/**
+ * out = the state that undoes c, so c followed by out is
+ * solved
+ */
+void cubeInverse(const cubeState *c, cubeState *out)
+{
+	uint64_t corners = 0, edges[2] = {0, 0};
+	for (int i = 0; i < 8; i++)
+	{
+		unsigned ci = c->corners >> 8 * i & 0xff;
+		unsigned twist = (3 - (ci >> 4)) % 3;
+		corners |= SLOT(i, twist) << 8 * (ci & 7);
+	}
+	for (int i = 0; i < 12; i++)
+	{
+		unsigned ei = c->edges[i / 8] >> 8 * (i % 8) & 0xff;
+		int to = ei & 15;
+		edges[to / 8] |= SLOT(i, ei >> 4) << 8 * (to % 8);
+	}
+	out->corners = corners;
+	out->edges[0] = edges[0];
+	out->edges[1] = edges[1];
+}
+
+int cubeEqual(const cubeState *a, const cubeState *b)
+{
+	return a->corners == b->corners && a->edges[0] == b->edges[0] && a->edges[1] == b->edges[1];
+}
+
+int cubeIsSolved(const cubeState *c)
+{
+	return c->corners == SOLVED_CORNERS && c->edges[0] == SOLVED_EDGES_LO && c->edges[1] == SOLVED_EDGES_HI;
+}
+
+// Whether a permutation of n is odd, counting the cycles
+// its elements are in
+static int oddPermutation(const int *perm, int n)
+{
+	int seen[12] = {0}, odd = 0;
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = i; !seen[j]; j = perm[j])
+		{
+			seen[j] = 1;
+			odd ^= j != i;
+		}
+	}
+	return odd;
+}
+
+/**
+ * Whether c is a cube that can be reached by turning:
+ * every cubie once, twists adding to a multiple of 3,
+ * flips to a multiple of 2, and corners and edges
+ * permuted the same parity. Returns 1 if so, 0 if not
+ */
+int cubeCheck(const cubeState *c)
+{
+	int corners[8], edges[12], seen = 0, twist = 0, flip = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		unsigned ci = c->corners >> 8 * i & 0xff;
+		if ((ci & 15) > 7 || ci >> 4 > 2)
+			return 0;
+		corners[i] = ci & 15;
+		seen |= 1 << corners[i];
+		twist += ci >> 4;
+	}
+	if (seen != 0xff)
+		return 0;
+
+	seen = 0;
+	for (int i = 0; i < 12; i++)
+	{
+		unsigned ei = c->edges[i / 8] >> 8 * (i % 8) & 0xff;
+		if ((ei & 15) > 11 || ei >> 4 > 1)
+			return 0;
+		edges[i] = ei & 15;
+		seen |= 1 << edges[i];
+		flip += ei >> 4;
+	}
+	if (seen != 0xfff || c->edges[1] >> 32)
+		return 0;
+
+	return twist % 3 == 0 && flip % 2 == 0 && oddPermutation(corners, 8) == oddPermutation(edges, 12);
+}
+
+// Shuffle perm[0..n) in place
+static void shuffleSlots(int *perm, int n, unsigned int *seed)
+{
+	for (int i = 0; i < n; i++)
+	{
+		perm[i] = i;
+	}
+	for (int i = n - 1; i > 0; i--)
+	{
+		int j = rand_r(seed) % (i + 1);
+		int temp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = temp;
+	}
+}
+
+/**
+ * Set c to a cube picked evenly from every cube that can
+ * be reached by turning, using rand_r on seed
+ */
+void cubeRandom(cubeState *c, unsigned int *seed)
+{
+	int corners[8], edges[12];
+	shuffleSlots(corners, 8, seed);
+	shuffleSlots(edges, 12, seed);
+	// Swapping two edges fixes the parity
+	if (oddPermutation(corners, 8) != oddPermutation(edges, 12))
+	{
+		int temp = edges[0];
+		edges[0] = edges[1];
+		edges[1] = temp;
+	}
+
+	// The last twist and flip make the totals work
+	int twist = 0, flip = 0;
+	c->corners = c->edges[0] = c->edges[1] = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		int t = i < 7 ? rand_r(seed) % 3 : (3 - twist % 3) % 3;
+		twist += t;
+		c->corners |= SLOT(corners[i], t) << 8 * i;
+	}
+	for (int i = 0; i < 12; i++)
+	{
+		int f = i < 11 ? rand_r(seed) % 2 : flip % 2;
+		flip += f;
+		c->edges[i / 8] |= SLOT(edges[i], f) << 8 * (i % 8);
+	}
+}
+
+/**
+ * Name of a move, like "R" or "U2" or "F'"
+ */
+const char *cubeMoveName(int move)
+{
+	return move >= 0 && move < CUBE_MOVES ? move_names[move] : "?";
+}
+
+/**
+ * Read moves written like "R U2 F' B", separated by
+ * spaces, into moves. Returns how many there were, or -1
+ * if one isn't a move or there are more than max_moves
+ */
+int cubeParseMoves(const char *text, int *list, int max_moves)
+{
+	int n = 0;
+	char name[4];
+	int len;
+	while (sscanf(text, " %3s%n", name, &len) == 1)
+	{
+		int move = 0;
+		while (move < CUBE_MOVES && strcmp(name, move_names[move]))
+		{
+			move++;
+		}
+		if (move == CUBE_MOVES || n == max_moves)
+			return -1;
+		list[n++] = move;
+		text += len;
+	}
+	return n;
+}
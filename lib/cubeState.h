@@ -0,0 +1,76 @@
+#ifndef CUBE_STATE_H
+#define CUBE_STATE_H
+
+#include <stdint.h>
+
+// Corner slots, and the corner cubies that belong in them
+enum
+{
+	URF,
+	UFL,
+	ULB,
+	UBR,
+	DFR,
+	DLF,
+	DBL,
+	DRB
+};
+
+// Edge slots and cubies
+enum
+{
+	UR,
+	UF,
+	UL,
+	UB,
+	DR,
+	DF,
+	DL,
+	DB,
+	FR,
+	FL,
+	BL,
+	BR
+};
+
+// Faces in the order moves are numbered. Move 3 * face +
+// n - 1 turns the face n quarter turns clockwise, so the
+// 18 moves go U, U2, U', R, R2, R', F and so on
+enum
+{
+	CUBE_U,
+	CUBE_R,
+	CUBE_F,
+	CUBE_D,
+	CUBE_L,
+	CUBE_B
+};
+
+#define CUBE_MOVES 18
+
+// A 3x3x3 cube down to which cubie is in each slot and
+// how it's turned there. Byte i of corners is the corner
+// cubie in slot i, with its twist (0 to 2) in bits 4 and
+// 5. Bytes 0 to 11 of edges are the edge cubies, with
+// their flip in bit 4, and the last 4 bytes are 0. A
+// move is the state it takes the solved cube to, and
+// applying it is a byte shuffle and an add
+typedef struct
+{
+	uint64_t corners;
+	uint64_t edges[2];
+} cubeState;
+
+void cubeSolved(cubeState *c);
+void cubeMultiply(const cubeState *a, const cubeState *b, cubeState *out);
+void cubeMove(cubeState *c, int move);
+void cubeApply(cubeState *c, const int *list, int num_moves);
+void cubeInverse(const cubeState *c, cubeState *out);
+int cubeEqual(const cubeState *a, const cubeState *b);
+int cubeIsSolved(const cubeState *c);
+int cubeCheck(const cubeState *c);
+void cubeRandom(cubeState *c, unsigned int *seed);
+const char *cubeMoveName(int move);
+int cubeParseMoves(const char *text, int *list, int max_moves);
+
+#endif
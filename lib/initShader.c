@@ -1,6 +1,27 @@
+// For clock_gettime under -std=c99
+#define _DEFAULT_SOURCE
+
 #include "initShader.h"
+#include "cacheFile.h"
+#include "msClock.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Linked programs are cached next to the vertex shader, as
+// vshader.glsl.<hash>.bin with a hash of the fragment shader's
+// name and any defines. Bump the version when the layout changes
+#define PROGRAM_CACHE_MAGIC 0x4E494250 // "PBIN" when little endian
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader
+{
+    GLuint magic;
+    GLuint version;
+    unsigned long long key;
+    GLenum format;
+    GLint length;
+};
 
 // Create a NULL-terminated string by reading the provided file
 static char* readShaderSource(const char* shaderFile)
@@ -23,28 +44,206 @@ static char* readShaderSource(const char* shaderFile)
     return buf;
 }
 
+// 64 bit FNV-1a, continuing from h
+static unsigned long long hashString(unsigned long long h, const char* str)
+{
+    for (; str && *str; str++)
+	h = (h ^ (unsigned char) *str) * 1099511628211ull;
+    // Keep "ab" + "c" apart from "a" + "bc"
+    return (h ^ 0xff) * 1099511628211ull;
+}
+
+// What a cached binary has to match: both sources, and
+// the driver that made it, since binaries only load on
+// the exact driver that wrote them
+static unsigned long long programKey(const char* vSource, const char* fSource)
+{
+    unsigned long long h = 14695981039346656037ull;
+    h = hashString(h, vSource);
+    h = hashString(h, fSource);
+    h = hashString(h, (const char*) glGetString(GL_VENDOR));
+    h = hashString(h, (const char*) glGetString(GL_RENDERER));
+    h = hashString(h, (const char*) glGetString(GL_VERSION));
+    return h;
+}
+
+// Whether the GL can hand back and take linked programs
+static int haveProgramBinary(void)
+{
+#ifndef __APPLE__
+    if (!GLEW_ARB_get_program_binary)
+	return 0;
+#endif
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// Load a program saved by saveProgram into program if
+// its key matches. Returns 0 if there's no such cache or
+// the driver turns it down
+static int loadProgram(GLuint program, const char* cacheFile, unsigned long long key)
+{
+    FILE* fp = fopen(cacheFile, "rb");
+    if (fp == NULL)
+	return 0;
+
+    struct ProgramCacheHeader h;
+    int ok = fread(&h, sizeof(h), 1, fp) == 1 && h.magic == PROGRAM_CACHE_MAGIC &&
+	h.version == PROGRAM_CACHE_VERSION && h.key == key && h.length > 0;
+    void* binary = ok ? malloc(h.length) : NULL;
+    ok = binary != NULL && fread(binary, 1, h.length, fp) == (size_t) h.length;
+    fclose(fp);
+
+    GLint linked = 0;
+    if (ok)
+    {
+	glProgramBinary(program, h.format, binary, h.length);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+    free(binary);
+    return linked;
+}
+
+// Write a linked program's binary to cacheFile, through
+// cacheWrite. Returns 0 if it couldn't be written
+static int saveProgram(GLuint program, const char* cacheFile, unsigned long long key)
+{
+    struct ProgramCacheHeader h = { PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, 0, 0 };
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &h.length);
+    if (h.length <= 0)
+	return 0;
+    void* binary = malloc(h.length);
+    if (binary == NULL)
+	return 0;
+    glGetProgramBinary(program, h.length, &h.length, &h.format, binary);
+
+    cacheSection sections[] = {
+	{ &h, sizeof(h), 0 },
+	{ binary, (size_t) h.length, sizeof(h) }
+    };
+    int ok = cacheWrite(cacheFile, sections, 2, sizeof(h) + h.length);
+    free(binary);
+    return ok;
+}
+
+// Source with a #define line for each space separated name in
+// defines, as "NAME" or "NAME=value", put after the #version line
+// since GLSL wants that first
+static char* addDefines(char* source, const char* defines)
+{
+    size_t extra = 0;
+    const char* d;
+    for (d = defines; *d; d++)
+	extra += *d == ' ' ? 9 : 1;
+    char* out = (char *) malloc(strlen(source) + extra + 12);
+    if (out == NULL)
+    {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+    }
+
+    size_t head = 0;
+    if (strncmp(source, "#version", 8) == 0)
+    {
+	char* eol = strchr(source, '\n');
+	head = eol ? (size_t) (eol + 1 - source) : strlen(source);
+    }
+    memcpy(out, source, head);
+    char* o = out + head;
+    if (head > 0 && source[head - 1] != '\n')
+	*o++ = '\n';
+    for (d = defines; *d; )
+    {
+	while (*d == ' ')
+	    d++;
+	if (!*d)
+	    break;
+	o += sprintf(o, "#define ");
+	for (; *d && *d != ' '; d++)
+	    *o++ = *d == '=' ? ' ' : *d;
+	*o++ = '\n';
+    }
+    strcpy(o, source + head);
+    free(source);
+    return out;
+}
 
 // Create a GLSL program object from vertex and fragment shader files
 GLuint initShader(const char* vShaderFile, const char* fShaderFile)
+{
+    return initShaderDefines(vShaderFile, fShaderFile, NULL);
+}
+
+// Same, compiling both shaders with the space separated names in
+// defines #defined, so one pair of files can make several
+// specialized programs. The linked program is cached next to
+// vShaderFile, named with a hash of fShaderFile and defines so
+// programs sharing a vertex shader get a file each, where the
+// driver supports it, and loaded from there while the sources
+// and driver stay the same
+GLuint initShaderDefines(const char* vShaderFile, const char* fShaderFile, const char* defines)
 {
     int i;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     struct Shader shaders[2] = {
 	{ vShaderFile, GL_VERTEX_SHADER, NULL },
 	{ fShaderFile, GL_FRAGMENT_SHADER, NULL }
     };
 
-    GLuint program = glCreateProgram();
-    
     for (i = 0; i < 2; ++i)
     {
-	struct Shader s = shaders[i];
-	s.source = readShaderSource(s.filename);
-	if(s.source == NULL)
+	shaders[i].source = readShaderSource(shaders[i].filename);
+	if(shaders[i].source == NULL)
+	{
+	    fprintf(stderr, "Failed to read %s\n", shaders[i].filename);
+	    exit(EXIT_FAILURE);
+	}
+	if (defines)
+	    shaders[i].source = addDefines(shaders[i].source, defines);
+    }
+    // For the timing messages
+    char label[256];
+    snprintf(label, sizeof(label), "%s and %s%s%s", vShaderFile, fShaderFile,
+	     defines ? " with " : "", defines ? defines : "");
+
+    GLuint program = glCreateProgram();
+
+    int cacheable = haveProgramBinary();
+    unsigned long long key = 0;
+    char* cacheFile = NULL;
+    if (cacheable)
+    {
+	key = programKey(shaders[0].source, shaders[1].source);
+	size_t nameLen = strlen(vShaderFile) + 14;
+	cacheFile = (char *) malloc(nameLen);
+	if (cacheFile == NULL)
 	{
-	    fprintf(stderr, "Failed to read %s\n", s.filename);
+	    fprintf(stderr, "Out of memory\n");
 	    exit(EXIT_FAILURE);
 	}
+	unsigned long long nameHash = hashString(14695981039346656037ull, fShaderFile);
+	if (defines)
+	    nameHash = hashString(nameHash, defines);
+	snprintf(cacheFile, nameLen, "%s.%08x.bin", vShaderFile, (unsigned) nameHash);
+	if (loadProgram(program, cacheFile, key))
+	{
+	    printf("Loaded cached %s in %.1f ms\n", label, msSince(&start));
+	    free(shaders[0].source);
+	    free(shaders[1].source);
+	    free(cacheFile);
+	    glUseProgram(program);
+	    return program;
+	}
+	// Asks the driver to keep the binary around for saveProgram
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+	struct Shader s = shaders[i];
 
 	GLuint shader = glCreateShader(s.type);
 	glShaderSource(shader, 1, (const GLchar**) &s.source, NULL);
@@ -88,6 +287,14 @@ GLuint initShader(const char* vShaderFile, const char* fShaderFile)
 	exit(EXIT_FAILURE);
     }
 
+    printf("Compiled %s in %.1f ms\n", label, msSince(&start));
+    if (cacheable)
+    {
+	if (!saveProgram(program, cacheFile, key))
+	    printf("Couldn't write %s, the shaders will be compiled again next time\n", cacheFile);
+	free(cacheFile);
+    }
+
     /* use program object */
     glUseProgram(program);
 
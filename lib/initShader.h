@@ -19,5 +19,7 @@ struct Shader
 };
 
 GLuint initShader(const char* vertexShaderFile, const char* fragmentShaderFile);
+GLuint initShaderDefines(const char* vertexShaderFile, const char* fragmentShaderFile,
+			  const char* defines);
 
 #endif
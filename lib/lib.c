@@ -1,6 +1,50 @@
 #include <stdio.h>
 #include <math.h>
 #include "lib.h"
+#include "libSimd.h"
+
+#if LIB_SSE
+// Load/store a vec4 as 4 packed floats.
+// vec4 has no alignment guarantee so use unaligned ops
+static inline __m128 loadVec(const vec4 *v)
+{
+	return _mm_loadu_ps(&v->x);
+}
+
+static inline void storeVec(vec4 *v, __m128 r)
+{
+	_mm_storeu_ps(&v->x, r);
+}
+
+// Horizontal sum of all 4 lanes, left in every lane
+static inline __m128 hsum(__m128 r)
+{
+	__m128 shuf = _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(r, shuf);
+	shuf = _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 0, 3, 2));
+	return _mm_add_ps(sums, shuf);
+}
+
+// Linear combination of the 4 columns of a matrix,
+// i.e. the matrix times the vector (x, y, z, w)
+static inline __m128 combineCols(__m128 c0, __m128 c1, __m128 c2, __m128 c3, __m128 v)
+{
+	__m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+	r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+	r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+	r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+	return r;
+}
+#endif
+
+#if LIB_AVX
+// Copy a matrix column into both halves of a 256 bit register
+static inline __m256 dupCol(const vec4 *v)
+{
+	__m128 c = loadVec(v);
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(c), c, 1);
+}
+#endif
 
 // VECTORS
 
@@ -114,7 +158,15 @@ float magnitude(vec4 *v)
  */
 vec4 normalize(vec4 *v)
 {
+#if LIB_SSE
+	vec4 r;
+	__m128 a = loadVec(v);
+	__m128 len = _mm_sqrt_ps(hsum(_mm_mul_ps(a, a)));
+	storeVec(&r, _mm_mul_ps(a, _mm_div_ps(_mm_set1_ps(1.0f), len)));
+	return r;
+#else
 	return multScalVec(v, (1 / magnitude(v)));
+#endif
 }
 
 /**
@@ -122,7 +174,11 @@ vec4 normalize(vec4 *v)
  */
 float dotVec(vec4 *v, vec4 *u)
 {
+#if LIB_SSE
+	return _mm_cvtss_f32(hsum(_mm_mul_ps(loadVec(v), loadVec(u))));
+#else
 	return (v->x * u->x) + (v->y * u->y) + (v->z * u->z) + (v->w * u->w);
+#endif
 }
 
 /**
@@ -130,11 +186,25 @@ float dotVec(vec4 *v, vec4 *u)
  */
 vec4 crossVec(vec4 *v, vec4 *u)
 {
+#if LIB_SSE
+	// (v * u.yzx - v.yzx * u).yzx, with w forced to 0
+	vec4 r;
+	__m128 a = loadVec(v);
+	__m128 b = loadVec(u);
+	__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+	c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+	c = _mm_and_ps(c, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+	storeVec(&r, c);
+	return r;
+#else
 	return (vec4){
 		(v->y * u->z - v->z * u->y),
 		(v->z * u->x - v->x * u->z),
 		(v->x * u->y - v->y * u->x),
 		0.0};
+#endif
 }
 
 /**
@@ -291,6 +361,38 @@ mat4 subMat(mat4 *m, mat4 *n)
  */
 mat4 multMat(mat4 *m, mat4 *n)
 {
+#if LIB_AVX
+	// Each column of the result is m times the matching
+	// column of n. Do two columns per 256 bit register
+	mat4 r;
+	__m256 c0 = dupCol(&m->x);
+	__m256 c1 = dupCol(&m->y);
+	__m256 c2 = dupCol(&m->z);
+	__m256 c3 = dupCol(&m->w);
+	for (int i = 0; i < 2; i++)
+	{
+		__m256 v = _mm256_loadu_ps(&n->x.x + 8 * i);
+		__m256 s = _mm256_mul_ps(c0, _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0)));
+		s = _mm256_add_ps(s, _mm256_mul_ps(c1, _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1))));
+		s = _mm256_add_ps(s, _mm256_mul_ps(c2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2))));
+		s = _mm256_add_ps(s, _mm256_mul_ps(c3, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3))));
+		_mm256_storeu_ps(&r.x.x + 8 * i, s);
+	}
+	return r;
+#elif LIB_SSE
+	// Each column of the result is m times the
+	// matching column of n
+	mat4 r;
+	__m128 c0 = loadVec(&m->x);
+	__m128 c1 = loadVec(&m->y);
+	__m128 c2 = loadVec(&m->z);
+	__m128 c3 = loadVec(&m->w);
+	storeVec(&r.x, combineCols(c0, c1, c2, c3, loadVec(&n->x)));
+	storeVec(&r.y, combineCols(c0, c1, c2, c3, loadVec(&n->y)));
+	storeVec(&r.z, combineCols(c0, c1, c2, c3, loadVec(&n->z)));
+	storeVec(&r.w, combineCols(c0, c1, c2, c3, loadVec(&n->w)));
+	return r;
+#else
 	// Transpose m so we can easily
 	// use dot products to get values
 	mat4 t = transpose(m);
@@ -319,6 +421,7 @@ mat4 multMat(mat4 *m, mat4 *n)
 	r.w.w = dotVec(&t.w, &n->w);
 
 	return r;
+#endif
 }
 
 /**
@@ -326,6 +429,19 @@ mat4 multMat(mat4 *m, mat4 *n)
  */
 mat4 transpose(mat4 *m)
 {
+#if LIB_SSE
+	mat4 r;
+	__m128 c0 = loadVec(&m->x);
+	__m128 c1 = loadVec(&m->y);
+	__m128 c2 = loadVec(&m->z);
+	__m128 c3 = loadVec(&m->w);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	storeVec(&r.x, c0);
+	storeVec(&r.y, c1);
+	storeVec(&r.z, c2);
+	storeVec(&r.w, c3);
+	return r;
+#else
 	mat4 temp = {
 		{m->x.x, m->y.x, m->z.x, m->w.x},
 		{m->x.y, m->y.y, m->z.y, m->w.y},
@@ -333,33 +449,125 @@ mat4 transpose(mat4 *m)
 		{m->x.w, m->y.w, m->z.w, m->w.w},
 	};
 	return temp;
+#endif
 }
 
 /**
- * Get the inverse of a matrix
+ * Get the inverse of a matrix.
+ * Expands cofactors using the 2x2 determinants of the
+ * top and bottom halves of m, which are shared between
+ * all 16 entries, so it's straight line code with no
+ * copying into arrays.
  */
 mat4 invMat(mat4 *m)
 {
-	// Identity matrix
-	// mat4 I = {
-	// 	{1, 0, 0, 0},
-	// 	{0, 1, 0, 0},
-	// 	{0, 0, 1, 0},
-	// 	{0, 0, 0, 1},
-	// };
-
-	// Matrix of minor
-	mat4 minor = minorMat(m);
-	// Matrix of cofactor
-	mat4 cofac = cofactor(&minor);
-	// Transpose cofactor
-	mat4 t = transpose(&cofac);
+	// a[i][j] is column i, row j. The inverse of the
+	// transpose is the transpose of the inverse, so the
+	// formula below works without reordering anything
+	const GLfloat(*a)[4] = (const GLfloat(*)[4]) & m->x.x;
+	mat4 r;
+	GLfloat(*b)[4] = (GLfloat(*)[4]) & r.x.x;
+
+	// 2x2 determinants from the first two columns
+	GLfloat s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+	GLfloat s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+	GLfloat s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+	GLfloat s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+	GLfloat s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+	GLfloat s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+
+	// 2x2 determinants from the last two columns
+	GLfloat c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+	GLfloat c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+	GLfloat c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+	GLfloat c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+	GLfloat c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+	GLfloat c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+
 	// Determinant of m
-	GLfloat det = m->x.x * minor.x.x - m->y.x * minor.y.x + m->z.x * minor.z.x - m->w.x * minor.w.x;
-	// Inverse of m
-	mat4 invM = multScalMat(&t, 1 / det);
+	GLfloat det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	GLfloat inv = 1 / det;
+
+	b[0][0] = (a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * inv;
+	b[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * inv;
+	b[0][2] = (a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * inv;
+	b[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * inv;
+
+	b[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * inv;
+	b[1][1] = (a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * inv;
+	b[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * inv;
+	b[1][3] = (a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * inv;
 
-	return invM;
+	b[2][0] = (a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * inv;
+	b[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * inv;
+	b[2][2] = (a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * inv;
+	b[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * inv;
+
+	b[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * inv;
+	b[3][1] = (a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * inv;
+	b[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * inv;
+	b[3][3] = (a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * inv;
+
+	return r;
+}
+
+/**
+ * Inverse of an affine matrix, one whose bottom row
+ * is 0 0 0 1 (any mix of rotate, scale, translate).
+ * Only the 3x3 part needs a real inverse; the
+ * translation just gets run backwards through it.
+ */
+mat4 invAffine(mat4 *m)
+{
+	// Rows of the 3x3 inverse are the cross products
+	// of the columns, divided by the determinant
+	GLfloat r0x = m->y.y * m->z.z - m->y.z * m->z.y;
+	GLfloat r0y = m->y.z * m->z.x - m->y.x * m->z.z;
+	GLfloat r0z = m->y.x * m->z.y - m->y.y * m->z.x;
+
+	GLfloat r1x = m->z.y * m->x.z - m->z.z * m->x.y;
+	GLfloat r1y = m->z.z * m->x.x - m->z.x * m->x.z;
+	GLfloat r1z = m->z.x * m->x.y - m->z.y * m->x.x;
+
+	GLfloat r2x = m->x.y * m->y.z - m->x.z * m->y.y;
+	GLfloat r2y = m->x.z * m->y.x - m->x.x * m->y.z;
+	GLfloat r2z = m->x.x * m->y.y - m->x.y * m->y.x;
+
+	GLfloat inv = 1 / (m->x.x * r0x + m->x.y * r0y + m->x.z * r0z);
+	r0x *= inv, r0y *= inv, r0z *= inv;
+	r1x *= inv, r1y *= inv, r1z *= inv;
+	r2x *= inv, r2y *= inv, r2z *= inv;
+
+	// New translation is -(inverse 3x3 * t)
+	vec4 *t = &m->w;
+	mat4 r = {
+		{r0x, r1x, r2x, 0},
+		{r0y, r1y, r2y, 0},
+		{r0z, r1z, r2z, 0},
+		{-(r0x * t->x + r0y * t->y + r0z * t->z),
+		 -(r1x * t->x + r1y * t->y + r1z * t->z),
+		 -(r2x * t->x + r2y * t->y + r2z * t->z), 1},
+	};
+	return r;
+}
+
+/**
+ * Inverse of a rigid matrix, a rotation followed by a
+ * translation and nothing else. The rotation part is
+ * orthonormal so its inverse is its transpose.
+ */
+mat4 invRigid(mat4 *m)
+{
+	vec4 *t = &m->w;
+	mat4 r = {
+		{m->x.x, m->y.x, m->z.x, 0},
+		{m->x.y, m->y.y, m->z.y, 0},
+		{m->x.z, m->y.z, m->z.z, 0},
+		{-(m->x.x * t->x + m->x.y * t->y + m->x.z * t->z),
+		 -(m->y.x * t->x + m->y.y * t->y + m->y.z * t->z),
+		 -(m->z.x * t->x + m->z.y * t->y + m->z.z * t->z), 1},
+	};
+	return r;
 }
 
 /**
@@ -447,6 +655,13 @@ GLfloat det3x3(GLfloat arr[])
  */
 vec4 multMatVec(mat4 *m, vec4 *v)
 {
+#if LIB_SSE
+	// Linear combination of m's columns, no transpose needed
+	vec4 r;
+	storeVec(&r, combineCols(loadVec(&m->x), loadVec(&m->y),
+							 loadVec(&m->z), loadVec(&m->w), loadVec(v)));
+	return r;
+#else
 	mat4 t = transpose(m);
 	vec4 r = {
 		dotVec(&t.x, v),
@@ -455,6 +670,64 @@ vec4 multMatVec(mat4 *m, vec4 *v)
 		dotVec(&t.w, v),
 	};
 	return r;
+#endif
+}
+
+/**
+ * Multiply every vector in 'in' by m, writing the results
+ * to 'out'. Works on the whole array in one pass instead of
+ * calling multMatVec per vertex. 'in' and 'out' may be the
+ * same array.
+ */
+void transformVec4Array(const mat4 *m, const vec4 *in, vec4 *out, int n)
+{
+	int i = 0;
+#if LIB_AVX
+	// Two vertices per 256 bit register
+	__m256 c0 = dupCol(&m->x);
+	__m256 c1 = dupCol(&m->y);
+	__m256 c2 = dupCol(&m->z);
+	__m256 c3 = dupCol(&m->w);
+	for (; i + 2 <= n; i += 2)
+	{
+		__m256 v = _mm256_loadu_ps(&in[i].x);
+		__m256 r = _mm256_mul_ps(c0, _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(c1, _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1))));
+		r = _mm256_add_ps(r, _mm256_mul_ps(c2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2))));
+		r = _mm256_add_ps(r, _mm256_mul_ps(c3, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3))));
+		_mm256_storeu_ps(&out[i].x, r);
+	}
+#endif
+#if LIB_SSE
+	__m128 s0 = loadVec(&m->x);
+	__m128 s1 = loadVec(&m->y);
+	__m128 s2 = loadVec(&m->z);
+	__m128 s3 = loadVec(&m->w);
+	for (; i < n; i++)
+	{
+		storeVec(&out[i], combineCols(s0, s1, s2, s3, loadVec(&in[i])));
+	}
+#else
+	// Transpose once so each output element
+	// is a dot product with a row of m
+	mat4 t = transpose((mat4 *)m);
+	for (; i < n; i++)
+	{
+		vec4 v = in[i];
+		out[i].x = t.x.x * v.x + t.x.y * v.y + t.x.z * v.z + t.x.w * v.w;
+		out[i].y = t.y.x * v.x + t.y.y * v.y + t.y.z * v.z + t.y.w * v.w;
+		out[i].z = t.z.x * v.x + t.z.y * v.y + t.z.z * v.z + t.z.w * v.w;
+		out[i].w = t.w.x * v.x + t.w.y * v.y + t.w.z * v.z + t.w.w * v.w;
+	}
+#endif
+}
+
+/**
+ * Multiply every vector in an array by m, in place
+ */
+void transformVec4ArrayInPlace(const mat4 *m, vec4 *v, int n)
+{
+	transformVec4Array(m, v, v, n);
 }
 
 // AFFINE TRANSFORMATIONS
@@ -539,6 +812,764 @@ mat4 z_rotate(GLfloat theta)
 	return r;
 }
 
+// QUATERNIONS
+
+/**
+ * Quaternion for a rotation of theta radians about
+ * an axis. Same direction as x/y/z_rotate.
+ */
+quat quatAxisAngle(vec4 axis, GLfloat theta)
+{
+	axis.w = 0;
+	axis = normalize(&axis);
+	GLfloat s = sinf(theta / 2);
+	return (quat){axis.x * s, axis.y * s, axis.z * s, cosf(theta / 2)};
+}
+
+/**
+ * Returns a * b, the rotation b followed by a
+ */
+quat quatMult(quat *a, quat *b)
+{
+	return (quat){
+		a->w * b->x + a->x * b->w + a->y * b->z - a->z * b->y,
+		a->w * b->y - a->x * b->z + a->y * b->w + a->z * b->x,
+		a->w * b->z + a->x * b->y - a->y * b->x + a->z * b->w,
+		a->w * b->w - a->x * b->x - a->y * b->y - a->z * b->z};
+}
+
+/**
+ * Conjugate of a quaternion, which is the
+ * inverse rotation for a unit quaternion
+ */
+quat quatConj(quat *q)
+{
+	return (quat){-q->x, -q->y, -q->z, q->w};
+}
+
+/**
+ * Returns a unit length copy of a quaternion
+ */
+quat quatNormalize(quat *q)
+{
+	GLfloat s = 1 / sqrtf(q->x * q->x + q->y * q->y + q->z * q->z + q->w * q->w);
+	return (quat){q->x * s, q->y * s, q->z * s, q->w * s};
+}
+
+/**
+ * Spherical interpolation between two rotations,
+ * t = 0 gives a and t = 1 gives b
+ */
+quat quatSlerp(quat *a, quat *b, GLfloat t)
+{
+	quat c = *b;
+	GLfloat d = a->x * c.x + a->y * c.y + a->z * c.z + a->w * c.w;
+
+	// Take the short way around
+	if (d < 0)
+	{
+		c = (quat){-c.x, -c.y, -c.z, -c.w};
+		d = -d;
+	}
+
+	// Nearly the same rotation; a normalized lerp is
+	// just as good and avoids dividing by sin(0)
+	GLfloat s0 = 1 - t, s1 = t;
+	if (d < 0.9995)
+	{
+		GLfloat theta = acosf(d);
+		GLfloat inv = 1 / sinf(theta);
+		s0 = sinf((1 - t) * theta) * inv;
+		s1 = sinf(t * theta) * inv;
+	}
+
+	quat r = {
+		a->x * s0 + c.x * s1,
+		a->y * s0 + c.y * s1,
+		a->z * s0 + c.z * s1,
+		a->w * s0 + c.w * s1};
+	return quatNormalize(&r);
+}
+
+/**
+ * Rotation matrix for a unit quaternion
+ */
+mat4 quatToMat(quat *q)
+{
+	GLfloat xx = q->x * q->x, yy = q->y * q->y, zz = q->z * q->z;
+	GLfloat xy = q->x * q->y, xz = q->x * q->z, yz = q->y * q->z;
+	GLfloat wx = q->w * q->x, wy = q->w * q->y, wz = q->w * q->z;
+
+	mat4 r = {
+		{1 - 2 * (yy + zz), 2 * (xy + wz), 2 * (xz - wy), 0},
+		{2 * (xy - wz), 1 - 2 * (xx + zz), 2 * (yz + wx), 0},
+		{2 * (xz + wy), 2 * (yz - wx), 1 - 2 * (xx + yy), 0},
+		{0, 0, 0, 1},
+	};
+	return r;
+}
+
+/**
+ * Rotate a vector by a unit quaternion without
+ * building the matrix. The w element is unchanged.
+ */
+vec4 quatRotateVec(quat *q, vec4 *v)
+{
+	// t = 2 * (q.xyz cross v)
+	GLfloat tx = 2 * (q->y * v->z - q->z * v->y);
+	GLfloat ty = 2 * (q->z * v->x - q->x * v->z);
+	GLfloat tz = 2 * (q->x * v->y - q->y * v->x);
+
+	// v + w * t + (q.xyz cross t)
+	return v4(
+		v->x + q->w * tx + (q->y * tz - q->z * ty),
+		v->y + q->w * ty + (q->z * tx - q->x * tz),
+		v->z + q->w * tz + (q->x * ty - q->y * tx),
+		v->w);
+}
+
+// CAMERA
+
+/**
+ * Rotation from camera space to world space:
+ * pitch about x, then yaw about y
+ */
+quat cameraOrientation(camera *c)
+{
+	quat yaw = {0, sinf(c->yaw / 2), 0, cosf(c->yaw / 2)};
+	quat pitch = {sinf(c->pitch / 2), 0, 0, cosf(c->pitch / 2)};
+	return quatMult(&yaw, &pitch);
+}
+
+/**
+ * Unit vector the camera is looking along
+ */
+vec4 cameraForward(camera *c)
+{
+	quat q = cameraOrientation(c);
+	vec4 v = v4(0, 0, -1, 0);
+	return quatRotateVec(&q, &v);
+}
+
+/**
+ * Unit vector to the camera's right, always level
+ * with the y = 0 plane
+ */
+vec4 cameraRight(camera *c)
+{
+	return v4(cosf(c->yaw), 0, -sinf(c->yaw), 0);
+}
+
+/**
+ * Model view matrix for the camera. Same result as
+ * look_at(eye, eye + forward, y axis) but straight from
+ * the orientation, with no normalizing or cross products.
+ */
+mat4 cameraView(camera *c)
+{
+	// The inverse rotation takes world space to camera space
+	quat q = cameraOrientation(c);
+	q = quatConj(&q);
+	mat4 r = quatToMat(&q);
+
+	// Then move the eye to the origin
+	vec4 t = v4(-c->eye.x, -c->eye.y, -c->eye.z, 1);
+	r.w = multMatVec(&r, &t);
+
+	return r;
+}
+
+// INDEXED GEOMETRY
+
+// Hash the bits of a vertex's attributes
+static GLuint welderHash(welder *w, vec4 *p, vec2 *t, vec4 *c)
+{
+	GLuint words[10];
+	int n = 4;
+	memcpy(words, p, sizeof(vec4));
+	if (w->use_tex)
+	{
+		memcpy(words + n, t, sizeof(vec2));
+		n += 2;
+	}
+	if (w->use_color)
+	{
+		memcpy(words + n, c, sizeof(vec4));
+		n += 4;
+	}
+
+	// FNV-1a a word at a time, then spread the high bits down
+	// since the table is indexed by the low ones
+	GLuint h = 2166136261u;
+	for (int i = 0; i < n; i++)
+	{
+		h = (h ^ words[i]) * 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+// Build an empty table with num_slots slots and put every
+// vertex so far back into it
+static void welderRehash(welder *w, int num_slots)
+{
+	free(w->slots);
+	w->slots = (GLuint *)calloc(num_slots, sizeof(GLuint));
+	if (!w->slots)
+	{
+		printf("Error allocating memory for welder\n");
+		exit(1);
+	}
+	w->num_slots = num_slots;
+
+	vec2 no_tex = {0, 0};
+	vec4 no_color = {0, 0, 0, 0};
+	for (int i = 0; i < w->positions.length; i++)
+	{
+		GLuint slot = welderHash(w, &w->positions.items[i],
+								 w->use_tex ? &w->tex_coords.items[i] : &no_tex,
+								 w->use_color ? &w->colors.items[i] : &no_color);
+		slot &= num_slots - 1;
+		while (w->slots[slot])
+		{
+			slot = (slot + 1) & (num_slots - 1);
+		}
+		w->slots[slot] = i + 1;
+	}
+}
+
+/**
+ * Start welding with room for about expected unique
+ * vertices. use_tex and use_color pick which attributes
+ * are part of a vertex
+ */
+void welderNew(welder *w, int expected, GLboolean use_tex, GLboolean use_color)
+{
+	v4ListNew(&w->positions);
+	v2ListNew(&w->tex_coords);
+	v4ListNew(&w->colors);
+	u32ListNew(&w->indices);
+	w->use_tex = use_tex;
+	w->use_color = use_color;
+
+	v4ListReserve(&w->positions, expected);
+	if (use_tex)
+		v2ListReserve(&w->tex_coords, expected);
+	if (use_color)
+		v4ListReserve(&w->colors, expected);
+
+	// Keep the table at most half full
+	int num_slots = 64;
+	while (num_slots < expected * 2)
+	{
+		num_slots *= 2;
+	}
+	w->slots = NULL;
+	welderRehash(w, num_slots);
+}
+
+/**
+ * Add one triangle corner. If an identical vertex has
+ * already been added its index is reused, otherwise
+ * the vertex is stored. Returns the index
+ */
+GLuint welderAdd(welder *w, vec4 position, vec2 tex_coord, vec4 color)
+{
+	GLuint mask = w->num_slots - 1;
+	GLuint slot = welderHash(w, &position, &tex_coord, &color) & mask;
+	GLuint found;
+	while ((found = w->slots[slot]))
+	{
+		GLuint i = found - 1;
+		if (!memcmp(&w->positions.items[i], &position, sizeof(vec4)) &&
+			(!w->use_tex || !memcmp(&w->tex_coords.items[i], &tex_coord, sizeof(vec2))) &&
+			(!w->use_color || !memcmp(&w->colors.items[i], &color, sizeof(vec4))))
+		{
+			u32ListPush(&w->indices, i);
+			return i;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	GLuint index = w->positions.length;
+	v4ListPush(&w->positions, position);
+	if (w->use_tex)
+		v2ListPush(&w->tex_coords, tex_coord);
+	if (w->use_color)
+		v4ListPush(&w->colors, color);
+	u32ListPush(&w->indices, index);
+	w->slots[slot] = index + 1;
+
+	if (w->positions.length * 2 > w->num_slots)
+	{
+		welderRehash(w, w->num_slots * 2);
+	}
+	return index;
+}
+
+/**
+ * Add n corners from unindexed arrays. tex_coords and
+ * colors may be NULL if unused
+ */
+void welderAddArrays(welder *w, const vec4 *positions, const vec2 *tex_coords,
+					 const vec4 *colors, int n)
+{
+	vec2 no_tex = {0, 0};
+	vec4 no_color = {0, 0, 0, 0};
+	u32ListReserve(&w->indices, w->indices.length + n);
+	for (int i = 0; i < n; i++)
+	{
+		welderAdd(w, positions[i],
+				  tex_coords ? tex_coords[i] : no_tex,
+				  colors ? colors[i] : no_color);
+	}
+}
+
+/**
+ * Free the hash table and whatever the lists still hold.
+ * Release the lists first to keep their contents
+ */
+void welderFree(welder *w)
+{
+	free(w->slots);
+	w->slots = NULL;
+	v4ListFree(&w->positions);
+	v2ListFree(&w->tex_coords);
+	v4ListFree(&w->colors);
+	u32ListFree(&w->indices);
+}
+
+/**
+ * Narrow indices to 16 bits in place if every vertex
+ * can be addressed that way. Returns the GL type the
+ * array now holds for glDrawElements
+ */
+GLenum packIndices(GLuint *indices, int n, int num_vertices)
+{
+	if (num_vertices > 65536)
+		return GL_UNSIGNED_INT;
+
+	// Each short lands at or before the int it came
+	// from, so going forward never overwrites unread data.
+	// The shorts are copied in as bytes since the array
+	// is still read as GLuint
+	unsigned char *packed = (unsigned char *)indices;
+	for (int i = 0; i < n; i++)
+	{
+		GLushort index = (GLushort)indices[i];
+		memcpy(packed + i * sizeof(GLushort), &index, sizeof(GLushort));
+	}
+	return GL_UNSIGNED_SHORT;
+}
+
+/**
+ * Bytes per index of a glDrawElements index type
+ */
+size_t indexSize(GLenum type)
+{
+	return type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+// VERTEX CACHE OPTIMIZATION
+
+// Size of the LRU cache the triangle order is tuned
+// for, and of the FIFO used to measure the result.
+// Most hardware since about 2010 behaves like 16-32
+#define VERTEX_CACHE_SIZE 32
+// Valence past which a vertex's score stops changing
+#define MAX_VALENCE 32
+
+/**
+ * Count vertex shader runs for drawing n indices through
+ * a FIFO post-transform cache of cache_size entries
+ */
+int cacheMisses(const GLuint *indices, int n, int num_vertices, int cache_size)
+{
+	// A vertex is cached if fewer than cache_size misses
+	// have happened since it was last loaded
+	int *loaded = (int *)malloc(sizeof(int) * num_vertices);
+	if (!loaded)
+	{
+		printf("Error allocating memory for cache simulation\n");
+		exit(1);
+	}
+	for (int i = 0; i < num_vertices; i++)
+	{
+		loaded[i] = -cache_size - 1;
+	}
+
+	int misses = 0;
+	for (int i = 0; i < n; i++)
+	{
+		GLuint v = indices[i];
+		if (misses - loaded[v] > cache_size)
+		{
+			loaded[v] = misses;
+			misses++;
+		}
+	}
+	free(loaded);
+	return misses;
+}
+
+/**
+ * Print the average cache miss ratio (vertex shader runs
+ * per triangle, 0.5 is ideal) and average transform to
+ * vertex ratio (runs per unique vertex, 1.0 is ideal)
+ */
+void printCacheStats(const char *name, const GLuint *indices, int n, int num_vertices)
+{
+	int misses = cacheMisses(indices, n, num_vertices, VERTEX_CACHE_SIZE);
+	printf("%s: ACMR %.3f  ATVR %.3f\n", name,
+		   n ? misses / (n / 3.0) : 0.0,
+		   num_vertices ? (double)misses / num_vertices : 0.0);
+}
+
+/**
+ * Reorder triangles so vertices are reused while they're
+ * still in the post-transform cache, following Tom Forsyth's
+ * "Linear-Speed Vertex Cache Optimisation". Each vertex is
+ * scored on how recently it was used and how few triangles
+ * still need it, and the best scoring triangle touching the
+ * cache goes next. Triangles keep their winding
+ */
+void optimizeVertexCache(GLuint *indices, int n, int num_vertices)
+{
+	int num_tris = n / 3;
+	if (num_tris == 0)
+		return;
+
+	// Score tables so there's no pow() in the loop
+	GLfloat cache_score[VERTEX_CACHE_SIZE];
+	GLfloat valence_score[MAX_VALENCE + 1];
+	for (int i = 0; i < VERTEX_CACHE_SIZE; i++)
+	{
+		// The last triangle's vertices get a fixed score so
+		// its neighbours don't just get picked in a strip
+		if (i < 3)
+			cache_score[i] = 0.75;
+		else
+			cache_score[i] = pow(1.0 - (i - 3.0) / (VERTEX_CACHE_SIZE - 3), 1.5);
+	}
+	valence_score[0] = 0;
+	for (int i = 1; i <= MAX_VALENCE; i++)
+	{
+		// Favour finishing off vertices with few triangles left
+		valence_score[i] = 2.0 * pow(i, -0.5);
+	}
+
+	// Triangles using each vertex, packed by vertex
+	int *tri_start = (int *)calloc(num_vertices + 1, sizeof(int));
+	int *remaining = (int *)calloc(num_vertices, sizeof(int));
+	int *vert_tris = (int *)malloc(sizeof(int) * n);
+	GLfloat *vert_score = (GLfloat *)malloc(sizeof(GLfloat) * num_vertices);
+	GLfloat *tri_score = (GLfloat *)malloc(sizeof(GLfloat) * num_tris);
+	char *emitted = (char *)calloc(num_tris, 1);
+	GLuint *out = (GLuint *)malloc(sizeof(GLuint) * n);
+	if (!tri_start || !remaining || !vert_tris ||
+		!vert_score || !tri_score || !emitted || !out)
+	{
+		printf("Error allocating memory for vertex cache optimization\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		remaining[indices[i]]++;
+	}
+	for (int v = 0; v < num_vertices; v++)
+	{
+		tri_start[v + 1] = tri_start[v] + remaining[v];
+	}
+	// remaining doubles as a fill cursor, it ends up back
+	// at each vertex's triangle count
+	memset(remaining, 0, sizeof(int) * num_vertices);
+	for (int t = 0; t < num_tris; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint v = indices[3 * t + k];
+			vert_tris[tri_start[v] + remaining[v]++] = t;
+		}
+	}
+
+	for (int v = 0; v < num_vertices; v++)
+	{
+		vert_score[v] = valence_score[remaining[v] < MAX_VALENCE ? remaining[v] : MAX_VALENCE];
+	}
+	for (int t = 0; t < num_tris; t++)
+	{
+		tri_score[t] = vert_score[indices[3 * t]] +
+					   vert_score[indices[3 * t + 1]] +
+					   vert_score[indices[3 * t + 2]];
+	}
+
+	// LRU cache, most recent first. 3 extra slots hold
+	// what gets pushed out by the newest triangle
+	GLuint cache[VERTEX_CACHE_SIZE + 3];
+	int cache_len = 0;
+	int best = -1;
+	int scan = 0;
+
+	for (int out_tris = 0; out_tris < num_tris; out_tris++)
+	{
+		// Nothing in the cache has triangles left, which
+		// happens after every disconnected piece of a mesh.
+		// Rescanning all triangles for the best score each
+		// time would be quadratic, so take the next one
+		// still waiting in input order instead. scan only
+		// moves forward, so this is linear over the mesh
+		if (best < 0)
+		{
+			while (emitted[scan])
+			{
+				scan++;
+			}
+			best = scan;
+		}
+
+		// Emit it and take it off its vertices' lists
+		emitted[best] = 1;
+		GLuint *tri = &indices[3 * best];
+		memcpy(&out[3 * out_tris], tri, sizeof(GLuint) * 3);
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint v = tri[k];
+			int *list = &vert_tris[tri_start[v]];
+			for (int j = 0; j < remaining[v]; j++)
+			{
+				if (list[j] == best)
+				{
+					list[j] = list[--remaining[v]];
+					break;
+				}
+			}
+		}
+
+		// Move its vertices to the front of the cache
+		GLuint next[VERTEX_CACHE_SIZE + 3];
+		int next_len = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			next[next_len++] = tri[k];
+		}
+		for (int j = 0; j < cache_len; j++)
+		{
+			GLuint v = cache[j];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				next[next_len++] = v;
+		}
+		memcpy(cache, next, sizeof(GLuint) * next_len);
+		cache_len = next_len;
+
+		// Rescore everything that moved, including whatever
+		// just fell off the end
+		for (int j = 0; j < cache_len; j++)
+		{
+			GLuint v = cache[j];
+			GLfloat score = 0;
+			if (remaining[v] > 0)
+			{
+				score = valence_score[remaining[v] < MAX_VALENCE ? remaining[v] : MAX_VALENCE];
+				if (j < VERTEX_CACHE_SIZE)
+					score += cache_score[j];
+			}
+			GLfloat diff = score - vert_score[v];
+			vert_score[v] = score;
+			for (int i = 0; i < remaining[v]; i++)
+			{
+				tri_score[vert_tris[tri_start[v] + i]] += diff;
+			}
+		}
+		if (cache_len > VERTEX_CACHE_SIZE)
+			cache_len = VERTEX_CACHE_SIZE;
+
+		// Next is the best triangle using a cached vertex
+		best = -1;
+		GLfloat best_score = -1;
+		for (int j = 0; j < cache_len; j++)
+		{
+			GLuint v = cache[j];
+			for (int i = 0; i < remaining[v]; i++)
+			{
+				int t = vert_tris[tri_start[v] + i];
+				if (tri_score[t] > best_score)
+				{
+					best_score = tri_score[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	// Small or already well ordered meshes can come out
+	// slightly worse, so only keep the new order if it helps
+	if (cacheMisses(out, num_tris * 3, num_vertices, VERTEX_CACHE_SIZE) <
+		cacheMisses(indices, num_tris * 3, num_vertices, VERTEX_CACHE_SIZE))
+		memcpy(indices, out, sizeof(GLuint) * num_tris * 3);
+	free(tri_start);
+	free(remaining);
+	free(vert_tris);
+	free(vert_score);
+	free(tri_score);
+	free(emitted);
+	free(out);
+}
+
+// Put the items of arr in the order given by remap,
+// dropping any that map to -1
+static void remapArray(void *arr, const int *remap, int num_vertices, size_t size)
+{
+	char *copy = (char *)malloc(size * num_vertices);
+	if (!copy)
+	{
+		printf("Error allocating memory for vertex fetch optimization\n");
+		exit(1);
+	}
+	memcpy(copy, arr, size * num_vertices);
+	for (int v = 0; v < num_vertices; v++)
+	{
+		if (remap[v] >= 0)
+			memcpy((char *)arr + size * remap[v], copy + size * v, size);
+	}
+	free(copy);
+}
+
+/**
+ * Renumber vertices in the order the indices first use
+ * them so fetching walks forward through memory. Any of
+ * tex_coords and colors may be NULL. Unused vertices are
+ * dropped and the new vertex count is returned
+ */
+int optimizeVertexFetch(GLuint *indices, int n, vec4 *positions, vec2 *tex_coords,
+						vec4 *colors, int num_vertices)
+{
+	int *remap = (int *)malloc(sizeof(int) * num_vertices);
+	if (!remap)
+	{
+		printf("Error allocating memory for vertex fetch optimization\n");
+		exit(1);
+	}
+	for (int v = 0; v < num_vertices; v++)
+	{
+		remap[v] = -1;
+	}
+
+	int used = 0;
+	for (int i = 0; i < n; i++)
+	{
+		GLuint v = indices[i];
+		if (remap[v] < 0)
+			remap[v] = used++;
+		indices[i] = remap[v];
+	}
+
+	remapArray(positions, remap, num_vertices, sizeof(vec4));
+	if (tex_coords)
+		remapArray(tex_coords, remap, num_vertices, sizeof(vec2));
+	if (colors)
+		remapArray(colors, remap, num_vertices, sizeof(vec4));
+	free(remap);
+	return used;
+}
+
+// TEXT PARSING
+
+// Powers of 10 that are exact as doubles
+static const double pow10s[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/**
+ * Parse a decimal float with optional sign, fraction and
+ * exponent, reading no further than end. Only the first
+ * 19 significant digits count, which is far more than a
+ * GLfloat holds. Returns the character after the number,
+ * or NULL if there are no digits at p
+ */
+const char *parseFloat(const char *p, const char *end, GLfloat *out)
+{
+	int neg = 0;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		neg = *p == '-';
+		p++;
+	}
+
+	unsigned long long mant = 0;
+	int exp = 0, digits = 0, any = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, any = 1)
+	{
+		if (digits < 19)
+		{
+			mant = mant * 10 + (*p - '0');
+			digits += mant != 0;
+		}
+		else
+			exp++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = 1)
+		{
+			if (digits < 19)
+			{
+				mant = mant * 10 + (*p - '0');
+				digits += mant != 0;
+				exp--;
+			}
+		}
+	}
+	if (!any)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int eneg = 0, e = 0;
+		p++;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			eneg = *p == '-';
+			p++;
+		}
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			e = e < 1000 ? e * 10 + (*p - '0') : e;
+		}
+		exp += eneg ? -e : e;
+	}
+
+	double v = (double)mant;
+	if (exp > 0)
+		v *= exp <= 22 ? pow10s[exp] : pow(10, exp);
+	else if (exp < 0)
+		v /= exp >= -22 ? pow10s[-exp] : pow(10, -exp);
+	*out = neg ? -v : v;
+	return p;
+}
+
+/**
+ * Parse a decimal integer with optional sign, reading no
+ * further than end. Returns the character after it, or
+ * NULL if there are no digits at p
+ */
+const char *parseInt(const char *p, const char *end, int *out)
+{
+	int neg = 0, v = 0;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		neg = *p == '-';
+		p++;
+	}
+	if (p == end || *p < '0' || *p > '9')
+		return NULL;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		v = v * 10 + (*p - '0');
+	}
+	*out = neg ? -v : v;
+	return p;
+}
+
 // PERSPECTIVE FUNCTIONS
 
 /**
@@ -602,94 +1633,192 @@ mat4 perspective(GLfloat left, GLfloat right, GLfloat bottom,
 	return m4(x, y, z, w);
 }
 
-// FUNCTIONS FOR DYNAMIC LISTS
+// ARENAS
+
+// Every block starts with the arena state from before it
+// was chained on, so resetting can walk back through them.
+// The first block's header has a NULL base
+#define ARENA_HEADER ((sizeof(arena) + 15) & ~(size_t)15)
 
-// Init v4List
-void v4ListNew(v4List *list)
+static char *arenaBlock(size_t capacity)
 {
-	list->capacity = 512;
-	list->items = (vec4 *)malloc(sizeof(vec4) * list->capacity);
-	list->length = 0;
+	char *block = (char *)malloc(capacity);
+	if (!block)
+	{
+		printf("Error allocating %zu bytes for arena\n", capacity);
+		exit(1);
+	}
+	return block;
 }
 
-// Free space held by v4List
-void v4ListFree(v4List *list)
+// Free the newest block and go back to the one before it
+static void arenaPop(arena *a)
 {
-	free(list->items);
+	arena prev = *(arena *)a->base;
+	free(a->base);
+	a->base = prev.base;
+	a->capacity = prev.capacity;
+	a->used = prev.used;
+	a->prior -= prev.used;
 }
 
-// Resize v4List
-void v4ListResize(v4List *list, int capacity)
+/**
+ * Allocate capacity bytes for an arena to hand out
+ */
+void arenaNew(arena *a, size_t capacity)
 {
-	if (list)
-	{
-		vec4 *items = (vec4 *)realloc(list->items, sizeof(vec4) * capacity);
-		if (items)
-		{
-			list->items = items;
-			list->capacity = capacity;
-			return;
-		}
-		printf("Error reallocating memory for v4List\n");
-		exit(1);
-	}
+	if (capacity < ARENA_HEADER * 2)
+		capacity = ARENA_HEADER * 2;
+	a->base = arenaBlock(capacity);
+	a->capacity = capacity;
+	a->used = ARENA_HEADER;
+	a->prior = 0;
+	a->peak = ARENA_HEADER;
+	a->initial = capacity;
+	((arena *)a->base)->base = NULL;
 }
 
-// Add to v4List
-void v4ListPush(v4List *list, vec4 item)
+/**
+ * Take size bytes from the arena. Allocations are
+ * 16 byte aligned so SIMD loads stay on one line
+ */
+void *arenaAlloc(arena *a, size_t size)
 {
-	if (list)
+	size_t start = (a->used + 15) & ~(size_t)15;
+	if (start + size > a->capacity)
 	{
-		// Check if list is full
-		if (list->capacity == list->length)
-		{
-			// Double in size
-			v4ListResize(list, list->capacity * 2);
-		}
-		// Add to end of list
-		list->items[list->length] = item;
-		list->length += 1;
+		// Chain on a new block big enough for this
+		size_t capacity = a->capacity * 2;
+		if (capacity < ARENA_HEADER + size)
+			capacity = ARENA_HEADER + size;
+		char *block = arenaBlock(capacity);
+		*(arena *)block = *a;
+		a->prior += a->used;
+		a->base = block;
+		a->capacity = capacity;
+		start = ARENA_HEADER;
 	}
+	a->used = start + size;
+	if (a->prior + a->used > a->peak)
+		a->peak = a->prior + a->used;
+	return a->base + start;
 }
 
-// Init v2List
-void v2ListNew(v2List *list)
+/**
+ * Remember the current position to reset to later
+ */
+arenaPos arenaMark(arena *a)
 {
-	list->capacity = 512;
-	list->items = (vec2 *)malloc(sizeof(vec2) * list->capacity);
-	list->length = 0;
+	return (arenaPos){a->base, a->used};
 }
 
-// Resize v2List
-void v2ListResize(v2List *list, int capacity)
+/**
+ * Release everything allocated since pos was marked
+ */
+void arenaReset(arena *a, arenaPos pos)
 {
-	if (list)
+	while (a->base != pos.base)
 	{
-		vec2 *items = (vec2 *)realloc(list->items, sizeof(vec2) * capacity);
-		if (items)
+		if (!((arena *)a->base)->base)
 		{
-			list->items = items;
-			list->capacity = capacity;
-			return;
+			printf("Error: arena reset to a position it doesn't hold\n");
+			exit(1);
 		}
-		printf("Error reallocating memory for v2List\n");
-		exit(1);
+		arenaPop(a);
 	}
+	a->used = pos.used;
+}
+
+/**
+ * Release everything allocated from the arena,
+ * keeping the first block to use again
+ */
+void arenaClear(arena *a)
+{
+	while (((arena *)a->base)->base)
+		arenaPop(a);
+	a->used = ARENA_HEADER;
 }
 
-// Add to v2List
-void v2ListPush(v2List *list, vec2 item)
+/**
+ * Release everything and give the memory back
+ */
+void arenaFree(arena *a)
 {
-	if (list)
+	arenaClear(a);
+	free(a->base);
+	a->base = NULL;
+	a->capacity = 0;
+	a->used = 0;
+}
+
+/**
+ * Print the most the arena has ever had in use
+ */
+void printArena(arena *a, const char *name)
+{
+	printf("%s arena: peak %.1f KB of %.1f KB", name,
+		   a->peak / 1024.0, a->initial / 1024.0);
+	if (a->peak > a->initial)
+		printf(" (overflowed, start it at %zu bytes or more)", a->peak + ARENA_HEADER);
+	printf("\n");
+}
+
+// FUNCTIONS FOR DYNAMIC LISTS
+
+/**
+ * Next capacity for a list that needs room for needed
+ * items. Doubles so pushes are amortized constant time
+ */
+int listGrowth(int capacity, int needed)
+{
+	int grown = capacity ? capacity * 2 : 16;
+	return grown > needed ? grown : needed;
+}
+
+/**
+ * Move a list's items into storage for new_capacity items
+ * of size bytes each. Heap lists use realloc. Arena lists
+ * grow in place when they were the last thing allocated,
+ * otherwise they copy into a fresh block and leave the
+ * old one for the arena to reclaim
+ */
+void *listRealloc(void *items, int length, int capacity, int new_capacity,
+				  size_t size, arena *backing)
+{
+	if (!backing)
 	{
-		// Check if list is full
-		if (list->capacity == list->length)
+		if (new_capacity == 0)
+		{
+			free(items);
+			return NULL;
+		}
+		void *resized = realloc(items, size * new_capacity);
+		if (!resized)
 		{
-			// Double in size
-			v2ListResize(list, list->capacity * 2);
+			printf("Error reallocating memory for list\n");
+			exit(1);
 		}
-		// Add to end of list
-		list->items[list->length] = item;
-		list->length += 1;
+		return resized;
+	}
+
+	char *end = (char *)items + size * capacity;
+	if (items && end == backing->base + backing->used &&
+		(char *)items + size * new_capacity <= backing->base + backing->capacity)
+	{
+		backing->used = ((char *)items - backing->base) + size * new_capacity;
+		if (backing->prior + backing->used > backing->peak)
+			backing->peak = backing->prior + backing->used;
+		return items;
 	}
+	// Shrinking something in the middle of the arena frees
+	// nothing, so keep it where it is
+	if (new_capacity <= capacity)
+		return new_capacity ? items : NULL;
+
+	void *moved = arenaAlloc(backing, size * new_capacity);
+	int keep = length < new_capacity ? length : new_capacity;
+	if (keep > 0)
+		memcpy(moved, items, size * keep);
+	return moved;
 }
@@ -1,4 +1,10 @@
 
+#ifndef LIB_H
+#define LIB_H
+
+#include <stdlib.h>
+#include <string.h>
+
 #ifdef __APPLE__ // include Mac OS X verions of headers
 
 #include <OpenGL/OpenGL.h>
@@ -24,28 +30,12 @@ typedef struct
 
 typedef GLfloat vec4Arr[4];
 
-// A dynamically resizing list of vec4
-typedef struct
-{
-	vec4 *items;
-	int capacity;
-	int length;
-} v4List;
-
 typedef struct
 {
 	GLfloat x;
 	GLfloat y;
 } vec2;
 
-// A dynamically resizing list of vec2
-typedef struct
-{
-	vec2 *items;
-	int capacity;
-	int length;
-} v2List;
-
 typedef struct
 {
 	vec4 x;
@@ -56,6 +46,192 @@ typedef struct
 
 typedef GLfloat mat4Arr[16];
 
+// A rotation quaternion. x, y, z are the vector
+// part and w is the scalar part
+typedef struct
+{
+	GLfloat x;
+	GLfloat y;
+	GLfloat z;
+	GLfloat w;
+} quat;
+
+// A first person camera described by where it is and
+// which way it's facing instead of an eye/at pair.
+// Yaw of 0 looks down -z, positive turns left.
+// Positive pitch looks up.
+typedef struct
+{
+	vec4 eye;
+	GLfloat yaw;
+	GLfloat pitch;
+} camera;
+
+// A bump allocator handing out memory from one block.
+// Nothing is freed on its own; arenaReset rolls back to an
+// earlier arenaMark and arenaClear empties it, both without
+// touching the heap. If the block fills up another twice
+// the size is chained on, and peak tracks the most ever in
+// use so the first block can be sized to avoid that
+typedef struct
+{
+	char *base;
+	size_t capacity;
+	size_t used;
+	size_t prior; // Bytes used in earlier chained blocks
+	size_t peak;
+	size_t initial;
+} arena;
+
+// A position in an arena to roll back to
+typedef struct
+{
+	char *base;
+	size_t used;
+} arenaPos;
+
+void arenaNew(arena *a, size_t capacity);
+void *arenaAlloc(arena *a, size_t size);
+arenaPos arenaMark(arena *a);
+void arenaReset(arena *a, arenaPos pos);
+void arenaClear(arena *a);
+void arenaFree(arena *a);
+void printArena(arena *a, const char *name);
+
+void *listRealloc(void *items, int length, int capacity, int new_capacity,
+				  size_t size, arena *backing);
+int listGrowth(int capacity, int needed);
+
+/**
+ * Declare a dynamically resizing list of type along with
+ * its functions, all prefixed with name:
+ *   New/NewArena  start empty, no allocation until first use
+ *   Reserve       make room for at least capacity items
+ *   Resize        set capacity exactly
+ *   Push          add one item
+ *   Append        copy n items onto the end
+ *   Extend        add n uninitialized items, return the first
+ *   ShrinkToFit   drop unused capacity
+ *   Release       hand the items to the caller without copying
+ *   Clear         empty without freeing
+ *   Free          give the memory back
+ * Lists made with NewArena allocate from the arena, so
+ * their items must not be passed to free().
+ */
+#define LIST(name, type)                                                        \
+	typedef struct                                                              \
+	{                                                                           \
+		type *items;                                                            \
+		int capacity;                                                           \
+		int length;                                                             \
+		arena *backing;                                                         \
+	} name;                                                                     \
+                                                                                \
+	static inline void name##New(name *list)                                    \
+	{                                                                           \
+		list->items = NULL;                                                     \
+		list->capacity = 0;                                                     \
+		list->length = 0;                                                       \
+		list->backing = NULL;                                                   \
+	}                                                                           \
+                                                                                \
+	static inline void name##NewArena(name *list, arena *a)                     \
+	{                                                                           \
+		name##New(list);                                                        \
+		list->backing = a;                                                      \
+	}                                                                           \
+                                                                                \
+	static inline void name##Resize(name *list, int capacity)                   \
+	{                                                                           \
+		list->items = (type *)listRealloc(list->items, list->length,            \
+										  list->capacity, capacity,             \
+										  sizeof(type), list->backing);         \
+		list->capacity = capacity;                                              \
+		if (list->length > capacity)                                            \
+			list->length = capacity;                                            \
+	}                                                                           \
+                                                                                \
+	static inline void name##Reserve(name *list, int capacity)                  \
+	{                                                                           \
+		if (list->capacity < capacity)                                          \
+			name##Resize(list, capacity);                                       \
+	}                                                                           \
+                                                                                \
+	static inline void name##Push(name *list, type item)                        \
+	{                                                                           \
+		if (list->length == list->capacity)                                     \
+			name##Resize(list, listGrowth(list->capacity, list->length + 1));   \
+		list->items[list->length++] = item;                                     \
+	}                                                                           \
+                                                                                \
+	static inline type *name##Extend(name *list, int n)                         \
+	{                                                                           \
+		int needed = list->length + n;                                          \
+		if (needed > list->capacity)                                            \
+			name##Resize(list, listGrowth(list->capacity, needed));             \
+		type *start = list->items + list->length;                               \
+		list->length = needed;                                                  \
+		return start;                                                           \
+	}                                                                           \
+                                                                                \
+	static inline void name##Append(name *list, const type *items, int n)       \
+	{                                                                           \
+		if (n > 0)                                                              \
+			memcpy(name##Extend(list, n), items, sizeof(type) * n);             \
+	}                                                                           \
+                                                                                \
+	static inline void name##ShrinkToFit(name *list)                            \
+	{                                                                           \
+		if (list->capacity > list->length)                                      \
+			name##Resize(list, list->length);                                   \
+	}                                                                           \
+                                                                                \
+	static inline type *name##Release(name *list, int *length)                  \
+	{                                                                           \
+		type *items = list->items;                                              \
+		if (length)                                                             \
+			*length = list->length;                                             \
+		list->items = NULL;                                                     \
+		list->capacity = 0;                                                     \
+		list->length = 0;                                                       \
+		return items;                                                           \
+	}                                                                           \
+                                                                                \
+	static inline void name##Clear(name *list)                                  \
+	{                                                                           \
+		list->length = 0;                                                       \
+	}                                                                           \
+                                                                                \
+	static inline void name##Free(name *list)                                   \
+	{                                                                           \
+		if (!list->backing)                                                     \
+			free(list->items);                                                  \
+		list->items = NULL;                                                     \
+		list->capacity = 0;                                                     \
+		list->length = 0;                                                       \
+	}
+
+// Dynamically resizing lists of vec4, vec2, and indices
+LIST(v4List, vec4)
+LIST(v2List, vec2)
+LIST(u32List, GLuint)
+
+// Turns a stream of triangle corners into indexed geometry,
+// keeping one copy of each distinct (position, tex coord,
+// color) and one index per corner. Attributes that aren't
+// used are neither stored nor compared
+typedef struct
+{
+	v4List positions;
+	v2List tex_coords;
+	v4List colors;
+	u32List indices;
+	GLuint *slots; // Hash table of vertex index + 1, 0 if empty
+	int num_slots;
+	GLboolean use_tex;
+	GLboolean use_color;
+} welder;
+
 // Function Signatures
 
 vec2 v2(GLfloat x, GLfloat y);
@@ -87,10 +263,14 @@ mat4 subMat(mat4 *m, mat4 *n);
 mat4 multMat(mat4 *m, mat4 *n);
 mat4 transpose(mat4 *m);
 mat4 invMat(mat4 *m);
+mat4 invAffine(mat4 *m);
+mat4 invRigid(mat4 *m);
 mat4 minorMat(mat4 *m);
 mat4 cofactor(mat4 *m);
 GLfloat det3x3(GLfloat arr[]);
 vec4 multMatVec(mat4 *m, vec4 *v);
+void transformVec4Array(const mat4 *m, const vec4 *in, vec4 *out, int n);
+void transformVec4ArrayInPlace(const mat4 *m, vec4 *v, int n);
 
 mat4 translate(GLfloat x, GLfloat y, GLfloat z);
 mat4 scale(GLfloat x, GLfloat y, GLfloat z);
@@ -98,15 +278,38 @@ mat4 x_rotate(GLfloat theta);
 mat4 y_rotate(GLfloat theta);
 mat4 z_rotate(GLfloat theta);
 
+quat quatAxisAngle(vec4 axis, GLfloat theta);
+quat quatMult(quat *a, quat *b);
+quat quatConj(quat *q);
+quat quatNormalize(quat *q);
+quat quatSlerp(quat *a, quat *b, GLfloat t);
+mat4 quatToMat(quat *q);
+vec4 quatRotateVec(quat *q, vec4 *v);
+
+quat cameraOrientation(camera *c);
+vec4 cameraForward(camera *c);
+vec4 cameraRight(camera *c);
+mat4 cameraView(camera *c);
+
+void welderNew(welder *w, int expected, GLboolean use_tex, GLboolean use_color);
+GLuint welderAdd(welder *w, vec4 position, vec2 tex_coord, vec4 color);
+void welderAddArrays(welder *w, const vec4 *positions, const vec2 *tex_coords,
+					 const vec4 *colors, int n);
+void welderFree(welder *w);
+GLenum packIndices(GLuint *indices, int n, int num_vertices);
+size_t indexSize(GLenum type);
+
+int cacheMisses(const GLuint *indices, int n, int num_vertices, int cache_size);
+void printCacheStats(const char *name, const GLuint *indices, int n, int num_vertices);
+void optimizeVertexCache(GLuint *indices, int n, int num_vertices);
+int optimizeVertexFetch(GLuint *indices, int n, vec4 *positions, vec2 *tex_coords,
+						vec4 *colors, int num_vertices);
+
+const char *parseFloat(const char *p, const char *end, GLfloat *out);
+const char *parseInt(const char *p, const char *end, int *out);
+
 mat4 look_at(vec4 eye, vec4 at, vec4 up);
 mat4 perspective(GLfloat left, GLfloat right, GLfloat bottom,
 				 GLfloat top, GLfloat near, GLfloat far);
 
-void v4ListNew(v4List *list);
-void v4ListFree(v4List *list);
-void v4ListResize(v4List *list, int capacity);
-void v4ListPush(v4List *list, vec4 item);
-
-void v2ListNew(v2List *list);
-void v2ListResize(v2List *list, int capacity);
-void v2ListPush(v2List *list, vec2 item);
\ No newline at end of file
+#endif // LIB_H
@@ -0,0 +1,22 @@
+#ifndef LIB_SIMD_H
+#define LIB_SIMD_H
+
+// Pick a SIMD backend at build time, for lib.c and every
+// lib file with a vector path. SSE2 is always there on
+// x86_64; SSSE3 and AVX get used when the compiler is
+// told it can (-mssse3, -mavx or -march=native). Define
+// LIB_NO_SIMD to force the plain scalar code everywhere
+#if !defined(LIB_NO_SIMD) && defined(__SSE2__)
+#define LIB_SSE 1
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#define LIB_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX__)
+#define LIB_AVX 1
+#include <immintrin.h>
+#endif
+#endif
+
+#endif
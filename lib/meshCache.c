@@ -0,0 +1,184 @@
+// For madvise when built with -std=c99, as lab2 does
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "meshCache.h"
+#include "cacheFile.h"
+
+// Bump when the layout below changes
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_MAGIC 0x4853454d // "MESH" when little endian
+// Sections start on cache line boundaries
+#define SECTION_ALIGN 64
+
+// The file is this header followed by the positions,
+// colors, tex coords and indices, in the same order
+// they're laid out in a vertex buffer. Written in the
+// machine's own byte order, so a cache from a machine
+// of the other endianness fails the magic check
+typedef struct
+{
+	GLuint magic;
+	GLuint version;
+	unsigned long long source_hash;
+	GLuint index_type;
+	GLint num_vertices;
+	GLint num_indices;
+	GLint has_colors;
+	GLint has_tex_coords;
+	GLuint pad;
+	unsigned long long positions_offset;
+	unsigned long long colors_offset;
+	unsigned long long tex_coords_offset;
+	unsigned long long indices_offset;
+	unsigned long long file_size;
+} meshCacheHeader;
+
+static unsigned long long alignUp(unsigned long long n)
+{
+	return (n + SECTION_ALIGN - 1) & ~(unsigned long long)(SECTION_ALIGN - 1);
+}
+
+// Whether a section lies within a file of the given size
+static int inFile(unsigned long long offset, unsigned long long length, size_t size)
+{
+	return offset <= size && length <= size - offset && offset % SECTION_ALIGN == 0;
+}
+
+/**
+ * 64 bit FNV-1a hash of a file's size and contents, taken
+ * 8 bytes at a time so it runs well ahead of the disk.
+ * Exits with a message if the file can't be read
+ */
+unsigned long long hashFile(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		printf("Error: could not open '%s'\n", filename);
+		exit(1);
+	}
+	size_t size = st.st_size;
+	unsigned long long h = 14695981039346656037ull;
+	h = (h ^ size) * 1099511628211ull;
+	if (size > 0)
+	{
+		const unsigned char *data = (const unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			printf("Error: could not map '%s'\n", filename);
+			exit(1);
+		}
+		madvise((void *)data, size, MADV_SEQUENTIAL);
+
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			unsigned long long word;
+			memcpy(&word, data + i, 8);
+			h = (h ^ word) * 1099511628211ull;
+		}
+		for (; i < size; i++)
+		{
+			h = (h ^ data[i]) * 1099511628211ull;
+		}
+		munmap((void *)data, size);
+	}
+	close(fd);
+	return h;
+}
+
+/**
+ * Map a cache file written by meshCacheSave. The arrays
+ * point straight into the mapping, nothing is copied.
+ * Returns 0 and leaves mesh alone if the file is missing,
+ * damaged, or was made from a different source
+ */
+int meshCacheLoad(meshCache *mesh, const char *filename, unsigned long long source_hash)
+{
+	size_t size;
+	char *data = (char *)cacheMap(filename, sizeof(meshCacheHeader), &size);
+	if (!data)
+		return 0;
+
+	// Every section has to be inside the file
+	const meshCacheHeader *h = (const meshCacheHeader *)data;
+	size_t index_size = h->index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	int ok = h->magic == MESH_CACHE_MAGIC && h->version == MESH_CACHE_VERSION &&
+			 h->source_hash == source_hash && h->file_size == size &&
+			 (h->index_type == GL_UNSIGNED_SHORT || h->index_type == GL_UNSIGNED_INT) &&
+			 h->num_vertices >= 0 && h->num_indices >= 0 &&
+			 inFile(h->positions_offset, sizeof(vec4) * h->num_vertices, size) &&
+			 (!h->has_colors || inFile(h->colors_offset, sizeof(vec4) * h->num_vertices, size)) &&
+			 (!h->has_tex_coords || inFile(h->tex_coords_offset, sizeof(vec2) * h->num_vertices, size)) &&
+			 inFile(h->indices_offset, index_size * h->num_indices, size);
+	if (!ok)
+	{
+		cacheUnmap(data, size);
+		return 0;
+	}
+
+	mesh->positions = (vec4 *)(data + h->positions_offset);
+	mesh->colors = h->has_colors ? (vec4 *)(data + h->colors_offset) : NULL;
+	mesh->tex_coords = h->has_tex_coords ? (vec2 *)(data + h->tex_coords_offset) : NULL;
+	mesh->indices = data + h->indices_offset;
+	mesh->index_type = h->index_type;
+	mesh->num_vertices = h->num_vertices;
+	mesh->num_indices = h->num_indices;
+	mesh->map = data;
+	mesh->map_size = size;
+	return 1;
+}
+
+/**
+ * Write a mesh to a cache file tagged with the hash of
+ * whatever it was built from, through cacheWrite.
+ * Returns 0 if it couldn't be written
+ */
+int meshCacheSave(const meshCache *mesh, const char *filename, unsigned long long source_hash)
+{
+	size_t vert_size = sizeof(vec4) * mesh->num_vertices;
+	size_t tex_size = mesh->tex_coords ? sizeof(vec2) * mesh->num_vertices : 0;
+	size_t color_size = mesh->colors ? vert_size : 0;
+	size_t index_size = indexSize(mesh->index_type) * mesh->num_indices;
+
+	meshCacheHeader h = {0};
+	h.magic = MESH_CACHE_MAGIC;
+	h.version = MESH_CACHE_VERSION;
+	h.source_hash = source_hash;
+	h.index_type = mesh->index_type;
+	h.num_vertices = mesh->num_vertices;
+	h.num_indices = mesh->num_indices;
+	h.has_colors = mesh->colors != NULL;
+	h.has_tex_coords = mesh->tex_coords != NULL;
+	h.positions_offset = alignUp(sizeof(h));
+	h.colors_offset = alignUp(h.positions_offset + vert_size);
+	h.tex_coords_offset = alignUp(h.colors_offset + color_size);
+	h.indices_offset = alignUp(h.tex_coords_offset + tex_size);
+	h.file_size = alignUp(h.indices_offset + index_size);
+
+	cacheSection sections[] = {
+		{&h, sizeof(h), 0},
+		{mesh->positions, vert_size, h.positions_offset},
+		{mesh->colors, color_size, h.colors_offset},
+		{mesh->tex_coords, tex_size, h.tex_coords_offset},
+		{mesh->indices, index_size, h.indices_offset}};
+	return cacheWrite(filename, sections, 5, h.file_size);
+}
+
+/**
+ * Unmap a mesh loaded by meshCacheLoad. Meshes that
+ * weren't loaded from a file are left alone
+ */
+void meshCacheClose(meshCache *mesh)
+{
+	if (mesh->map)
+		cacheUnmap(mesh->map, mesh->map_size);
+	mesh->map = NULL;
+	mesh->map_size = 0;
+}
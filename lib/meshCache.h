@@ -0,0 +1,28 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "lib.h"
+
+// An indexed mesh ready to upload, either built by the
+// program or mapped from a cache file. colors and
+// tex_coords are NULL when the mesh doesn't have them
+typedef struct
+{
+	vec4 *positions;
+	vec4 *colors;
+	vec2 *tex_coords;
+	void *indices;
+	GLenum index_type;
+	int num_vertices;
+	int num_indices;
+	// Mapping holding the arrays when loaded from a file
+	void *map;
+	size_t map_size;
+} meshCache;
+
+unsigned long long hashFile(const char *filename);
+int meshCacheLoad(meshCache *mesh, const char *filename, unsigned long long source_hash);
+int meshCacheSave(const meshCache *mesh, const char *filename, unsigned long long source_hash);
+void meshCacheClose(meshCache *mesh);
+
+#endif
@@ -0,0 +1,138 @@
+// For clock_gettime under -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include "meshUpload.h"
+#include "msClock.h"
+
+// Highest index in indices[first, last), plus one
+static int vertexEnd(const meshUpload *u, int first, int last)
+{
+	GLuint end = 0;
+	if (u->index_type == GL_UNSIGNED_SHORT)
+	{
+		const GLushort *idx = (const GLushort *)u->indices;
+		for (int i = first; i < last; i++)
+		{
+			end = idx[i] >= end ? idx[i] + 1 : end;
+		}
+	}
+	else
+	{
+		const GLuint *idx = (const GLuint *)u->indices;
+		for (int i = first; i < last; i++)
+		{
+			end = idx[i] >= end ? idx[i] + 1 : end;
+		}
+	}
+	return end;
+}
+
+// Copy vertices [uploaded_vertices, end) into each
+// section of the vertex buffer
+static void uploadVertices(meshUpload *u, int end)
+{
+	int first = u->uploaded_vertices;
+	if (end <= first)
+		return;
+	size_t n = end - first;
+	size_t offset = 0;
+	glBufferSubData(GL_ARRAY_BUFFER, offset + sizeof(vec4) * first, sizeof(vec4) * n, &u->positions[first]);
+	offset += sizeof(vec4) * u->num_vertices;
+	if (u->colors)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, offset + sizeof(vec4) * first, sizeof(vec4) * n, &u->colors[first]);
+		offset += sizeof(vec4) * u->num_vertices;
+	}
+	if (u->tex_coords)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, offset + sizeof(vec2) * first, sizeof(vec2) * n, &u->tex_coords[first]);
+	}
+	u->uploaded_vertices = end;
+}
+
+/**
+ * Create the vertex and index buffers at full size, with
+ * nothing in them yet, and leave them bound so attribute
+ * pointers can be set up. colors and tex_coords can be
+ * NULL, in which case they get no section
+ */
+void meshUploadStart(meshUpload *u, const vec4 *positions, const vec4 *colors, const vec2 *tex_coords,
+					 int num_vertices, const void *indices, GLenum index_type, int num_indices)
+{
+	*u = (meshUpload){0, 0, positions, colors, tex_coords, indices, index_type, num_vertices, num_indices};
+
+	size_t vertex_size = sizeof(vec4) * num_vertices;
+	if (colors)
+		vertex_size += sizeof(vec4) * num_vertices;
+	if (tex_coords)
+		vertex_size += sizeof(vec2) * num_vertices;
+	glGenBuffers(1, &u->vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, u->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertex_size, NULL, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &u->index_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, u->index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize(index_type) * num_indices, NULL, GL_STATIC_DRAW);
+}
+
+/**
+ * Upload whole triangles, about chunk_size bytes of
+ * indices at a time, along with every vertex they use,
+ * until budget_ms has passed or everything is in. At
+ * least one chunk goes up per call. Returns how many
+ * indices, from the start, can be drawn so far. The
+ * index buffer binding belongs to the bound vertex
+ * array, so bind the mesh's one first.
+ *
+ * Vertices go up as a prefix, as far as the highest
+ * index needs. A mesh laid out by optimizeVertexFetch
+ * uses its vertices in order, so that's only the ones
+ * these triangles add. Other meshes still come out
+ * right, but may need most vertices up front
+ */
+int meshUploadStep(meshUpload *u, size_t chunk_size, double budget_ms)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int chunk = chunk_size / indexSize(u->index_type) / 3 * 3;
+	if (chunk < 3)
+		chunk = 3;
+
+	glBindBuffer(GL_ARRAY_BUFFER, u->vertex_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, u->index_buffer);
+	while (u->uploaded_indices < u->num_indices)
+	{
+		int first = u->uploaded_indices;
+		int last = first + chunk < u->num_indices ? first + chunk : u->num_indices;
+		int end = vertexEnd(u, first, last);
+		if (end > u->num_vertices)
+		{
+			printf("Error: index %d is past the %d vertices being uploaded\n", end - 1, u->num_vertices);
+			exit(1);
+		}
+
+		// Vertices first, so everything drawn has them
+		uploadVertices(u, end);
+		size_t size = indexSize(u->index_type);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, size * first, size * (last - first),
+						(const char *)u->indices + size * first);
+		u->uploaded_indices = last;
+
+		if (msSince(&start) >= budget_ms)
+			break;
+	}
+
+	// Vertices no index uses go up with the last chunk
+	if (u->uploaded_indices == u->num_indices)
+		uploadVertices(u, u->num_vertices);
+	return u->uploaded_indices;
+}
+
+/**
+ * Whether everything is in the buffers
+ */
+int meshUploadDone(const meshUpload *u)
+{
+	return u->uploaded_indices == u->num_indices && u->uploaded_vertices == u->num_vertices;
+}
@@ -0,0 +1,32 @@
+#ifndef MESH_UPLOAD_H
+#define MESH_UPLOAD_H
+
+#include "lib.h"
+
+// An indexed mesh being copied into GL buffers a chunk
+// at a time. The vertex buffer holds the positions, then
+// the colors and tex coords if there are any, as one
+// section each. The arrays have to stay valid until
+// meshUploadDone
+typedef struct
+{
+	GLuint vertex_buffer;
+	GLuint index_buffer;
+	const vec4 *positions;
+	const vec4 *colors;
+	const vec2 *tex_coords;
+	const void *indices;
+	GLenum index_type;
+	int num_vertices;
+	int num_indices;
+	// How much is in the buffers so far
+	int uploaded_vertices;
+	int uploaded_indices;
+} meshUpload;
+
+void meshUploadStart(meshUpload *u, const vec4 *positions, const vec4 *colors, const vec2 *tex_coords,
+					 int num_vertices, const void *indices, GLenum index_type, int num_indices);
+int meshUploadStep(meshUpload *u, size_t chunk_size, double budget_ms);
+int meshUploadDone(const meshUpload *u);
+
+#endif
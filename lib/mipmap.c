@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "mipmap.h"
+#include "cacheFile.h"
+#include "libSimd.h"
+
+// Levels smaller than this are made on one thread,
+// starting threads would cost more than it saves
+#define MIN_THREADED_TEXELS (1 << 16)
+#define MAX_THREADS 16
+
+// Bump when the layout below changes
+#define MIP_CACHE_VERSION 2
+#define MIP_CACHE_MAGIC 0x5350494d // "MIPS" when little endian
+
+// The cache file is this header followed by levels 1 and
+// up, back to back. It's tied to its source by the
+// source's size and modification time
+typedef struct
+{
+	GLuint magic;
+	GLuint version;
+	cacheStamp source;
+	GLint width;
+	GLint height;
+	GLint num_levels;
+	GLint pad;
+	unsigned long long file_size;
+} mipCacheHeader;
+
+// Rows [first_row, last_row) of one level, made from
+// the level above it
+typedef struct
+{
+	const GLubyte *src;
+	int src_width, src_height;
+	GLubyte *dst;
+	int dst_width;
+	int first_row, last_row;
+} mipJob;
+
+/**
+ * Width and height of every level of a full chain, from
+ * level 0 down to 1x1. Returns how many levels there are
+ */
+int mipLevelDims(int width, int height, int *widths, int *heights)
+{
+	int num_levels = 0;
+	while (num_levels < MIP_MAX_LEVELS)
+	{
+		widths[num_levels] = width;
+		heights[num_levels++] = height;
+		if (width == 1 && height == 1)
+			break;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return num_levels;
+}
+
+// Sizes of every level, and the bytes levels 1 and up need
+static size_t levelSizes(mipChain *mips, int width, int height)
+{
+	size_t size = 0;
+	mips->num_levels = mipLevelDims(width, height, mips->width, mips->height);
+	for (int i = 1; i < mips->num_levels; i++)
+	{
+		size += 3 * (size_t)mips->width[i] * mips->height[i];
+	}
+	return size;
+}
+
+// Point each level into one block holding them all
+static void placeLevels(mipChain *mips, const GLubyte *data)
+{
+	mips->levels[0] = NULL;
+	for (int i = 1; i < mips->num_levels; i++)
+	{
+		mips->levels[i] = data;
+		data += 3 * (size_t)mips->width[i] * mips->height[i];
+	}
+}
+
+// Average 2x2 blocks of two RGBA rows into one row of
+// out_width texels. An odd last column is dropped, and
+// a 1 texel wide row is averaged with itself
+static void downsampleRow(const GLubyte *row0, const GLubyte *row1, int src_width,
+						  GLubyte *out, int out_width)
+{
+	int x = 0;
+#if LIB_SSE
+	// Four output texels from eight input texels a step.
+	// Sums are taken in 16 bits so nothing rounds early
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	for (; x + 4 <= out_width && 2 * x + 8 <= src_width; x += 4)
+	{
+		__m128i half[2];
+		for (int k = 0; k < 2; k++)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(row0 + 8 * x + 16 * k));
+			__m128i b = _mm_loadu_si128((const __m128i *)(row1 + 8 * x + 16 * k));
+			// Texels 0 and 1, and 2 and 3, with both rows added
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			// Add each texel to its neighbour
+			lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+			half[k] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+		}
+		_mm_storeu_si128((__m128i *)(out + 4 * x), _mm_packus_epi16(half[0], half[1]));
+	}
+#endif
+	for (; x < out_width; x++)
+	{
+		int x0 = 2 * x, x1 = 2 * x + 1 < src_width ? 2 * x + 1 : x0;
+		for (int c = 0; c < 4; c++)
+		{
+			out[4 * x + c] = (row0[4 * x0 + c] + row0[4 * x1 + c] + row1[4 * x0 + c] + row1[4 * x1 + c] + 2) >> 2;
+		}
+	}
+}
+
+// Widen an RGB row to RGBA
+static void expandRow(const GLubyte *src, int width, GLubyte *dst)
+{
+	for (int x = 0; x < width; x++)
+	{
+		dst[4 * x] = src[3 * x];
+		dst[4 * x + 1] = src[3 * x + 1];
+		dst[4 * x + 2] = src[3 * x + 2];
+		dst[4 * x + 3] = 255;
+	}
+}
+
+// Drop the alpha of an RGBA row
+static void packRow(const GLubyte *src, int width, GLubyte *dst)
+{
+	for (int x = 0; x < width; x++)
+	{
+		dst[3 * x] = src[4 * x];
+		dst[3 * x + 1] = src[4 * x + 1];
+		dst[3 * x + 2] = src[4 * x + 2];
+	}
+}
+
+static void *runJob(void *arg)
+{
+	mipJob *job = (mipJob *)arg;
+	size_t src_stride = 3 * (size_t)job->src_width;
+	// Rows are widened to RGBA for the kernel and the
+	// result packed back to RGB, so the levels stay as
+	// small as level 0 and go to the GL as they are
+	GLubyte *wide = (GLubyte *)malloc(8 * (size_t)job->src_width + 4 * (size_t)job->dst_width);
+	if (!wide)
+	{
+		printf("Error allocating memory for mipmaps\n");
+		exit(1);
+	}
+	GLubyte *out = wide + 8 * (size_t)job->src_width;
+	for (int y = job->first_row; y < job->last_row; y++)
+	{
+		int y1 = 2 * y + 1 < job->src_height ? 2 * y + 1 : 2 * y;
+		expandRow(job->src + src_stride * 2 * y, job->src_width, wide);
+		expandRow(job->src + src_stride * y1, job->src_width, wide + 4 * job->src_width);
+		downsampleRow(wide, wide + 4 * job->src_width, job->src_width, out, job->dst_width);
+		packRow(out, job->dst_width, job->dst + 3 * (size_t)job->dst_width * y);
+	}
+	free(wide);
+	return NULL;
+}
+
+/**
+ * Build the mip chain of an RGB texture with a 2x2 box
+ * filter, each level from the one before. Bigger levels
+ * are split into bands of rows, one per thread.
+ * num_threads of 0 uses one thread per core. Exits with
+ * a message if there isn't memory for it
+ */
+void mipBuild(mipChain *mips, const textureFile *tex, int num_threads)
+{
+	mips->size = levelSizes(mips, tex->width, tex->height);
+	mips->data = malloc(mips->size ? mips->size : 1);
+	mips->mapped = GL_FALSE;
+	if (!mips->data)
+	{
+		printf("Error allocating memory for mipmaps\n");
+		exit(1);
+	}
+	placeLevels(mips, (const GLubyte *)mips->data);
+
+	if (num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	for (int i = 1; i < mips->num_levels; i++)
+	{
+		int w = mips->width[i], h = mips->height[i];
+		int threads = (size_t)w * h < MIN_THREADED_TEXELS ? 1 : num_threads;
+		if (threads > h)
+			threads = h;
+		mipJob jobs[MAX_THREADS];
+		pthread_t ids[MAX_THREADS];
+		for (int t = 0; t < threads; t++)
+		{
+			jobs[t] = (mipJob){i == 1 ? tex->texels : mips->levels[i - 1],
+							   mips->width[i - 1], mips->height[i - 1],
+							   (GLubyte *)mips->levels[i], w, h * t / threads, h * (t + 1) / threads};
+			if (t > 0 && pthread_create(&ids[t], NULL, runJob, &jobs[t]))
+			{
+				printf("Error starting mipmap thread\n");
+				exit(1);
+			}
+		}
+		runJob(&jobs[0]);
+		for (int t = 1; t < threads; t++)
+		{
+			pthread_join(ids[t], NULL);
+		}
+	}
+}
+
+/**
+ * Map a chain saved by mipSave for the file source.
+ * Returns 0 and leaves mips alone if the cache is
+ * missing or damaged, or source has changed since
+ */
+int mipLoad(mipChain *mips, const char *filename, const char *source)
+{
+	cacheStamp stamp;
+	size_t size;
+	if (!cacheStampOf(source, &stamp))
+		return 0;
+	char *data = (char *)cacheMap(filename, sizeof(mipCacheHeader), &size);
+	if (!data)
+		return 0;
+
+	const mipCacheHeader *h = (const mipCacheHeader *)data;
+	mipChain m;
+	int ok = h->magic == MIP_CACHE_MAGIC && h->version == MIP_CACHE_VERSION &&
+			 cacheStampEqual(&h->source, &stamp) &&
+			 h->width > 0 && h->height > 0 && h->file_size == size &&
+			 levelSizes(&m, h->width, h->height) == size - sizeof(mipCacheHeader) &&
+			 m.num_levels == h->num_levels;
+	if (!ok)
+	{
+		cacheUnmap(data, size);
+		return 0;
+	}
+	*mips = m;
+	placeLevels(mips, (const GLubyte *)data + sizeof(mipCacheHeader));
+	mips->data = data;
+	mips->size = size;
+	mips->mapped = GL_TRUE;
+	return 1;
+}
+
+/**
+ * Write a chain to a cache file tied to the file source,
+ * through cacheWrite. Returns 0 if it couldn't be
+ */
+int mipSave(const mipChain *mips, const char *filename, const char *source)
+{
+	mipCacheHeader h = {0};
+	if (!cacheStampOf(source, &h.source))
+		return 0;
+	h.magic = MIP_CACHE_MAGIC;
+	h.version = MIP_CACHE_VERSION;
+	h.width = mips->width[0];
+	h.height = mips->height[0];
+	h.num_levels = mips->num_levels;
+	const GLubyte *levels = mips->num_levels > 1 ? mips->levels[1] : NULL;
+	size_t levels_size = 0;
+	for (int i = 1; i < mips->num_levels; i++)
+	{
+		levels_size += 3 * (size_t)mips->width[i] * mips->height[i];
+	}
+	h.file_size = sizeof(h) + levels_size;
+
+	cacheSection sections[] = {{&h, sizeof(h), 0}, {levels, levels_size, sizeof(h)}};
+	return cacheWrite(filename, sections, 2, h.file_size);
+}
+
+/**
+ * Mip chain of a texture opened from source, mapped from
+ * source.mips if that's up to date, otherwise built on
+ * every core and saved there for next time. Returns 1
+ * if it came from the cache
+ */
+int mipChainFor(mipChain *mips, const textureFile *tex, const char *source)
+{
+	size_t name_len = strlen(source) + 6;
+	char *cache_name = (char *)malloc(name_len);
+	if (!cache_name)
+	{
+		printf("Error allocating memory for mipmaps\n");
+		exit(1);
+	}
+	snprintf(cache_name, name_len, "%s.mips", source);
+
+	int cached = mipLoad(mips, cache_name, source);
+	if (cached && (mips->width[0] != tex->width || mips->height[0] != tex->height))
+	{
+		mipFree(mips);
+		cached = 0;
+	}
+	if (!cached)
+	{
+		mipBuild(mips, tex, 0);
+		if (!mipSave(mips, cache_name, source))
+			printf("Couldn't write %s, mipmaps will be made again next time\n", cache_name);
+	}
+	free(cache_name);
+	return cached;
+}
+
+/**
+ * Free or unmap a chain from mipBuild or mipLoad
+ */
+void mipFree(mipChain *mips)
+{
+	if (mips->mapped)
+		cacheUnmap(mips->data, mips->size);
+	else
+		free(mips->data);
+	mips->data = NULL;
+	mips->size = 0;
+	mips->num_levels = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "textureFile.h"
+
+#define MIP_MAX_LEVELS 32
+
+// Mip chain of a texture. Level 0 is the texture itself
+// and isn't held here. Levels 1 and up are RGB8 with
+// packed rows, like level 0
+typedef struct
+{
+	int num_levels; // Including level 0
+	int width[MIP_MAX_LEVELS];
+	int height[MIP_MAX_LEVELS];
+	const GLubyte *levels[MIP_MAX_LEVELS];
+	void *data;
+	size_t size;
+	GLboolean mapped;
+} mipChain;
+
+int mipLevelDims(int width, int height, int *widths, int *heights);
+void mipBuild(mipChain *mips, const textureFile *tex, int num_threads);
+int mipLoad(mipChain *mips, const char *filename, const char *source);
+int mipSave(const mipChain *mips, const char *filename, const char *source);
+int mipChainFor(mipChain *mips, const textureFile *tex, const char *source);
+void mipFree(mipChain *mips);
+
+#endif
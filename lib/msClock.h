@@ -0,0 +1,21 @@
+#ifndef MS_CLOCK_H
+#define MS_CLOCK_H
+
+#include <time.h>
+
+// Timing on the monotonic clock, shared by the loaders
+// and initShader. Files built with -std=c99 need
+// _DEFAULT_SOURCE defined before their first include
+// for CLOCK_MONOTONIC to be there
+
+/**
+ * Milliseconds since start, on the monotonic clock
+ */
+static inline double msSince(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+#endif
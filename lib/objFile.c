@@ -0,0 +1,367 @@
+// madvise and MADV_SEQUENTIAL are hidden by -std=c99 without this
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "objFile.h"
+
+// Files smaller than this are parsed on one thread,
+// starting threads would cost more than it saves
+#define MIN_THREADED_SIZE (1 << 20)
+#define MAX_THREADS 16
+
+// One slice of the file, starting and ending on line
+// boundaries. The first pass counts what's in it and
+// the second writes it straight into the mesh arrays
+// at the offsets of everything before it
+typedef struct
+{
+	const char *start;
+	const char *end;
+	objMesh *mesh;
+	int num_v, num_vt, num_tris;
+	int first_v, first_vt, first_tri;
+	vec4 min, max;
+} objChunk;
+
+static int isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skipSpace(const char *p, const char *end)
+{
+	while (p < end && isSpace(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+// Start of the line after p
+static const char *nextLine(const char *p, const char *end)
+{
+	const char *nl = (const char *)memchr(p, '\n', end - p);
+	return nl ? nl + 1 : end;
+}
+
+static void badNumber(const char *p, const char *end)
+{
+	const char *e = p;
+	while (e < end && *e != '\n' && e - p < 32)
+	{
+		e++;
+	}
+	printf("Error: expected a number in OBJ file at '%.*s'\n", (int)(e - p), p);
+	exit(1);
+}
+
+// Number parsers that stop with a message on bad input
+static const char *readFloat(const char *p, const char *end, GLfloat *out)
+{
+	const char *next = parseFloat(p, end, out);
+	if (!next)
+		badNumber(p, end);
+	return next;
+}
+
+static const char *readInt(const char *p, const char *end, int *out)
+{
+	const char *next = parseInt(p, end, out);
+	if (!next)
+		badNumber(p, end);
+	return next;
+}
+
+// Type of the line starting at p (after any indent):
+// 'v', 't' for vt, 'f', or 0 for anything else
+static char lineType(const char *p, const char *end)
+{
+	if (end - p < 2)
+		return 0;
+	if (p[0] == 'v' && isSpace(p[1]))
+		return 'v';
+	if (p[0] == 'v' && p[1] == 't' && end - p > 2 && isSpace(p[2]))
+		return 't';
+	if (p[0] == 'f' && isSpace(p[1]))
+		return 'f';
+	return 0;
+}
+
+// First pass: count positions, tex coords and the
+// triangles each face will be split into
+static void *countChunk(void *arg)
+{
+	objChunk *c = (objChunk *)arg;
+	const char *end = c->end;
+	for (const char *p = c->start; p < end; p = nextLine(p, end))
+	{
+		p = skipSpace(p, end);
+		switch (lineType(p, end))
+		{
+		case 'v':
+			c->num_v++;
+			break;
+		case 't':
+			c->num_vt++;
+			break;
+		case 'f':
+		{
+			// Count corners as runs of non-space characters
+			int corners = 0;
+			for (p++; p < end && *p != '\n' && *p != '#'; p++)
+			{
+				if (!isSpace(*p) && isSpace(p[-1]))
+					corners++;
+			}
+			if (corners < 3)
+			{
+				printf("Error: less than 3 indices on face line\n");
+				exit(1);
+			}
+			c->num_tris += corners - 2;
+			break;
+		}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Turn a 1 based or negative (relative to the newest)
+ * OBJ index into a 0 based one, given how many items
+ * came before this line and how many there are in all
+ */
+static int resolveIndex(int i, int before, int total)
+{
+	int r = i > 0 ? i - 1 : before + i;
+	if (i == 0 || r < 0 || r >= total)
+	{
+		printf("Error: OBJ index %d out of range (%d available)\n", i, total);
+		exit(1);
+	}
+	return r;
+}
+
+// Parse one v/vt/vn face corner
+static const char *parseCorner(objChunk *c, const char *p, const char *end,
+							   int seen_v, int seen_vt, objCorner *out)
+{
+	objMesh *mesh = c->mesh;
+	int i;
+	p = readInt(p, end, &i);
+	out->v = resolveIndex(i, seen_v, mesh->num_positions);
+	out->vt = -1;
+	if (p < end && *p == '/')
+	{
+		p++;
+		if (p < end && *p != '/')
+		{
+			p = readInt(p, end, &i);
+			out->vt = resolveIndex(i, seen_vt, mesh->num_tex_coords);
+		}
+		if (p < end && *p == '/')
+		{
+			// Normal index, not used
+			p = readInt(p + 1, end, &i);
+		}
+	}
+	return p;
+}
+
+// Second pass: parse everything into place
+static void *parseChunk(void *arg)
+{
+	objChunk *c = (objChunk *)arg;
+	objMesh *mesh = c->mesh;
+	const char *end = c->end;
+	vec4 *pos = &mesh->positions[c->first_v];
+	vec2 *tex = &mesh->tex_coords[c->first_vt];
+	objCorner *corner = &mesh->corners[3 * c->first_tri];
+	int num_v = 0, num_vt = 0;
+	GLfloat x, y, z;
+
+	for (const char *p = c->start; p < end; p = nextLine(p, end))
+	{
+		p = skipSpace(p, end);
+		switch (lineType(p, end))
+		{
+		case 'v':
+			p = readFloat(skipSpace(p + 1, end), end, &x);
+			p = readFloat(skipSpace(p, end), end, &y);
+			p = readFloat(skipSpace(p, end), end, &z);
+			pos[num_v++] = v4(x, y, z, 1.0);
+
+			c->min.x = x < c->min.x ? x : c->min.x;
+			c->max.x = x > c->max.x ? x : c->max.x;
+			c->min.y = y < c->min.y ? y : c->min.y;
+			c->max.y = y > c->max.y ? y : c->max.y;
+			c->min.z = z < c->min.z ? z : c->min.z;
+			c->max.z = z > c->max.z ? z : c->max.z;
+			break;
+		case 't':
+			// The second coordinate is optional
+			p = readFloat(skipSpace(p + 2, end), end, &x);
+			p = skipSpace(p, end);
+			y = 0;
+			if (p < end && *p != '\n' && *p != '#')
+				p = readFloat(p, end, &y);
+			tex[num_vt++] = v2(x, y);
+			break;
+		case 'f':
+		{
+			// Fan out from the first corner: 1,2,3; 1,3,4; etc.
+			// Only the first and previous corner are needed, so
+			// faces can have any number of corners
+			int seen_v = c->first_v + num_v;
+			int seen_vt = c->first_vt + num_vt;
+			objCorner first, prev, cur;
+			int n = 0;
+			for (p = skipSpace(p + 1, end); p < end && *p != '\n' && *p != '#'; p = skipSpace(p, end))
+			{
+				p = parseCorner(c, p, end, seen_v, seen_vt, &cur);
+				if (n == 0)
+					first = cur;
+				else if (n >= 2)
+				{
+					corner[0] = first;
+					corner[1] = prev;
+					corner[2] = cur;
+					corner += 3;
+				}
+				prev = cur;
+				n++;
+			}
+			break;
+		}
+		}
+	}
+	return NULL;
+}
+
+// Run fn on every chunk, the first on this thread
+static void runChunks(void *(*fn)(void *), objChunk *chunks, int num_chunks)
+{
+	pthread_t threads[MAX_THREADS];
+	for (int i = 1; i < num_chunks; i++)
+	{
+		if (pthread_create(&threads[i], NULL, fn, &chunks[i]))
+		{
+			printf("Error starting OBJ parsing thread\n");
+			exit(1);
+		}
+	}
+	fn(&chunks[0]);
+	for (int i = 1; i < num_chunks; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+}
+
+/**
+ * Load an OBJ file. The file is memory mapped and split
+ * into line aligned chunks that are parsed in parallel,
+ * once to count and once to fill arrays sized from the
+ * counts. num_threads of 0 uses one thread per core.
+ * Exits with a message if the file can't be read
+ */
+void objLoad(objMesh *mesh, const char *filename, int num_threads)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		printf("Error: could not open '%s'\n", filename);
+		exit(1);
+	}
+	size_t size = st.st_size;
+	const char *data = NULL;
+	if (size > 0)
+	{
+		data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			printf("Error: could not map '%s'\n", filename);
+			exit(1);
+		}
+		madvise((void *)data, size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if (num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+	if (num_threads < 1 || size < MIN_THREADED_SIZE)
+		num_threads = 1;
+
+	// Split at the first line break after each even share
+	objChunk chunks[MAX_THREADS];
+	const char *end = data + size;
+	const char *p = data;
+	for (int i = 0; i < num_threads; i++)
+	{
+		const char *split = i == num_threads - 1 ? end : nextLine(data + size * (i + 1) / num_threads, end);
+		chunks[i] = (objChunk){p, split > p ? split : p, mesh};
+		p = chunks[i].end;
+	}
+	runChunks(countChunk, chunks, num_threads);
+
+	// Each chunk's output goes right after the chunk before it
+	int num_v = 0, num_vt = 0, num_tris = 0;
+	for (int i = 0; i < num_threads; i++)
+	{
+		chunks[i].first_v = num_v;
+		chunks[i].first_vt = num_vt;
+		chunks[i].first_tri = num_tris;
+		chunks[i].min = v4(INFINITY, INFINITY, INFINITY, 1);
+		chunks[i].max = v4(-INFINITY, -INFINITY, -INFINITY, 1);
+		num_v += chunks[i].num_v;
+		num_vt += chunks[i].num_vt;
+		num_tris += chunks[i].num_tris;
+	}
+
+	mesh->num_positions = num_v;
+	mesh->num_tex_coords = num_vt;
+	mesh->num_corners = num_tris * 3;
+	mesh->positions = (vec4 *)malloc(sizeof(vec4) * (num_v ? num_v : 1));
+	mesh->tex_coords = (vec2 *)malloc(sizeof(vec2) * (num_vt ? num_vt : 1));
+	mesh->corners = (objCorner *)malloc(sizeof(objCorner) * (num_tris ? num_tris * 3 : 1));
+	if (!mesh->positions || !mesh->tex_coords || !mesh->corners)
+	{
+		printf("Error allocating memory for '%s'\n", filename);
+		exit(1);
+	}
+	runChunks(parseChunk, chunks, num_threads);
+
+	mesh->min = num_v ? chunks[0].min : v4(0, 0, 0, 1);
+	mesh->max = num_v ? chunks[0].max : v4(0, 0, 0, 1);
+	for (int i = 1; i < num_threads; i++)
+	{
+		mesh->min.x = chunks[i].min.x < mesh->min.x ? chunks[i].min.x : mesh->min.x;
+		mesh->min.y = chunks[i].min.y < mesh->min.y ? chunks[i].min.y : mesh->min.y;
+		mesh->min.z = chunks[i].min.z < mesh->min.z ? chunks[i].min.z : mesh->min.z;
+		mesh->max.x = chunks[i].max.x > mesh->max.x ? chunks[i].max.x : mesh->max.x;
+		mesh->max.y = chunks[i].max.y > mesh->max.y ? chunks[i].max.y : mesh->max.y;
+		mesh->max.z = chunks[i].max.z > mesh->max.z ? chunks[i].max.z : mesh->max.z;
+	}
+
+	if (data)
+		munmap((void *)data, size);
+}
+
+void objFree(objMesh *mesh)
+{
+	free(mesh->positions);
+	free(mesh->tex_coords);
+	free(mesh->corners);
+	mesh->positions = NULL;
+	mesh->tex_coords = NULL;
+	mesh->corners = NULL;
+	mesh->num_positions = mesh->num_tex_coords = mesh->num_corners = 0;
+}
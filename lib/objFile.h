@@ -0,0 +1,35 @@
+#ifndef OBJ_FILE_H
+#define OBJ_FILE_H
+
+#include "lib.h"
+
+// One triangle corner as 0 based indices into the
+// position and tex coord arrays. vt is -1 when the
+// face didn't give a tex coord
+typedef struct
+{
+	int v;
+	int vt;
+} objCorner;
+
+// Geometry of a Wavefront OBJ file. Faces of any size
+// are fan triangulated into 3 corners per triangle.
+// Normals are skipped, as are objects, groups and
+// materials, so everything is one mesh
+typedef struct
+{
+	vec4 *positions;
+	vec2 *tex_coords;
+	objCorner *corners;
+	int num_positions;
+	int num_tex_coords;
+	int num_corners;
+	// Bounds of the positions
+	vec4 min;
+	vec4 max;
+} objMesh;
+
+void objLoad(objMesh *mesh, const char *filename, int num_threads);
+void objFree(objMesh *mesh);
+
+#endif
@@ -0,0 +1,611 @@
+// For madvise under -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "plyFile.h"
+
+static const struct
+{
+	const char *name;
+	const char *sized_name;
+	int size;
+} types[] = {
+	[PLY_INT8] = {"char", "int8", 1},
+	[PLY_UINT8] = {"uchar", "uint8", 1},
+	[PLY_INT16] = {"short", "int16", 2},
+	[PLY_UINT16] = {"ushort", "uint16", 2},
+	[PLY_INT32] = {"int", "int32", 4},
+	[PLY_UINT32] = {"uint", "uint32", 4},
+	[PLY_FLOAT32] = {"float", "float32", 4},
+	[PLY_FLOAT64] = {"double", "float64", 8},
+};
+
+static void plyError(const char *message)
+{
+	printf("Error: %s in PLY file\n", message);
+	exit(1);
+}
+
+static plyType parseType(const char *name)
+{
+	for (int t = 0; t < (int)(sizeof(types) / sizeof(types[0])); t++)
+	{
+		if (!strcmp(name, types[t].name) || !strcmp(name, types[t].sized_name))
+			return (plyType)t;
+	}
+	printf("Error: unknown PLY type '%s'\n", name);
+	exit(1);
+}
+
+// VALUES
+// Binary values are loaded through memcpy since records
+// aren't aligned. These are small enough to inline, so
+// with the type fixed for a whole element the compiler
+// hoists the switch out of the loops that call them
+
+static inline GLfloat loadFloat(const char *p, plyType type, GLboolean swap)
+{
+	switch (type)
+	{
+	case PLY_INT8:
+		return *(const signed char *)p;
+	case PLY_UINT8:
+		return *(const unsigned char *)p;
+	case PLY_INT16:
+	case PLY_UINT16:
+	{
+		unsigned short v;
+		memcpy(&v, p, 2);
+		v = swap ? __builtin_bswap16(v) : v;
+		return type == PLY_INT16 ? (GLfloat)(short)v : (GLfloat)v;
+	}
+	case PLY_INT32:
+	case PLY_UINT32:
+	case PLY_FLOAT32:
+	{
+		GLuint v;
+		memcpy(&v, p, 4);
+		v = swap ? __builtin_bswap32(v) : v;
+		if (type == PLY_FLOAT32)
+		{
+			GLfloat f;
+			memcpy(&f, &v, 4);
+			return f;
+		}
+		return type == PLY_INT32 ? (GLfloat)(int)v : (GLfloat)v;
+	}
+	case PLY_FLOAT64:
+	default:
+	{
+		unsigned long long v;
+		double d;
+		memcpy(&v, p, 8);
+		v = swap ? __builtin_bswap64(v) : v;
+		memcpy(&d, &v, 8);
+		return d;
+	}
+	}
+}
+
+// Integer value, for list lengths and indices
+static inline long long loadInt(const char *p, plyType type, GLboolean swap)
+{
+	switch (type)
+	{
+	case PLY_INT8:
+		return *(const signed char *)p;
+	case PLY_UINT8:
+		return *(const unsigned char *)p;
+	case PLY_INT16:
+	case PLY_UINT16:
+	{
+		unsigned short v;
+		memcpy(&v, p, 2);
+		v = swap ? __builtin_bswap16(v) : v;
+		return type == PLY_INT16 ? (long long)(short)v : (long long)v;
+	}
+	case PLY_INT32:
+	case PLY_UINT32:
+	{
+		GLuint v;
+		memcpy(&v, p, 4);
+		v = swap ? __builtin_bswap32(v) : v;
+		return type == PLY_INT32 ? (long long)(int)v : (long long)v;
+	}
+	default:
+		return (long long)loadFloat(p, type, swap);
+	}
+}
+
+// Next value of any type from the body, moving p past it
+static double readValue(plyFile *ply, const char **p, plyType type)
+{
+	if (*p + types[type].size > ply->data + ply->size)
+		plyError("unexpected end of data");
+	double v = type == PLY_FLOAT32 || type == PLY_FLOAT64 ? loadFloat(*p, type, ply->swap)
+														  : loadInt(*p, type, ply->swap);
+	*p += types[type].size;
+	return v;
+}
+
+// Move p past one property of a record
+static void skipProperty(plyFile *ply, const char **p, plyProperty *prop)
+{
+	long long n = 1;
+	if (prop->is_list)
+	{
+		n = (long long)readValue(ply, p, prop->count_type);
+		if (n < 0)
+			plyError("negative list length");
+	}
+	if (n * types[prop->type].size > ply->data + ply->size - *p)
+		plyError("unexpected end of data");
+	*p += n * types[prop->type].size;
+}
+
+// ASCII
+
+// Write v to dst as a value of the given type
+static void storeValue(char *dst, plyType type, double v)
+{
+	switch (type)
+	{
+	case PLY_INT8:
+	case PLY_UINT8:
+		*dst = type == PLY_INT8 ? (signed char)v : (unsigned char)v;
+		break;
+	case PLY_INT16:
+	case PLY_UINT16:
+	{
+		unsigned short x = type == PLY_INT16 ? (unsigned short)(short)v : (unsigned short)v;
+		memcpy(dst, &x, 2);
+		break;
+	}
+	case PLY_INT32:
+	case PLY_UINT32:
+	{
+		GLuint x = type == PLY_INT32 ? (GLuint)(int)v : (GLuint)v;
+		memcpy(dst, &x, 4);
+		break;
+	}
+	case PLY_FLOAT32:
+	{
+		GLfloat x = v;
+		memcpy(dst, &x, 4);
+		break;
+	}
+	case PLY_FLOAT64:
+		memcpy(dst, &v, 8);
+		break;
+	}
+}
+
+// Parse the next ascii value, skipping the whitespace
+// and line breaks before it
+static double parseValue(const char **p, const char *end, plyType type)
+{
+	const char *s = *p;
+	while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n'))
+	{
+		s++;
+	}
+	GLfloat f;
+	int i;
+	const char *next = type == PLY_FLOAT32 || type == PLY_FLOAT64 ? parseFloat(s, end, &f)
+																  : parseInt(s, end, &i);
+	if (!next)
+		plyError("missing or bad value");
+	*p = next;
+	return type == PLY_FLOAT32 || type == PLY_FLOAT64 ? f : i;
+}
+
+/**
+ * Parse an ascii body into the records a binary file in
+ * our own byte order would have, so every value is parsed
+ * exactly once and all reading after this goes through
+ * the binary code
+ */
+static void transcodeAscii(plyFile *ply, const char *p, const char *end)
+{
+	size_t capacity = 1 << 16, length = 0;
+	char *out = (char *)malloc(capacity);
+	if (!out)
+		plyError("out of memory for ascii body");
+
+	for (int i = 0; i < ply->num_elements; i++)
+	{
+		plyElement *e = &ply->elements[i];
+		for (int r = 0; r < e->count; r++)
+		{
+			for (int j = 0; j < e->num_properties; j++)
+			{
+				plyProperty *prop = &e->properties[j];
+				int n = 1;
+				if (prop->is_list)
+				{
+					n = (int)parseValue(&p, end, prop->count_type);
+					if (n < 0)
+						plyError("negative list length");
+				}
+
+				// Room for the length and every item
+				while (length + 8 * ((size_t)n + 1) > capacity)
+				{
+					capacity *= 2;
+					out = (char *)realloc(out, capacity);
+					if (!out)
+						plyError("out of memory for ascii body");
+				}
+				if (prop->is_list)
+				{
+					storeValue(out + length, prop->count_type, n);
+					length += types[prop->count_type].size;
+				}
+				for (int k = 0; k < n; k++)
+				{
+					storeValue(out + length, prop->type, parseValue(&p, end, prop->type));
+					length += types[prop->type].size;
+				}
+			}
+		}
+	}
+
+	ply->data = out;
+	ply->size = length;
+	ply->mapped = GL_FALSE;
+	ply->swap = GL_FALSE;
+}
+
+// HEADER
+
+static void addProperty(plyElement *e, plyProperty *prop)
+{
+	e->properties = (plyProperty *)realloc(e->properties, sizeof(plyProperty) * (e->num_properties + 1));
+	if (!e->properties)
+		plyError("out of memory reading header");
+
+	// Binary records have fixed offsets up to the first list
+	plyProperty *last = e->num_properties ? &e->properties[e->num_properties - 1] : NULL;
+	if (!last)
+		prop->offset = 0;
+	else if (last->is_list || last->offset < 0)
+		prop->offset = -1;
+	else
+		prop->offset = last->offset + types[last->type].size;
+	e->stride = prop->offset >= 0 && !prop->is_list ? prop->offset + types[prop->type].size : 0;
+	e->properties[e->num_properties++] = *prop;
+}
+
+// Parse the header, returning the start of the body
+static const char *parseHeader(plyFile *ply, const char *data, size_t size)
+{
+	const char *end = data + size;
+	if (size < 4 || strncmp(data, "ply", 3) || (data[3] != '\n' && data[3] != '\r'))
+		plyError("missing 'ply' magic");
+
+	GLboolean have_format = GL_FALSE;
+	const char *p = data;
+	for (;;)
+	{
+		const char *nl = (const char *)memchr(p, '\n', end - p);
+		if (!nl)
+			plyError("no end_header");
+		// Header lines are short, copy so they can be scanned
+		char line[256];
+		size_t len = nl - p < (long)sizeof(line) - 1 ? (size_t)(nl - p) : sizeof(line) - 1;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		p = nl + 1;
+
+		char word[PLY_NAME_LEN], a[PLY_NAME_LEN], b[PLY_NAME_LEN], c[PLY_NAME_LEN], d[PLY_NAME_LEN];
+		int count;
+		if (sscanf(line, "%63s", word) != 1 || !strcmp(word, "ply") ||
+			!strcmp(word, "comment") || !strcmp(word, "obj_info"))
+			continue;
+		if (!strcmp(word, "end_header"))
+			break;
+
+		if (!strcmp(word, "format") && sscanf(line, "%*s %63s", a) == 1)
+		{
+			if (!strcmp(a, "ascii"))
+				ply->format = PLY_ASCII;
+			else if (!strcmp(a, "binary_little_endian"))
+				ply->format = PLY_BINARY_LITTLE_ENDIAN;
+			else if (!strcmp(a, "binary_big_endian"))
+				ply->format = PLY_BINARY_BIG_ENDIAN;
+			else
+				plyError("unknown format");
+			have_format = GL_TRUE;
+		}
+		else if (!strcmp(word, "element") && sscanf(line, "%*s %63s %d", a, &count) == 2)
+		{
+			if (count < 0)
+				plyError("negative element count");
+			ply->elements = (plyElement *)realloc(ply->elements, sizeof(plyElement) * (ply->num_elements + 1));
+			if (!ply->elements)
+				plyError("out of memory reading header");
+			plyElement *e = &ply->elements[ply->num_elements++];
+			memset(e, 0, sizeof(*e));
+			strcpy(e->name, a);
+			e->count = count;
+		}
+		else if (!strcmp(word, "property") && ply->num_elements > 0)
+		{
+			plyProperty prop = {{0}};
+			if (sscanf(line, "%*s %63s %63s %63s %63s", a, b, c, d) == 4 && !strcmp(a, "list"))
+			{
+				prop.is_list = GL_TRUE;
+				prop.count_type = parseType(b);
+				prop.type = parseType(c);
+				strcpy(prop.name, d);
+			}
+			else if (sscanf(line, "%*s %63s %63s", a, b) == 2 && strcmp(a, "list"))
+			{
+				prop.type = parseType(a);
+				strcpy(prop.name, b);
+			}
+			else
+				plyError("bad property line");
+			addProperty(&ply->elements[ply->num_elements - 1], &prop);
+		}
+		else
+			plyError("bad header line");
+	}
+	if (!have_format)
+		plyError("no format line");
+	return p;
+}
+
+/**
+ * Open a PLY file and find where each element's records
+ * are. Binary files are memory mapped and read in place,
+ * ascii ones are converted to binary up front. Exits with
+ * a message if the file can't be read
+ */
+void plyOpen(plyFile *ply, const char *filename)
+{
+	memset(ply, 0, sizeof(*ply));
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		printf("Error: could not open '%s'\n", filename);
+		exit(1);
+	}
+	size_t size = st.st_size;
+	char *data = size ? (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		printf("Error: could not map '%s'\n", filename);
+		exit(1);
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	const char *body = parseHeader(ply, data, size);
+	if (ply->format == PLY_ASCII)
+	{
+		transcodeAscii(ply, body, data + size);
+		munmap(data, size);
+		body = ply->data;
+	}
+	else
+	{
+		ply->data = data;
+		ply->size = size;
+		ply->mapped = GL_TRUE;
+		const int one = 1;
+		GLboolean little = *(const char *)&one == 1;
+		ply->swap = little != (ply->format == PLY_BINARY_LITTLE_ENDIAN);
+	}
+
+	// Fixed size records can be stepped over all at once,
+	// the rest have to be walked to find where they end
+	const char *p = body;
+	const char *end = ply->data + ply->size;
+	for (int i = 0; i < ply->num_elements; i++)
+	{
+		plyElement *e = &ply->elements[i];
+		e->data = p;
+		if (e->stride)
+		{
+			if ((size_t)e->count * e->stride > (size_t)(end - p))
+				plyError("unexpected end of data");
+			p += (size_t)e->count * e->stride;
+		}
+		else
+		{
+			for (int r = 0; r < e->count; r++)
+			{
+				for (int j = 0; j < e->num_properties; j++)
+				{
+					skipProperty(ply, &p, &e->properties[j]);
+				}
+			}
+		}
+		e->end = p;
+	}
+}
+
+plyElement *plyFindElement(plyFile *ply, const char *name)
+{
+	for (int i = 0; i < ply->num_elements; i++)
+	{
+		if (!strcmp(ply->elements[i].name, name))
+			return &ply->elements[i];
+	}
+	return NULL;
+}
+
+plyProperty *plyFindProperty(plyElement *e, const char *name)
+{
+	for (int i = 0; e && i < e->num_properties; i++)
+	{
+		if (!strcmp(e->properties[i].name, name))
+			return &e->properties[i];
+	}
+	return NULL;
+}
+
+// READING
+
+/**
+ * Convert one scalar property of every record of e to
+ * GLfloat times scale, writing record i to out[i * out_stride].
+ * With a stride of 4 and out pointing at vec4s' x, y or z
+ * this fills one column of the vectors
+ */
+void plyReadFloats(plyFile *ply, plyElement *e, const char *property, GLfloat scale,
+				   GLfloat *out, int out_stride)
+{
+	plyProperty *prop = plyFindProperty(e, property);
+	if (!prop || prop->is_list)
+	{
+		printf("Error: no scalar property '%s' in PLY element '%s'\n", property, e->name);
+		exit(1);
+	}
+
+	if (e->stride)
+	{
+		// Fixed size records: one tight loop over the column
+		const char *src = e->data + prop->offset;
+		plyType type = prop->type;
+		GLboolean swap = ply->swap;
+		size_t stride = e->stride;
+		for (int i = 0; i < e->count; i++)
+		{
+			out[(size_t)i * out_stride] = loadFloat(src + i * stride, type, swap) * scale;
+		}
+		return;
+	}
+
+	const char *p = e->data;
+	for (int i = 0; i < e->count; i++)
+	{
+		for (int j = 0; j < e->num_properties; j++)
+		{
+			if (&e->properties[j] == prop)
+				out[(size_t)i * out_stride] = readValue(ply, &p, prop->type) * scale;
+			else
+				skipProperty(ply, &p, &e->properties[j]);
+		}
+	}
+}
+
+static void badIndex(long long index, int num_vertices)
+{
+	printf("ERROR: loaded index out of bounds\n");
+	printf("Index: %lld\tnum_vertices: %d\n", index, num_vertices);
+	exit(1);
+}
+
+/**
+ * Append the polygons in a list property of e to out as
+ * triangles, each face split into a fan around its first
+ * corner. property can be NULL to use the first list.
+ * Exits if an index isn't below num_vertices
+ */
+void plyReadFaces(plyFile *ply, plyElement *e, const char *property, int num_vertices, u32List *out)
+{
+	plyProperty *prop = NULL;
+	for (int j = 0; j < e->num_properties && !prop; j++)
+	{
+		plyProperty *pj = &e->properties[j];
+		if (pj->is_list && (!property || !strcmp(pj->name, property)))
+			prop = pj;
+	}
+	if (!prop)
+	{
+		printf("Error: no list property '%s' in PLY element '%s'\n", property ? property : "", e->name);
+		exit(1);
+	}
+
+	// Exact for triangle meshes, bigger faces grow it
+	u32ListReserve(out, out->length + e->count * 3);
+	const char *p = e->data;
+	const char *end = ply->data + ply->size;
+
+	// Faces with nothing but a uchar count and int indices,
+	// by far the most common layout, go straight from the
+	// mapping to the list
+	if (e->num_properties == 1 && prop->count_type == PLY_UINT8 &&
+		(prop->type == PLY_INT32 || prop->type == PLY_UINT32))
+	{
+		GLboolean swap = ply->swap;
+		for (int i = 0; i < e->count; i++)
+		{
+			int n = *(const unsigned char *)p++;
+			if (p + n * 4 > end)
+				plyError("unexpected end of data");
+			if (n >= 3)
+			{
+				GLuint *tri = u32ListExtend(out, (n - 2) * 3);
+				GLuint first = (GLuint)loadInt(p, PLY_UINT32, swap);
+				GLuint prev = (GLuint)loadInt(p + 4, PLY_UINT32, swap);
+				if (first >= (GLuint)num_vertices || prev >= (GLuint)num_vertices)
+					badIndex(first >= (GLuint)num_vertices ? first : prev, num_vertices);
+				for (int k = 2; k < n; k++)
+				{
+					GLuint cur = (GLuint)loadInt(p + 4 * k, PLY_UINT32, swap);
+					if (cur >= (GLuint)num_vertices)
+						badIndex(cur, num_vertices);
+					tri[0] = first;
+					tri[1] = prev;
+					tri[2] = cur;
+					tri += 3;
+					prev = cur;
+				}
+			}
+			p += n * 4;
+		}
+		return;
+	}
+
+	for (int i = 0; i < e->count; i++)
+	{
+		for (int j = 0; j < e->num_properties; j++)
+		{
+			if (&e->properties[j] != prop)
+			{
+				skipProperty(ply, &p, &e->properties[j]);
+				continue;
+			}
+			long long n = (long long)readValue(ply, &p, prop->count_type);
+			long long first = 0, prev = 0;
+			for (long long k = 0; k < n; k++)
+			{
+				long long cur = (long long)readValue(ply, &p, prop->type);
+				if (cur < 0 || cur >= num_vertices)
+					badIndex(cur, num_vertices);
+				if (k == 0)
+					first = cur;
+				else if (k >= 2)
+				{
+					GLuint *tri = u32ListExtend(out, 3);
+					tri[0] = first;
+					tri[1] = prev;
+					tri[2] = cur;
+				}
+				prev = cur;
+			}
+		}
+	}
+}
+
+void plyClose(plyFile *ply)
+{
+	for (int i = 0; i < ply->num_elements; i++)
+	{
+		free(ply->elements[i].properties);
+	}
+	free(ply->elements);
+	if (ply->mapped)
+		munmap(ply->data, ply->size);
+	else
+		free(ply->data);
+	memset(ply, 0, sizeof(*ply));
+}
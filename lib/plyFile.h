@@ -0,0 +1,69 @@
+#ifndef PLY_FILE_H
+#define PLY_FILE_H
+
+#include "lib.h"
+
+#define PLY_NAME_LEN 64
+
+typedef enum
+{
+	PLY_ASCII,
+	PLY_BINARY_LITTLE_ENDIAN,
+	PLY_BINARY_BIG_ENDIAN
+} plyFormat;
+
+// Scalar types, in both their old (char, uchar, ...)
+// and sized (int8, uint8, ...) spellings
+typedef enum
+{
+	PLY_INT8,
+	PLY_UINT8,
+	PLY_INT16,
+	PLY_UINT16,
+	PLY_INT32,
+	PLY_UINT32,
+	PLY_FLOAT32,
+	PLY_FLOAT64
+} plyType;
+
+typedef struct
+{
+	char name[PLY_NAME_LEN];
+	GLboolean is_list;
+	plyType type;		// Type of the value, or of each item of a list
+	plyType count_type; // Type of a list's length
+	int offset;			// Byte offset in a binary record, -1 after a list
+} plyProperty;
+
+// A block of records that all have the same properties
+typedef struct
+{
+	char name[PLY_NAME_LEN];
+	int count;
+	plyProperty *properties;
+	int num_properties;
+	int stride; // Bytes per binary record, 0 if they vary
+	const char *data;
+	const char *end;
+} plyElement;
+
+typedef struct
+{
+	plyFormat format;
+	plyElement *elements;
+	int num_elements;
+	char *data; // Whole file, or binary records parsed from ascii
+	size_t size;
+	GLboolean swap; // Byte order is the opposite of ours
+	GLboolean mapped;
+} plyFile;
+
+void plyOpen(plyFile *ply, const char *filename);
+plyElement *plyFindElement(plyFile *ply, const char *name);
+plyProperty *plyFindProperty(plyElement *e, const char *name);
+void plyReadFloats(plyFile *ply, plyElement *e, const char *property, GLfloat scale,
+				   GLfloat *out, int out_stride);
+void plyReadFaces(plyFile *ply, plyElement *e, const char *property, int num_vertices, u32List *out);
+void plyClose(plyFile *ply);
+
+#endif
@@ -0,0 +1,299 @@
+// For clock_gettime and strdup under -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "texStream.h"
+#include "bcEncode.h"
+#include "textureUpload.h"
+
+// Each slot goes free -> mapped -> filled -> in flight
+// -> free. The loading thread only moves it from mapped
+// to filled, the main thread does the rest
+enum
+{
+	SLOT_FREE,
+	SLOT_MAPPED,
+	SLOT_FILLED,
+	SLOT_IN_FLIGHT
+};
+
+static int slotState(texStream *ts, texStreamSlot *s)
+{
+	pthread_mutex_lock(&ts->lock);
+	int state = s->state;
+	pthread_mutex_unlock(&ts->lock);
+	return state;
+}
+
+static void setSlotState(texStream *ts, texStreamSlot *s, int state)
+{
+	pthread_mutex_lock(&ts->lock);
+	s->state = state;
+	pthread_cond_broadcast(&ts->cond);
+	pthread_mutex_unlock(&ts->lock);
+}
+
+// Loading thread: make the levels, from the caches when
+// they're up to date, then copy them a band at a time
+// into whichever buffer of the ring comes next
+static void *runStream(void *arg)
+{
+	texStream *ts = (texStream *)arg;
+	textureFile tex = ts->tex;
+	bcTexture bc;
+	mipChain mips;
+	const GLubyte *levels[MIP_MAX_LEVELS];
+	int num_levels;
+	if (ts->compressed)
+	{
+		bcTextureFor(&bc, &tex, ts->source, BC1);
+		num_levels = bc.num_levels;
+		for (int i = 0; i < num_levels; i++)
+		{
+			levels[i] = bc.levels[i];
+		}
+	}
+	else
+	{
+		mipChainFor(&mips, &tex, ts->source);
+		num_levels = mips.num_levels;
+		levels[0] = tex.texels;
+		for (int i = 1; i < num_levels; i++)
+		{
+			levels[i] = mips.levels[i];
+		}
+	}
+
+	pthread_mutex_lock(&ts->lock);
+	ts->num_levels = num_levels;
+	for (int i = 0, w = tex.width, h = tex.height; i < num_levels; i++)
+	{
+		ts->width[i] = w;
+		ts->height[i] = h;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	ts->prepared = GL_TRUE;
+	pthread_mutex_unlock(&ts->lock);
+
+	int chunk = 0;
+	for (int i = 0; i < num_levels; i++)
+	{
+		// Compressed bands are whole rows of 4x4 blocks,
+		// the rest single RGB rows
+		int w = ts->width[i], h = ts->height[i];
+		int unit_rows = ts->compressed ? 4 : 1;
+		size_t unit_size = ts->compressed ? bcLevelSize(BC1, w, 4) : 3 * (size_t)w;
+		int units = (h + unit_rows - 1) / unit_rows;
+		int units_per_chunk = TEX_STREAM_SLOT_SIZE / unit_size;
+		if (units_per_chunk < 1)
+		{
+			printf("Error: '%s' is too wide to stream\n", ts->source);
+			exit(1);
+		}
+		for (int u = 0; u < units; u += units_per_chunk)
+		{
+			int n = units - u < units_per_chunk ? units - u : units_per_chunk;
+			texStreamSlot *s = &ts->slots[chunk % TEX_STREAM_SLOTS];
+			pthread_mutex_lock(&ts->lock);
+			while (s->state != SLOT_MAPPED)
+				pthread_cond_wait(&ts->cond, &ts->lock);
+			pthread_mutex_unlock(&ts->lock);
+
+			memcpy(s->ptr, levels[i] + u * unit_size, n * unit_size);
+			s->level = i;
+			s->y = u * unit_rows;
+			s->rows = n * unit_rows < h - s->y ? n * unit_rows : h - s->y;
+			s->size = n * unit_size;
+			setSlotState(ts, s, SLOT_FILLED);
+			chunk++;
+		}
+	}
+
+	if (ts->compressed)
+		bcFree(&bc);
+	else
+		mipFree(&mips);
+	textureClose(&tex);
+	pthread_mutex_lock(&ts->lock);
+	ts->num_chunks = chunk;
+	pthread_mutex_unlock(&ts->lock);
+	return NULL;
+}
+
+/**
+ * Make the ring of pixel buffers. Needs a GL context
+ */
+void texStreamNew(texStream *ts)
+{
+	memset(ts, 0, sizeof(*ts));
+	pthread_mutex_init(&ts->lock, NULL);
+	pthread_cond_init(&ts->cond, NULL);
+	for (int i = 0; i < TEX_STREAM_SLOTS; i++)
+	{
+		glGenBuffers(1, &ts->slots[i].pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ts->slots[i].pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, TEX_STREAM_SLOT_SIZE, NULL, GL_STREAM_DRAW);
+		ts->slots[i].state = SLOT_FREE;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/**
+ * Start loading the texture file source into a new GL
+ * texture in the background. width and height are passed
+ * on to textureTryOpen. The file is opened here, so a
+ * missing or unreadable one is caught before anything
+ * starts: it prints a message and returns 0, and the
+ * caller keeps the texture it has. Only one texture
+ * streams at a time, check texStreamBusy first. Exits
+ * with a message if the thread can't be started
+ */
+int texStreamStart(texStream *ts, const char *source, int width, int height)
+{
+	if (!textureTryOpen(&ts->tex, source, width, height))
+	{
+		printf("Keeping the current texture instead of '%s'\n", source);
+		return 0;
+	}
+	free(ts->source);
+	ts->source = strdup(source);
+	ts->compressed = haveS3tc();
+	ts->active = GL_TRUE;
+	ts->allocated = GL_FALSE;
+	ts->texture = 0;
+	ts->prepared = GL_FALSE;
+	ts->num_chunks = -1;
+	ts->next_upload = 0;
+	ts->frames = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts->start);
+	if (!ts->source || pthread_create(&ts->thread, NULL, runStream, ts))
+	{
+		printf("Error starting texture loading thread\n");
+		exit(1);
+	}
+	return 1;
+}
+
+// Storage for every level, filled in by the transfers
+static void allocateLevels(texStream *ts)
+{
+	glGenTextures(1, &ts->texture);
+	glBindTexture(GL_TEXTURE_2D, ts->texture);
+	GLenum internal = ts->compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB;
+	for (int i = 0; i < ts->num_levels; i++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, i, internal, ts->width[i], ts->height[i], 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ts->num_levels - 1);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	ts->allocated = GL_TRUE;
+}
+
+/**
+ * Move the stream along: start transfers of the bands
+ * the loading thread has written, and map buffers whose
+ * transfers have finished for it to write more. Never
+ * waits on the thread or the GPU, so call it once a frame.
+ * Returns the finished texture once every band has been
+ * sent, 0 until then. The caller owns the texture, and
+ * it's left bound to GL_TEXTURE_2D
+ */
+GLuint texStreamStep(texStream *ts)
+{
+	if (!ts->active)
+		return 0;
+	ts->frames++;
+	pthread_mutex_lock(&ts->lock);
+	GLboolean prepared = ts->prepared;
+	int num_chunks = ts->num_chunks;
+	pthread_mutex_unlock(&ts->lock);
+	if (!prepared)
+		return 0;
+	if (!ts->allocated)
+		allocateLevels(ts);
+
+	glBindTexture(GL_TEXTURE_2D, ts->texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	// Bands go up in the order they were written
+	for (;;)
+	{
+		texStreamSlot *s = &ts->slots[ts->next_upload % TEX_STREAM_SLOTS];
+		if (slotState(ts, s) != SLOT_FILLED)
+			break;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		s->ptr = NULL;
+		int w = ts->width[s->level];
+		if (ts->compressed)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, s->level, 0, s->y, w, s->rows,
+									  GL_COMPRESSED_RGB_S3TC_DXT1_EXT, s->size, (GLvoid *)0);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, s->level, 0, s->y, w, s->rows,
+							GL_RGB, GL_UNSIGNED_BYTE, (GLvoid *)0);
+		s->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		setSlotState(ts, s, SLOT_IN_FLIGHT);
+		ts->next_upload++;
+	}
+
+	GLboolean done = num_chunks >= 0 && ts->next_upload == num_chunks;
+	for (int i = 0; i < TEX_STREAM_SLOTS; i++)
+	{
+		texStreamSlot *s = &ts->slots[i];
+		int state = slotState(ts, s);
+		if (state == SLOT_IN_FLIGHT)
+		{
+			GLenum r = glClientWaitSync(s->fence, 0, 0);
+			if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+				continue;
+			glDeleteSync(s->fence);
+			s->fence = NULL;
+			state = SLOT_FREE;
+			setSlotState(ts, s, state);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+		if (state == SLOT_FREE && !done)
+		{
+			// The transfer out of it is finished, so it can
+			// be written without waiting
+			s->ptr = (GLubyte *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, TEX_STREAM_SLOT_SIZE,
+												 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (!s->ptr)
+			{
+				printf("Error mapping a texture upload buffer\n");
+				exit(1);
+			}
+			setSlotState(ts, s, SLOT_MAPPED);
+		}
+		else if (state == SLOT_MAPPED && done)
+		{
+			// Mapped for a band that never came
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			s->ptr = NULL;
+			setSlotState(ts, s, SLOT_FREE);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (!done)
+		return 0;
+	pthread_join(ts->thread, NULL);
+	ts->active = GL_FALSE;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts->elapsed = (now.tv_sec - ts->start.tv_sec) * 1e3 + (now.tv_nsec - ts->start.tv_nsec) * 1e-6;
+	return ts->texture;
+}
+
+/**
+ * Whether a texture is still streaming
+ */
+int texStreamBusy(const texStream *ts)
+{
+	return ts->active;
+}
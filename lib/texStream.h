@@ -0,0 +1,60 @@
+#ifndef TEX_STREAM_H
+#define TEX_STREAM_H
+
+#include <pthread.h>
+#include <time.h>
+#include "mipmap.h"
+
+// Pixel buffers texels pass through on their way to the
+// GPU, and the size of each. A level bigger than one
+// buffer goes up as bands of rows
+#define TEX_STREAM_SLOTS 3
+#define TEX_STREAM_SLOT_SIZE (1 << 20)
+
+// One pixel buffer of the ring
+typedef struct
+{
+	GLuint pbo;
+	GLsync fence; // Set while its transfer is in flight
+	GLubyte *ptr; // Set while it's mapped
+	int state;
+	// The band the loading thread put in it
+	int level, y, rows;
+	GLsizei size;
+} texStreamSlot;
+
+// A texture read, mip mapped and compressed on its own
+// thread, which writes it straight into mapped pixel
+// buffers. The main thread only unmaps them and starts
+// the transfers, so swapping textures doesn't stall a
+// frame. The texture isn't used until it's complete
+typedef struct
+{
+	texStreamSlot slots[TEX_STREAM_SLOTS];
+	char *source;
+	textureFile tex; // Open from texStreamStart until the thread is done
+	GLboolean compressed;
+	GLboolean active;
+	GLboolean allocated;
+	GLuint texture;
+	// Set by the loading thread once it knows them
+	GLboolean prepared;
+	int num_levels;
+	int width[MIP_MAX_LEVELS];
+	int height[MIP_MAX_LEVELS];
+	int num_chunks; // -1 until every band is written
+	int next_upload;
+	int frames;
+	struct timespec start;
+	double elapsed; // ms the last texture took, set when done
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} texStream;
+
+void texStreamNew(texStream *ts);
+int texStreamStart(texStream *ts, const char *source, int width, int height);
+GLuint texStreamStep(texStream *ts);
+int texStreamBusy(const texStream *ts);
+
+#endif
@@ -0,0 +1,164 @@
+// MADV_WILLNEED needs this under -std=c99
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "textureFile.h"
+
+static int isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Next number in a PPM header, skipping whitespace and
+// comments. Returns -1 if there isn't one
+static long ppmNumber(const char **p, const char *end)
+{
+	const char *s = *p;
+	while (s < end && (isSpace(*s) || *s == '#'))
+	{
+		if (*s == '#')
+		{
+			while (s < end && *s != '\n')
+				s++;
+		}
+		else
+			s++;
+	}
+	long n = -1;
+	for (; s < end && *s >= '0' && *s <= '9' && n < 1 << 24; s++)
+	{
+		n = (n < 0 ? 0 : n * 10) + (*s - '0');
+	}
+	*p = s;
+	return n;
+}
+
+// Read "width height" from filename.dim, if there is one
+static int readSidecar(const char *filename, int *width, int *height)
+{
+	size_t name_len = strlen(filename) + 5;
+	char *dim_name = (char *)malloc(name_len);
+	if (!dim_name)
+		return 0;
+	snprintf(dim_name, name_len, "%s.dim", filename);
+	FILE *f = fopen(dim_name, "r");
+	free(dim_name);
+	if (!f)
+		return 0;
+	int w, h;
+	int ok = fscanf(f, "%d %d", &w, &h) == 2 && w > 0 && h > 0;
+	fclose(f);
+	if (ok)
+	{
+		*width = w;
+		*height = h;
+	}
+	return ok;
+}
+
+/**
+ * Map an RGB8 texture file. The size comes from, in order:
+ * a binary PPM (P6) header, a filename.dim file holding
+ * "width height", the width and height given, or for a
+ * headerless file with width or height 0, the square
+ * that fills it. Nothing is copied, the texels are read
+ * from the page cache as they're uploaded. Prints why and
+ * returns 0, leaving tex alone, if the file can't be read
+ * or is too small
+ */
+int textureTryOpen(textureFile *tex, const char *filename, int width, int height)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+	{
+		printf("Error: could not open '%s'\n", filename);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	size_t size = st.st_size;
+	char *data = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		printf("Error: could not map '%s'\n", filename);
+		return 0;
+	}
+	// It's about to be read front to back
+	madvise(data, size, MADV_WILLNEED);
+
+	size_t offset = 0;
+	if (size >= 2 && data[0] == 'P' && data[1] == '6')
+	{
+		const char *p = data + 2;
+		long w = ppmNumber(&p, data + size);
+		long h = ppmNumber(&p, data + size);
+		long max = ppmNumber(&p, data + size);
+		if (w <= 0 || h <= 0 || max != 255 || p >= data + size || !isSpace(*p))
+		{
+			printf("Error: '%s' isn't an 8 bit binary PPM\n", filename);
+			munmap(data, size);
+			return 0;
+		}
+		width = w;
+		height = h;
+		// One whitespace character ends the header
+		offset = p + 1 - data;
+	}
+	else if (!readSidecar(filename, &width, &height) && (width <= 0 || height <= 0))
+	{
+		size_t side = 0;
+		while ((side + 1) * (side + 1) * 3 <= size)
+			side++;
+		if (side * side * 3 != size)
+		{
+			printf("Error: can't tell the size of '%s', add a %s.dim with its width and height\n",
+				   filename, filename);
+			munmap(data, size);
+			return 0;
+		}
+		width = height = side;
+	}
+
+	if ((size - offset) / 3 / width < (size_t)height)
+	{
+		printf("Error: '%s' is too small for a %dx%d texture\n", filename, width, height);
+		munmap(data, size);
+		return 0;
+	}
+	tex->texels = (const GLubyte *)data + offset;
+	tex->width = width;
+	tex->height = height;
+	tex->map = data;
+	tex->map_size = size;
+	return 1;
+}
+
+/**
+ * textureTryOpen for files the program can't go on
+ * without. Exits if the file can't be used
+ */
+void textureOpen(textureFile *tex, const char *filename, int width, int height)
+{
+	if (!textureTryOpen(tex, filename, width, height))
+		exit(1);
+}
+
+/**
+ * Unmap a texture opened by textureOpen
+ */
+void textureClose(textureFile *tex)
+{
+	if (tex->map)
+		munmap(tex->map, tex->map_size);
+	tex->texels = NULL;
+	tex->map = NULL;
+	tex->map_size = 0;
+}
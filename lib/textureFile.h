@@ -0,0 +1,31 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__ // include Mac OS X verions of headers
+#include <OpenGL/OpenGL.h>
+#else // non-Mac OS X operating systems
+#include <GL/glew.h>
+#endif // __APPLE__
+
+// Doesn't use lib.h, so programs with their own vector
+// types can use it too
+
+// An RGB8 texture mapped straight from its file. texels
+// points into the mapping, so it's read only and only
+// valid until textureClose
+typedef struct
+{
+	const GLubyte *texels;
+	int width;
+	int height;
+	void *map;
+	size_t map_size;
+} textureFile;
+
+int textureTryOpen(textureFile *tex, const char *filename, int width, int height);
+void textureOpen(textureFile *tex, const char *filename, int width, int height);
+void textureClose(textureFile *tex);
+
+#endif
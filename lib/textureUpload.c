@@ -0,0 +1,52 @@
+#include "textureUpload.h"
+#include "bcEncode.h"
+
+/**
+ * Whether the GL takes S3TC (BC1 to BC3) textures. Every
+ * Mac GPU does, elsewhere GLEW is asked
+ */
+int haveS3tc(void)
+{
+#ifdef __APPLE__
+	return 1;
+#else
+	return GLEW_EXT_texture_compression_s3tc;
+#endif
+}
+
+/**
+ * Upload a texture opened from the file source and all of
+ * its mip levels to the bound GL_TEXTURE_2D. Where the GL
+ * takes S3TC the levels go up BC1 compressed, 1/6 the
+ * size of RGB8, otherwise uncompressed. Either way they
+ * come from a cache next to source when it's up to date
+ * and are made and cached otherwise. Returns 1 if they
+ * came from the cache
+ */
+int textureUpload(const textureFile *tex, const char *source)
+{
+	if (haveS3tc())
+	{
+		bcTexture bc;
+		int cached = bcTextureFor(&bc, tex, source, BC1);
+		for (int i = 0; i < bc.num_levels; i++)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, bc.width[i], bc.height[i], 0,
+								   bc.level_size[i], bc.levels[i]);
+		}
+		bcFree(&bc);
+		return cached;
+	}
+
+	mipChain mips;
+	int cached = mipChainFor(&mips, tex, source);
+	// Every level's rows are packed, whatever the width
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tex->width, tex->height, 0, GL_RGB, GL_UNSIGNED_BYTE, tex->texels);
+	for (int i = 1; i < mips.num_levels; i++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, mips.width[i], mips.height[i], 0, GL_RGB, GL_UNSIGNED_BYTE, mips.levels[i]);
+	}
+	mipFree(&mips);
+	return cached;
+}
@@ -0,0 +1,13 @@
+#ifndef TEXTURE_UPLOAD_H
+#define TEXTURE_UPLOAD_H
+
+#include "textureFile.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+int haveS3tc(void);
+int textureUpload(const textureFile *tex, const char *source);
+
+#endif
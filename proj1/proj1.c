@@ -20,6 +20,7 @@
 
 #define BUFFER_OFFSET(offset) ((GLvoid *)(offset))
 #define WSIZE 1024
+#define SCRATCH_SIZE (1 << 20)
 
 GLuint ctm_location;
 
@@ -27,6 +28,10 @@ vec4 *vertices;
 vec4 *colors;
 vec4 *normals;
 
+// Everything built on the CPU side lives here until
+// it's been uploaded, then it's all cleared at once
+arena scratch;
+
 int num_vertices = 0;
 int num_colors = 0;
 int num_normals = 0;
@@ -92,11 +97,12 @@ void unitSphere(void)
 
     // Allocate space for vertices
     int numVerts = ((numRings)*6) * numSegments;
-    vertices = (vec4 *)malloc(sizeof(vec4) * numVerts);
+    vertices = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numVerts);
 
     // Form reference edges of segment
-    vec4 *ref1 = (vec4 *)malloc(sizeof(vec4) * (numRings + 1));
-    vec4 *ref2 = (vec4 *)malloc(sizeof(vec4) * (numRings + 1));
+    arenaPos temp_mark = arenaMark(&scratch);
+    vec4 *ref1 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (numRings + 1));
+    vec4 *ref2 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (numRings + 1));
     theta = M_PI / numRings;
     r = z_rotate(-theta);
     ref1[0] = v4(0, 1, 0, 1);
@@ -151,6 +157,9 @@ void unitSphere(void)
             ref2[j] = multMatVec(&r, &ref1[j]);
         }
     }
+
+    // Done with ref1 and ref2
+    arenaReset(&scratch, temp_mark);
 }
 
 /**
@@ -173,13 +182,14 @@ void spring(void)
     // Allocate space for vertices
     // Vertices in "shaft" + vertices in end caps
     int numVerts = numSegments * numCircPoints * numCoils * 6 + 2 * 3 * numCircPoints;
-    vertices = (vec4 *)malloc(sizeof(vec4) * numVerts);
+    vertices = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numVerts);
+    arenaPos temp_mark = arenaMark(&scratch);
 
     // Make circle cross section for reference
     // Use unit circle for ease of coding, scale later
     // Translate all points + 2 on x axis so circle can
     // easily be rotated around y axis to make torus
-    vec4 *refCirc1 = (vec4 *)malloc(sizeof(vec4) * numCircPoints);
+    vec4 *refCirc1 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numCircPoints);
     theta = 2 * M_PI / numCircPoints;
     for (int i = 0; i < numCircPoints; i++)
     {
@@ -191,7 +201,7 @@ void spring(void)
 
     // Copy refCirc1 to give reference for other
     // edge of each segment
-    vec4 *refCirc2 = (vec4 *)malloc(sizeof(vec4) * numCircPoints);
+    vec4 *refCirc2 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numCircPoints);
     memcpy(refCirc2, refCirc1, sizeof(vec4) * numCircPoints);
 
     // Rotate refCirc1 around y axis by 2 * PI / numSegments
@@ -247,6 +257,9 @@ void spring(void)
         vertices[num_vertices++] = refCirc2[i];
     }
 
+    // Done with the reference circles
+    arenaReset(&scratch, temp_mark);
+
     // Translate -0.25 on y
     t = translate(0, -0.5, 0);
     // Scale everything back down
@@ -275,7 +288,7 @@ void fromFile(char *filename)
     printf("%d\n", num);
 
     // Allocate memory for vertices
-    vertices = (vec4 *)malloc(sizeof(vec4) * num);
+    vertices = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * num);
 
     GLfloat x, y, z, w;
     vec4 v;
@@ -288,6 +301,7 @@ void fromFile(char *filename)
         // Add vertice
         vertices[num_vertices++] = v;
     }
+    fclose(f);
 
     // Find bounds of points
     GLfloat minx = 0, maxx = 0, miny = 0, maxy = 0, minz = 0, maxz = 0;
@@ -344,7 +358,7 @@ void randColors(void)
     GLfloat r, g, b;
 
     // Allocate memory for color vectors
-    colors = (vec4 *)malloc(sizeof(vec4) * num_vertices);
+    colors = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * num_vertices);
 
     // Seed random number generator
     srand((unsigned)time(NULL));
@@ -566,7 +580,8 @@ void getNormals()
 {
     // Array list to add normals to
     v4List norm_list;
-    v4ListNew(&norm_list);
+    v4ListNewArena(&norm_list, &scratch);
+    v4ListReserve(&norm_list, num_vertices);
 
     vec4 p1, p2, p3, v1, v2, n;
 #if SMOOTH
@@ -606,8 +621,7 @@ void getNormals()
 #endif
 
     // Transfer array list to normals
-    normals = norm_list.items;
-    num_normals = norm_list.length;
+    normals = v4ListRelease(&norm_list, &num_normals);
 }
 
 int main(int argc, char **argv)
@@ -619,6 +633,7 @@ int main(int argc, char **argv)
     glutCreateWindow("Template");
     glewInit();
 
+    arenaNew(&scratch, SCRATCH_SIZE);
     if (argc >= 2)
     {
         if (!strcmp(argv[1], "spring"))
@@ -656,6 +671,11 @@ int main(int argc, char **argv)
     randColors();
 
     init();
+
+    // Geometry is on the GPU now, so release the CPU copy
+    printArena(&scratch, "Geometry");
+    arenaClear(&scratch);
+    vertices = colors = normals = NULL;
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutMouseFunc(mouse);
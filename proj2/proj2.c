@@ -14,27 +14,75 @@
 
 #include "../lib/initShader.h"
 #include "../lib/lib.h"
+#include "../lib/plyFile.h"
+#include "../lib/asyncLoad.h"
+#include "../lib/meshUpload.h"
+#include "../lib/texStream.h"
 #include "proj2.h"
 
 #define BUFFER_OFFSET(offset) ((GLvoid *)(offset))
 #define DEBUG 0
-
+#define SCRATCH_SIZE (4 << 20)
+// Longest file name that can be typed in
+#define NAME_LEN 4096
+#define NAME_FORMAT "%4095s"
+// How often to check whether the model has finished loading
+#define LOAD_POLL_MS 10
+// The model goes to the GPU a chunk at a time, as many
+// as fit in the budget each frame
+#define UPLOAD_CHUNK_SIZE (1 << 20)
+#define UPLOAD_BUDGET_MS 4.0
+
+GLuint program;
 GLuint ctm_location;
 
 vec4 *vertices;
 vec4 *colors;
 vec2 *tex_coords;
+GLuint *indices;
+GLenum index_type = GL_UNSIGNED_INT;
 
 int num_vertices = 0;
 int num_colors = 0;
 int num_tex_coords = 0;
+int num_indices = 0;
 GLboolean idle_spin = GL_FALSE;
 GLboolean usefile = GL_FALSE;
 GLboolean hasColors = GL_FALSE;
 int texw, texh;
 
+// Temporary memory for loading and building, cleared
+// once everything has been uploaded
+arena scratch;
+
 mat4 ctm;
 
+// The model loads on its own thread while the box it
+// will be scaled to fit is drawn. Once loaded it's
+// drawn as far as it has been uploaded
+asyncLoad model_load;
+GLboolean model_ready = GL_FALSE;
+GLuint model_vao;
+meshUpload model_upload;
+int num_drawn = 0;
+int upload_frames = 0;
+GLuint placeholder_vao;
+
+// The model's texture streams in through a ring of pixel
+// buffers, and it's drawn plain gray until it's there.
+// 't' swaps in the next texture named on the command
+// line the same way, the model's own being the first
+texStream tex_stream;
+GLuint model_texture;
+const char **texture_names;
+int num_texture_names;
+int texture_index = 0;
+
+// For time to first frame and to the whole model
+struct timespec program_start;
+GLboolean shown_first_frame = GL_FALSE;
+GLboolean shown_model = GL_FALSE;
+
 // Variables for mouse movements/dragging
 vec4 curPoint = (vec4){0, 0, 0, 1};
 vec4 prevPoint = (vec4){0, 0, 0, 1};
@@ -65,6 +113,7 @@ mat4 rotate_mat = {
 };
 
 char *filenameInput;
+char *filename;
 
 /**
  * Idle animation
@@ -79,239 +128,172 @@ void idle(void)
 }
 
 /**
- * Read ply file
+ * Take the welded vertices and indices from w
+ * as the geometry to draw
  */
-void readFile()
+void takeMesh(welder *w)
 {
-    // Prompt for ply filename
-    filenameInput = (char *)malloc(sizeof(char) * 25);
-    if (filenameInput == NULL)
+    int corners = w->indices.length;
+    vertices = v4ListRelease(&w->positions, &num_vertices);
+    tex_coords = v2ListRelease(&w->tex_coords, &num_tex_coords);
+    colors = v4ListRelease(&w->colors, &num_colors);
+    indices = u32ListRelease(&w->indices, &num_indices);
+    welderFree(w);
+    printf("Welded %d corners into %d vertices\n", corners, num_vertices);
+
+    // Reorder for the post-transform cache, then lay the
+    // vertices out in the order they get fetched
+    printCacheStats("Before optimizing", indices, num_indices, num_vertices);
+    optimizeVertexCache(indices, num_indices, num_vertices);
+    num_vertices = optimizeVertexFetch(indices, num_indices, vertices,
+                                       num_tex_coords ? tex_coords : NULL,
+                                       num_colors ? colors : NULL, num_vertices);
+    if (num_tex_coords)
+        num_tex_coords = num_vertices;
+    if (num_colors)
+        num_colors = num_vertices;
+    printCacheStats("After optimizing", indices, num_indices, num_vertices);
+
+    index_type = packIndices(indices, num_indices, num_vertices);
+    printf("Using %d bit indices\n", index_type == GL_UNSIGNED_SHORT ? 16 : 32);
+}
+
+/**
+ * Prompt for a ply file name until one that can
+ * be opened is given
+ */
+void promptFile()
+{
+    // Room is left to add the .ply or .data extension
+    filenameInput = (char *)malloc(sizeof(char) * (NAME_LEN + 6));
+    filename = (char *)malloc(sizeof(char) * (NAME_LEN + 6));
+    if (filenameInput == NULL || filename == NULL)
     {
         printf("ERROR ALLOCATING MEMORY\n");
         exit(0);
     }
     printf("\nEnter .ply file name (no file extension): ");
-    scanf("%s", filenameInput);
-
-    char *filename = (char *)malloc(sizeof(char) * 25);
+    scanf(NAME_FORMAT, filenameInput);
     strcpy(filename, filenameInput);
     strcat(filename, ".ply");
 
-    // Attempt to open file for reading
+    // Make sure it can be opened before handing it over
     FILE *f;
     f = fopen(filename, "r");
     while (f == NULL)
     {
         printf("ERROR: File '%s' could not be opened\n", filename);
         printf("Enter .ply file name (no file extension): ");
-        scanf("%s", filenameInput);
+        scanf(NAME_FORMAT, filenameInput);
         strcpy(filename, filenameInput);
         strcat(filename, ".ply");
         f = fopen(filename, "r");
     }
+    fclose(f);
+}
 
-    // Read line by line until 'end_header\n' found
-    char *buff;
-    size_t buffSize = 50;
-    buff = (char *)malloc(sizeof(char) * buffSize);
-    if (buff == NULL)
-    {
-        printf("Error allocating memory for buffer\n");
+/**
+ * Read the ply file chosen by promptFile
+ */
+void readFile()
+{
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The header says what's in the file and how it's
+    // laid out, ascii or binary of either byte order
+    plyFile ply;
+    plyOpen(&ply, filename);
+    plyElement *vert_elem = plyFindElement(&ply, "vertex");
+    plyElement *face_elem = plyFindElement(&ply, "face");
+    if (!vert_elem || !face_elem)
+    {
+        printf("ERROR: %s has no vertex or face element\n", filename);
         exit(0);
     }
-
-    int numFileVerts = 0;
-    int faces = 0;
-    int numFileTexVerts = 0;
-
-    while (!strstr(buff, "end_header\n"))
+    int numFileVerts = vert_elem->count;
+    hasColors = plyFindProperty(vert_elem, "red") != NULL;
+    plyElement *tex_elem = plyFindElement(&ply, "multi_texture_vertex");
+    plyElement *tex_face_elem = plyFindElement(&ply, "multi_texture_face");
+    if (!hasColors && (!tex_elem || !tex_face_elem))
     {
-        getline(&buff, &buffSize, f);
-#if DEBUG
-        printf("READ LINE: %s", buff);
-#endif
-
-        // Find and extract num vertices in file
-        if (strstr(buff, " vertex "))
-        {
-            sscanf(buff, "%*s %*s %d", &numFileVerts);
-#if DEBUG
-            printf("FOUND VERTEX: ");
-            printf("%d\n", numFileVerts);
-#endif
-        }
-
-        // Find and extract num faces in object
-        if (strstr(buff, " face "))
-        {
-            sscanf(buff, "%*s %*s %d", &faces);
-#if DEBUG
-            printf("FOUND FACE: ");
-            printf("%d\n", faces);
-#endif
-        }
-
-        // Find and extract num texture vertices
-        if (strstr(buff, " multi_texture_vertex "))
-        {
-            sscanf(buff, "%*s %*s %d", &numFileTexVerts);
-#if DEBUG
-            printf("FOUND TEX VERTEX: ");
-            printf("%d\n", numFileTexVerts);
-#endif
-        }
-
-        // If string "red" is found, the file
-        // contains color values
-        if (strstr(buff, " red"))
-        {
-            hasColors = GL_TRUE;
-        }
-    }
-
-    // Allocate space for vertices
-    // Each face has 3 vertices
-    vertices = (vec4 *)malloc(sizeof(vec4) * faces * 3);
-    // If has colors, allocate space. Else allocate
-    // for tex vertices
-    if (hasColors)
-    {
-        colors = (vec4 *)malloc(sizeof(vec4) * faces * 3);
-    }
-    else
-    {
-        tex_coords = (vec2 *)malloc(sizeof(vec2) * faces * 3);
-    }
-
-    // Allocate space to load vertex coordinates
-    // from file
-    vec4 *fileVerts = (vec4 *)malloc(sizeof(vec4) * numFileVerts);
-    // If has color, allocate space to load color values
-    // from file
-    vec4 *fileColors;
-    if (hasColors)
-    {
-        fileColors = (vec4 *)malloc(sizeof(vec4) * numFileVerts);
-        if (fileColors == NULL)
-        {
-            printf("Error allocating memory for file color list\n");
-            exit(0);
-        }
-    }
-
-    if (fileVerts == NULL)
-    {
-        printf("Error allocating memory for file vertex list\n");
+        printf("ERROR: %s has neither colors nor texture coordinates\n", filename);
         exit(0);
     }
-    // Load floats x, y, and z numFileVerts times
-    GLfloat x, y, z;
-    unsigned char r, g, b;
+
+    // Positions, and colors scaled from [0, 255] to [0.0, 1.0],
+    // are converted a column at a time straight from the file
+    arenaPos temp_mark = arenaMark(&scratch);
+    vec4 *fileVerts = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numFileVerts);
     for (int i = 0; i < numFileVerts; i++)
     {
-        fread(&x, sizeof(x), 1, f);
-        fread(&y, sizeof(y), 1, f);
-        fread(&z, sizeof(z), 1, f);
-        fileVerts[i] = v4(x, y, z, 1.0);
-
-        // If has colors, load them
-        if (hasColors)
-        {
-            fread(&r, sizeof(char), 1, f);
-            fread(&g, sizeof(char), 1, f);
-            fread(&b, sizeof(char), 1, f);
-
-            float flr, flg, flb;
-            flr = (GLfloat)r;
-            flg = (GLfloat)g;
-            flb = (GLfloat)b;
-            // Scale from [0, 255] to [0.0, 1.0]
-            fileColors[i] = v4(flr / 255.0, flg / 255.0, flb / 255.0, 1.0);
-        }
+        fileVerts[i].w = 1.0;
     }
-
-    // Read vertex indices and copy corresponding
-    // vec4 from fileVerts to vertices
-    unsigned char num;
-    int index;
-    for (int i = 0; i < faces; i++)
+    plyReadFloats(&ply, vert_elem, "x", 1, &fileVerts[0].x, 4);
+    plyReadFloats(&ply, vert_elem, "y", 1, &fileVerts[0].y, 4);
+    plyReadFloats(&ply, vert_elem, "z", 1, &fileVerts[0].z, 4);
+    vec4 *fileColors = NULL;
+    if (hasColors)
     {
-        // Read num
-        fread(&num, sizeof(num), 1, f);
-
-        // Read num indices
-        for (int j = 0; j < num; j++)
+        fileColors = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numFileVerts);
+        for (int i = 0; i < numFileVerts; i++)
         {
-            fread(&index, sizeof(index), 1, f);
-            // Check index bounds
-            if (index >= numFileVerts)
-            {
-                printf("ERROR: loaded index out of bounds\n");
-                printf("Index: %c\tnumFileVerts: %d", index, numFileVerts);
-                exit(0);
-            }
-            // Copy from fileVerts to vertices
-            vertices[num_vertices++] = fileVerts[index];
-            // If file has color, copy
-            if (hasColors)
-            {
-                colors[num_colors++] = fileColors[index];
-            }
+            fileColors[i].w = 1.0;
         }
-    }
-    // If file doesn't have color, load tex data
+        plyReadFloats(&ply, vert_elem, "red", 1 / 255.0, &fileColors[0].x, 4);
+        plyReadFloats(&ply, vert_elem, "green", 1 / 255.0, &fileColors[0].y, 4);
+        plyReadFloats(&ply, vert_elem, "blue", 1 / 255.0, &fileColors[0].z, 4);
+    }
+
+    // Vertex indices for each face. Faces with more
+    // than 3 corners are split into a fan of triangles
+    u32List tri_verts;
+    u32ListNewArena(&tri_verts, &scratch);
+    plyReadFaces(&ply, face_elem, NULL, numFileVerts, &tri_verts);
+
+    // If file doesn't have color, load tex data. Tex
+    // faces are split the same way as the vertex faces
+    vec2 *file_tex = NULL;
+    u32List tri_tex;
+    u32ListNewArena(&tri_tex, &scratch);
     if (!hasColors)
     {
-        // Allocate space to load tex coords
-        vec2 *file_tex = (vec2 *)malloc(sizeof(vec2) * numFileTexVerts);
-        if (file_tex == NULL)
+        file_tex = (vec2 *)arenaAlloc(&scratch, sizeof(vec2) * tex_elem->count);
+        plyReadFloats(&ply, tex_elem, "u", 1, &file_tex[0].x, 2);
+        plyReadFloats(&ply, tex_elem, "v", 1, &file_tex[0].y, 2);
+        plyReadFaces(&ply, tex_face_elem, NULL, tex_elem->count, &tri_tex);
+        if (tri_tex.length != tri_verts.length)
         {
-            printf("Error allocating memory for file tex coord list\n");
+            printf("ERROR: texture faces don't match vertex faces\n");
             exit(0);
         }
-
-        // Load floats u and v numFileTexVerts times
-        GLfloat u, v;
-        for (int i = 0; i < numFileTexVerts; i++)
-        {
-            // We don't care about the leading char tx
-            fread(&num, sizeof(num), 1, f);
-            fread(&u, sizeof(u), 1, f);
-            fread(&v, sizeof(v), 1, f);
-            file_tex[i] = v2(u, v);
-        }
-
-        // Read vertex indices and copy corresponding
-        // vec2 from file_tex to tex_coords
-        unsigned char tx;
-        unsigned int tn;
-
-        for (int i = 0; i < faces; i++)
-        {
-            // Read and ignore tx and tn
-            fread(&tx, sizeof(tx), 1, f);
-            fread(&tn, sizeof(tn), 1, f);
-
-            // Read num
-            fread(&num, sizeof(num), 1, f);
-            // Read num indices
-            for (int j = 0; j < num; j++)
-            {
-                fread(&index, sizeof(index), 1, f);
-                // Check index bounds
-                if (index >= numFileTexVerts)
-                {
-                    printf("ERROR: loaded index out of bounds\n");
-                    printf("Index: %d\tnumFileTexVerts: %d\n", index, numFileTexVerts);
-                    exit(0);
-                }
-                // Copy from file_tex to tex_coords
-                tex_coords[num_tex_coords++] = file_tex[index];
-            }
-        }
     }
-
-    fclose(f);
+    plyClose(&ply);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    printf("Read %s in %.1f ms: %d vertices, %d triangles\n", filename,
+           (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6,
+           numFileVerts, tri_verts.length / 3);
+
+    // Weld corners that share a position and color or
+    // tex coord into one vertex and index them
+    welder mesh;
+    welderNew(&mesh, numFileVerts, !hasColors, hasColors);
+    u32ListReserve(&mesh.indices, tri_verts.length);
+    vec2 no_tex = v2(0, 0);
+    vec4 no_color = v4(0, 0, 0, 0);
+    for (int i = 0; i < tri_verts.length; i++)
+    {
+        GLuint vi = tri_verts.items[i];
+        welderAdd(&mesh, fileVerts[vi],
+                  hasColors ? no_tex : file_tex[tri_tex.items[i]],
+                  hasColors ? fileColors[vi] : no_color);
+    }
+    takeMesh(&mesh);
+    free(filename);
+    filename = NULL;
+
+    // Done with the per-file-vertex arrays
+    arenaReset(&scratch, temp_mark);
 
 #if DEBUG
     printf("\nNum vertices: %d\n", num_vertices);
@@ -351,16 +333,19 @@ void unitSphere(void)
     mat4 r;
     GLint numSegments = 40, numRings = 40;
 
-    // Allocate space for vertices
+    // Allocate space for vertices. They're welded
+    // into indexed form at the end so build them
+    // in scratch
+    arenaPos temp_mark = arenaMark(&scratch);
     int numVerts = ((numRings)*6) * numSegments;
-    vertices = (vec4 *)malloc(sizeof(vec4) * numVerts);
+    vertices = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numVerts);
 
     // Allocate space for texture coordinates
-    tex_coords = (vec2 *)malloc(sizeof(vec2) * numVerts);
+    tex_coords = (vec2 *)arenaAlloc(&scratch, sizeof(vec2) * numVerts);
 
     // Form reference edges of segment
-    vec4 *ref1 = (vec4 *)malloc(sizeof(vec4) * (numRings + 1));
-    vec4 *ref2 = (vec4 *)malloc(sizeof(vec4) * (numRings + 1));
+    vec4 *ref1 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (numRings + 1));
+    vec4 *ref2 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (numRings + 1));
     theta = M_PI / numRings;
     r = z_rotate(-theta);
     ref1[0] = v4(0, 1, 0, 1);
@@ -416,6 +401,7 @@ void unitSphere(void)
         }
     }
 
+
     // Create texture coordinates
     for (int i = 0; i < num_vertices; i++)
     {
@@ -431,6 +417,16 @@ void unitSphere(void)
     printf("Last vertex: ");
     printVec(&vertices[num_vertices - 1]);
 #endif
+
+    // Neighbouring triangles share corners, so
+    // weld them into indexed form
+    welder mesh;
+    welderNew(&mesh, num_vertices / 4, GL_TRUE, GL_FALSE);
+    welderAddArrays(&mesh, vertices, tex_coords, NULL, num_vertices);
+    takeMesh(&mesh);
+
+    // Done with the unwelded arrays, ref1, and ref2
+    arenaReset(&scratch, temp_mark);
 }
 
 /**
@@ -464,53 +460,96 @@ void randColors(void)
     }
 }
 
+/**
+ * Set up everything that doesn't depend on the model:
+ * the shader, and the placeholder box drawn until the
+ * model is ready
+ */
 void init(void)
 {
+    program = initShader("vshader.glsl", "fshader.glsl");
+    glUseProgram(program);
 
-    // Load texture data
-    GLubyte my_texels[texw][texh][3];
+    // The placeholder is drawn in its own colors
+    glUniform1i(glGetUniformLocation(program, "use_color"), 1);
 
-    // Load texture from file based on
-    // user input
-    if (usefile && !hasColors)
+    // Placeholder: the edges of the cube that centerScale
+    // fits the model into, so it spins and zooms the same
+    // way the model will
+    vec4 box[48];
+    int n = 0;
+    for (int axis = 0; axis < 3; axis++)
     {
-        char *fn = (char *)malloc(sizeof(char) * 25);
-        fn = strcat(filenameInput, ".data");
-        FILE *f = fopen(fn, "r");
-        if (f == NULL)
+        // Four edges along each axis, at each combination
+        // of -1 and 1 on the other two
+        for (int i = 0; i < 4; i++)
         {
-            printf("Error: couldn't open file %s\n", fn);
-            exit(0);
+            GLfloat a = i & 1 ? 1 : -1, b = i & 2 ? 1 : -1;
+            GLfloat *p = (GLfloat *)&box[n];
+            p[axis] = -1;
+            p[(axis + 1) % 3] = a;
+            p[(axis + 2) % 3] = b;
+            p[3] = 1;
+            box[n + 1] = box[n];
+            ((GLfloat *)&box[n + 1])[axis] = 1;
+            n += 2;
         }
-        fread(my_texels, texw * texh * 3, 1, f);
-        fclose(f);
     }
-    // Load texture for ball
-    else if (!usefile)
+    for (int i = 0; i < 24; i++)
     {
-        FILE *f = fopen("ball.data", "r");
-        if (f == NULL)
-        {
-            printf("Error: couldn't open ball.data\n");
-            exit(0);
-        }
-        fread(my_texels, texw * texh * 3, 1, f);
-        fclose(f);
-    }
-    // char *fn = (char *)malloc(sizeof(char) * 25);
-    // fn = strcat(filenameInput, ".data");
-    // FILE *f = fopen(fn, "r");
-    // if (f == NULL)
-    // {
-    //     printf("Error: couldn't open file %s\n", fn);
-    //     exit(0);
-    // }
-    // fread(my_texels, texw * texh * 3, 1, f);
-    // fclose(f);
-
-    GLuint program = initShader("vshader.glsl", "fshader.glsl");
-    glUseProgram(program);
+        box[24 + i] = v4(0.5, 0.5, 0.5, 1);
+    }
 
+    glGenVertexArrays(1, &placeholder_vao);
+    glBindVertexArray(placeholder_vao);
+    GLuint placeholder_buffer;
+    glGenBuffers(1, &placeholder_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, placeholder_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(box), box, GL_STATIC_DRAW);
+
+    GLuint vPosition = glGetAttribLocation(program, "vPosition");
+    glEnableVertexAttribArray(vPosition);
+    glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    GLuint vColor = glGetAttribLocation(program, "vColor");
+    glEnableVertexAttribArray(vColor);
+    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(vec4) * 24));
+
+    // Locate CTM
+    ctm_location = glGetUniformLocation(program, "ctm");
+
+    texStreamNew(&tex_stream);
+    GLubyte gray[3] = {128, 128, 128};
+    glGenTextures(1, &model_texture);
+    glBindTexture(GL_TEXTURE_2D, model_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, gray);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glDepthRange(1, 0);
+}
+
+/**
+ * Start the texture and set up the GL buffers the model
+ * streams into. Called on the main thread once the
+ * loading thread is done with them
+ */
+void uploadModel(void)
+{
+
+    // Texture from the file named after the model, or
+    // the ball's. It loads in the background while the
+    // model is drawn
+    if (!hasColors)
+    {
+        texture_names[0] = usefile ? strcat(filenameInput, ".data") : "ball.data";
+        // There's nothing to fall back on yet
+        if (!texStreamStart(&tex_stream, texture_names[0], texw, texh))
+            exit(1);
+    }
     if (hasColors)
     {
         glUniform1i(glGetUniformLocation(program, "use_color"), 1);
@@ -520,33 +559,13 @@ void init(void)
         glUniform1i(glGetUniformLocation(program, "use_color"), 0);
     }
 
-    // More texture stuff
-    if (!hasColors)
-    {
-        GLuint mytex[1];
-        glGenTextures(1, mytex);
-        glBindTexture(GL_TEXTURE_2D, mytex[0]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texw, texh, 0, GL_RGB, GL_UNSIGNED_BYTE, my_texels);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-        int param;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &param);
-    }
-
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glGenVertexArrays(1, &model_vao);
+    glBindVertexArray(model_vao);
 
-    GLuint buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors + sizeof(vec2) * num_tex_coords, NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec4) * num_vertices, vertices);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec4) * num_vertices, sizeof(vec4) * num_colors, colors);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors, sizeof(vec2) * num_tex_coords, tex_coords);
+    // Buffers are made at full size and filled a few
+    // chunks a frame from display
+    meshUploadStart(&model_upload, vertices, num_colors ? colors : NULL, num_tex_coords ? tex_coords : NULL,
+                    num_vertices, indices, index_type, num_indices);
 
     GLuint vPosition = glGetAttribLocation(program, "vPosition");
     glEnableVertexAttribArray(vPosition);
@@ -567,14 +586,40 @@ void init(void)
         glUniform1i(texture_location, 0);
         printf("texture_location: %i\n", texture_location);
     }
+}
 
-    // Locate CTM
-    ctm_location = glGetUniformLocation(program, "ctm");
+/**
+ * Build the chosen model and center it. Runs
+ * on the loading thread
+ */
+void loadModel(void)
+{
+    if (usefile)
+        readFile();
+    else
+        unitSphere();
+    centerScale();
+}
 
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.0, 0.0, 0.0, 1.0);
-    glDepthRange(1, 0);
+/**
+ * Timer callback that waits for the loading thread,
+ * then swaps the placeholder for the model
+ */
+void checkLoad(int value)
+{
+    if (!asyncLoadDone(&model_load))
+    {
+        glutTimerFunc(LOAD_POLL_MS, checkLoad, 0);
+        return;
+    }
+    printf("Loaded the model in %.1f ms on its own thread\n", model_load.elapsed);
+    uploadModel();
+    model_ready = GL_TRUE;
+
+    // Everything's on the GPU, release the temporaries
+    printArena(&scratch, "Scratch");
+    arenaClear(&scratch);
+    glutPostRedisplay();
 }
 
 void display(void)
@@ -586,9 +631,51 @@ void display(void)
 
     glUniformMatrix4fv(ctm_location, 1, GL_FALSE, (GLfloat *)&ctm);
 
-    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+    if (!model_ready)
+    {
+        glBindVertexArray(placeholder_vao);
+        glDrawArrays(GL_LINES, 0, 24);
+        glutSwapBuffers();
+        if (!shown_first_frame)
+        {
+            printf("First frame after %.1f ms\n", msSince(&program_start));
+            shown_first_frame = GL_TRUE;
+        }
+        return;
+    }
+
+    glBindVertexArray(model_vao);
+    // Upload some more, then draw what's there so far
+    if (!meshUploadDone(&model_upload))
+    {
+        num_drawn = meshUploadStep(&model_upload, UPLOAD_CHUNK_SIZE, UPLOAD_BUDGET_MS);
+        upload_frames++;
+        glutPostRedisplay();
+    }
+    // Same for the texture, which is swapped in whole
+    if (texStreamBusy(&tex_stream))
+    {
+        GLuint streamed = texStreamStep(&tex_stream);
+        if (streamed)
+        {
+            glDeleteTextures(1, &model_texture);
+            model_texture = streamed;
+            printf("Streamed %s in %.1f ms over %d frames\n", texture_names[texture_index],
+                   tex_stream.elapsed, tex_stream.frames);
+        }
+        glutPostRedisplay();
+    }
+    glBindTexture(GL_TEXTURE_2D, model_texture);
+    glDrawElements(GL_TRIANGLES, num_drawn, index_type, BUFFER_OFFSET(0));
 
     glutSwapBuffers();
+    if (!shown_model && meshUploadDone(&model_upload))
+    {
+        printf("Uploaded over %d frames\n", upload_frames);
+        printf("Whole model on screen after %.1f ms\n", msSince(&program_start));
+        shown_first_frame = GL_TRUE;
+        shown_model = GL_TRUE;
+    }
 }
 
 void mouse(int button, int state, int x, int y)
@@ -764,10 +851,7 @@ void centerScale()
     mat4 tr = multMat(&s, &t);
 
     // Translate and scale all vertices
-    for (int i = 0; i < num_vertices; i++)
-    {
-        vertices[i] = multMatVec(&tr, &vertices[i]);
-    }
+    transformVec4ArrayInPlace(&tr, vertices, num_vertices);
 }
 
 void keyboard(unsigned char key, int mousex, int mousey)
@@ -780,6 +864,16 @@ void keyboard(unsigned char key, int mousex, int mousey)
         rotate_mat = identity();
         glutPostRedisplay();
     }
+    if (key == 't' && model_ready && !hasColors && !texStreamBusy(&tex_stream))
+    {
+        // Only the model's own texture has a known size.
+        // If the next one can't be opened the current one
+        // stays, and the one after is tried next time
+        texture_index = (texture_index + 1) % num_texture_names;
+        int w = texture_index ? 0 : texw, h = texture_index ? 0 : texh;
+        texStreamStart(&tex_stream, texture_names[texture_index], w, h);
+        glutPostRedisplay();
+    }
 
     //glutPostRedisplay();
 }
@@ -805,27 +899,18 @@ int main(int argc, char **argv)
             printf("INVALID CHOICE\n");
     } while (!check);
 
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
-    glutInitWindowSize(WSIZE, WSIZE);
-    glutInitWindowPosition(100, 100);
-    glutCreateWindow("Project 2");
-    glewInit();
-
-    ctm = identity();
     // INSERT SHAPE DRAWING FUNCTIONS HERE
     switch (choice)
     {
     case '1':
         texw = 320;
         texh = 320;
-        unitSphere();
         break;
     case '2':
         usefile = GL_TRUE;
         texw = 1024;
         texh = 1024;
-        readFile();
+        promptFile();
         break;
     case '3':
         exit(0);
@@ -834,15 +919,43 @@ int main(int argc, char **argv)
         break;
     }
 
-    centerScale();
+    // The model loads while the window opens. Scratch
+    // belongs to the loading thread until it's done
+    clock_gettime(CLOCK_MONOTONIC, &program_start);
+    arenaNew(&scratch, SCRATCH_SIZE);
+    asyncLoadStart(&model_load, loadModel);
+
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
+    glutInitWindowSize(WSIZE, WSIZE);
+    glutInitWindowPosition(100, 100);
+    glutCreateWindow("Project 2");
+    glewInit();
+
+    // What's left of the command line after GLUT's options
+    // are textures to swap between
+    texture_names = (const char **)malloc(sizeof(char *) * argc);
+    if (texture_names == NULL)
+    {
+        printf("ERROR ALLOCATING MEMORY\n");
+        exit(0);
+    }
+    num_texture_names = argc;
+    for (int i = 1; i < argc; i++)
+    {
+        texture_names[i] = argv[i];
+    }
 
+    ctm = identity();
     init();
+
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutMouseFunc(mouse);
     glutMotionFunc(motion);
     // glutReshapeFunc(reshape);
     glutIdleFunc(idle);
+    glutTimerFunc(0, checkLoad, 0);
     glutMainLoop();
 
     return 0;
@@ -3,4 +3,7 @@
 #define TEXH 1024
 
 void setCurPoint(int x, int y);
-void readFile();
\ No newline at end of file
+void promptFile();
+void readFile();
+void takeMesh(welder *w);
+void centerScale();
\ No newline at end of file
@@ -15,6 +15,12 @@
 
 #include "../lib/initShader.h"
 #include "../lib/lib.h"
+#include "../lib/objFile.h"
+#include "../lib/meshCache.h"
+#include "../lib/asyncLoad.h"
+#include "../lib/meshUpload.h"
+#include "../lib/textureFile.h"
+#include "../lib/textureUpload.h"
 #include "proj3.h"
 
 #define BUFFER_OFFSET(offset) ((GLvoid *)(offset))
@@ -24,6 +30,17 @@
 #define MOVE_SPEED 10
 #define EYE_LEVEL 1.01 // y offset to simulate eye level
 #define GROUND_PADDING 0.2
+// Bump when readFile changes what it builds so old
+// caches get rebuilt
+#define CITY_CACHE_VERSION 1
+// How often to check whether the city has finished loading
+#define LOAD_POLL_MS 10
+// Half the width of the ground drawn while the city loads
+#define PLACEHOLDER_SIZE 100
+// The city goes to the GPU a chunk at a time, as many
+// as fit in the budget each frame
+#define UPLOAD_CHUNK_SIZE (1 << 20)
+#define UPLOAD_BUDGET_MS 4.0
 
 // Available modes
 typedef enum
@@ -39,6 +56,7 @@ mat4 projection;
 mat4 arrow_tr;
 
 // Memory locations of pipeline values
+GLuint program;
 GLuint ctm_location;
 GLuint model_view_location;
 GLuint projection_location;
@@ -51,14 +69,40 @@ vec4 *vertices;
 vec4 *colors;
 vec2 *tex_coords;
 
+// Index buffer into the arrays above, 16 or 32 bit
+// depending on index_type
+GLuint *indices;
+GLenum index_type = GL_UNSIGNED_INT;
+
 // Keep track of vertex quantities 
 int num_vertices = 0;
 int num_colors = 0;
 int num_tex_coords = 0;
+int num_indices = 0;
 
 // Flag for file including colors
 GLboolean has_colors = GL_FALSE;
 
+// The city loads on its own thread while a plain ground
+// is drawn. Once loaded it's drawn as far as it has
+// been uploaded
+asyncLoad city_load;
+const char *city_file;
+GLboolean city_ready = GL_FALSE;
+GLuint city_vao;
+meshUpload city_upload;
+// Where the arrays above came from, so they can be let
+// go once the GL has its own copy
+meshCache city_cache;
+int num_drawn = 0;
+int upload_frames = 0;
+GLuint placeholder_vao;
+
+// For time to first frame and to the whole city
+struct timespec program_start;
+GLboolean shown_first_frame = GL_FALSE;
+GLboolean shown_city = GL_FALSE;
+
 // Texture dimensions
 int texw, texh;
 
@@ -68,10 +112,9 @@ GLfloat left, right, top, bottom, near, far;
 // Elevation of eyeline above y=0 plane
 GLfloat base_eye_level = 0.5;
 
-// Position vectors related to look_at
-vec4 eye = (vec4){0, EYE_LEVEL, 0, 1}; // Start at origin
-vec4 at = (vec4){0, EYE_LEVEL, -1, 1}; // Look towards -z
-vec4 up = (vec4){0, 1, 0, 0};          // Up stays the same
+// Camera position and direction. Starts at the
+// origin at eye level, looking towards -z
+camera cam = {{0, EYE_LEVEL, 0, 1}, 0, 0};
 
 // Find bounds of points
 GLfloat minx = 0, maxx = 0, miny = 0, maxy = 0, minz = 0, maxz = 0;
@@ -96,29 +139,6 @@ GLboolean from_map_flag = GL_FALSE;
 // Distance from "ground" used in animation
 GLfloat anim_d = 0;
 
-// Keep track of up/down camera angle
-GLfloat camera_theta = 0;
-
-// Used in animation calculations
-mat4 rx = {
-    {1, 0, 0, 0},
-    {0, 1, 0, 0},
-    {0, 0, 1, 0},
-    {0, 0, 0, 1},
-};
-mat4 ry = {
-    {1, 0, 0, 0},
-    {0, 1, 0, 0},
-    {0, 0, 1, 0},
-    {0, 0, 0, 1},
-};
-mat4 rz = {
-    {1, 0, 0, 0},
-    {0, 1, 0, 0},
-    {0, 0, 1, 0},
-    {0, 0, 0, 1},
-};
-
 /**
  * Idle animation
  */
@@ -128,91 +148,19 @@ void idle(void)
     // Animate to map mode
     if (to_map_flag == GL_TRUE)
     {
-        // Flag to know how long to keep looking down
-        GLboolean looking_down = GL_TRUE;
-        vec4 v1 = subVec(&at, &eye);
-
-        // If looking almost straight down,
-        // don't rotate or orientation is lost
-        // printf("Angle between: %f\n", angleBetween(&v1, &up));
-        if (angleBetween(&v1, &up) >= M_PI - 0.02)
-        {
-            // printf("Looking down!\n");
-            rz = identity();
-            looking_down = GL_FALSE;
-        }
-
-        if (looking_down == GL_TRUE)
+        // Look down a little at a time until looking
+        // almost straight down. Stop short or
+        // orientation is lost
+        if (cam.pitch > -(M_PI / 2 - 0.02))
         {
-            // printf("Animating...\n");
-            rx = identity();
-            ry = identity();
-            rz = identity();
-            // Calculate rotational axis as the cross
-            // product of [eye -> at] and [eye -> at + some y]
-            vec4 at_offset = v4(at.x, at.y + 0.005, at.z, at.w);
-            vec4 v2 = subVec(&at_offset, &eye);
-
-            vec4 axis = crossVec(&v1, &v2);
-            axis = normalize(&axis);
-
-            // Calculate translation matrix to
-            // move fixed point (eye) to origin
-            mat4 t1 = translate(-eye.x, -eye.y, -eye.z);
-
-            // Rotate a small amount each time
-            rz = z_rotate(-0.015);
-
-            // If looking almost straight down,
-            // don't rotate or orientation is lost
-            if (angleBetween(&v1, &up) >= M_PI - 0.02)
-            {
-                rz = identity();
-                looking_down = GL_FALSE;
-            }
-
-            // Rotate axis to plane y = 0
-            GLfloat d = sqrtf(axis.y * axis.y + axis.z * axis.z);
-
-            if (d != 0)
-            {
-                rx.y = v4(0, axis.z / d, axis.y / d, 0);
-                rx.z = v4(0, -axis.y / d, axis.z / d, 0);
-            }
-
-            // Rotate axis to plane x = 0
-            ry.x = v4(d, 0, axis.x, 0);
-            ry.z = v4(-axis.x, 0, d, 0);
-
-            // Put together translation matrix
-            mat4 m = t1;
-            m = multMat(&rx, &m);
-            m = multMat(&ry, &m);
-            m = multMat(&rz, &m);
-            // Invert t1, rx, and ry
-            t1 = invMat(&t1);
-            rx = invMat(&rx);
-            ry = invMat(&ry);
-            // Continue making m
-            m = multMat(&ry, &m);
-            m = multMat(&rx, &m);
-            m = multMat(&t1, &m);
-
-            // Apply m to 'at'
-            at = multMatVec(&m, &at);
-            model_view = look_at(eye, at, up);
-            // printVec(&at);
-            glutPostRedisplay();
+            cam.pitch -= 0.015;
         }
         else
         {
             // Move backwards up into the air until at a
-            // height of 100
-            eye.y += 1;
-            at.y += 1;
-            model_view = look_at(eye, at, up);
-            glutPostRedisplay();
-            if (eye.y >= 200)
+            // height of 200
+            cam.eye.y += 1;
+            if (cam.eye.y >= 200)
                 to_map_flag = GL_FALSE;
         }
     }
@@ -221,91 +169,27 @@ void idle(void)
     if (from_map_flag == GL_TRUE)
     {
         // Move towards ground
-        if (eye.y > EYE_LEVEL + 0.01)
+        if (cam.eye.y > EYE_LEVEL + 0.01)
         {
-            // printf("Moving in...\n");
-            eye.y -= 1;
-            at.y -= 1;
-            model_view = look_at(eye, at, up);
-            glutPostRedisplay();
+            cam.eye.y -= 1;
         }
         else
         {
             // Make sure eye is at exactly eye level
-            eye.y = EYE_LEVEL;
+            cam.eye.y = EYE_LEVEL;
             // look up until looking straight ahead
-            if (at.y < eye.y)
+            if (cam.pitch < 0)
             {
-                // printf("Looking up...\n");
-                rx = identity();
-                ry = identity();
-                rz = identity();
-                // Calculate rotational axis as the cross
-                // product of [eye -> at] and [eye -> at + some y]
-                vec4 at_offset = v4(at.x, at.y + 0.005, at.z, at.w);
-                vec4 v1 = subVec(&at, &eye);
-                vec4 v2 = subVec(&at_offset, &eye);
-
-                vec4 axis = crossVec(&v1, &v2);
-                // vec4 axis = crossVec(&at, &at_offset);
-                axis = normalize(&axis);
-
-                // Calculate translation matrix to
-                // move fixed point (eye) to origin
-                mat4 t1 = translate(-eye.x, -eye.y, -eye.z);
-
-                // Rotate a small amount each time
-                rz = z_rotate(0.015);
-
-                // If angle less than threshold, don't rotate
-                // if angle hits 0, orientation is lost
-                if (angleBetween(&v1, &up) < 0.02)
-                {
-                    rz = identity();
-                }
-
-                // Rotate axis to plane y = 0
-                GLfloat d = sqrtf(axis.y * axis.y + axis.z * axis.z);
-
-                if (d != 0)
-                {
-                    rx.y = v4(0, axis.z / d, axis.y / d, 0);
-                    rx.z = v4(0, -axis.y / d, axis.z / d, 0);
-                }
-
-                // Rotate axis to plane x = 0
-                ry.x = v4(d, 0, axis.x, 0);
-                ry.z = v4(-axis.x, 0, d, 0);
-
-                // Put together translation matrix
-                mat4 m = t1;
-                m = multMat(&rx, &m);
-                m = multMat(&ry, &m);
-                m = multMat(&rz, &m);
-                // Invert t1, rx, and ry
-                t1 = invMat(&t1);
-                rx = invMat(&rx);
-                ry = invMat(&ry);
-                // Continue making m
-                m = multMat(&ry, &m);
-                m = multMat(&rx, &m);
-                m = multMat(&t1, &m);
-
-                // Apply m to 'at'
-                at = multMatVec(&m, &at);
-                model_view = look_at(eye, at, up);
-                glutPostRedisplay();
+                cam.pitch += 0.015;
             }
             else
             {
-                // Make sure at and eye on same level
-                at.y = eye.y;
+                // Make sure we're looking exactly level
+                cam.pitch = 0;
                 // Stop animation
                 from_map_flag = GL_FALSE;
                 // Change mode to allow movement
                 curMode = WALK;
-                model_view = look_at(eye, at, up);
-                glutPostRedisplay();
             }
         }
     }
@@ -316,227 +200,75 @@ void idle(void)
     // Only move if in walk mode
     if (curMode == WALK)
     {
+        // Direction we're facing and the relative x axis
+        vec4 forward = cameraForward(&cam);
+        vec4 right = cameraRight(&cam);
+
         // Forward
+        // Do NOT translate in y direction
         if (forward_flag)
         {
-
-            // Use look_at
-            // Translate eye in direction of at
-            vec4 diff = subVec(&at, &eye);
-            // Normalize to unit vector for uniform movement
-            diff = normalize(&diff);
-            // Translate both eye and at in diff direction
-            // Do NOT translate in y direction
-            eye.x += diff.x / 10;
-            eye.z += diff.z / 10;
-            at.x += diff.x / 10;
-            at.z += diff.z / 10;
+            cam.eye.x += forward.x / 10;
+            cam.eye.z += forward.z / 10;
         }
         // Back
         if (back_flag)
         {
-            // Translate eye in direction of at
-            vec4 diff = subVec(&at, &eye);
-            // Normalize to unit vector for uniform movement
-            diff = normalize(&diff);
-            // Translate both eye and at in diff direction
-            // Do NOT translate in y direction
-            eye.x -= diff.x / 10;
-            eye.z -= diff.z / 10;
-            at.x -= diff.x / 10;
-            at.z -= diff.z / 10;
+            cam.eye.x -= forward.x / 10;
+            cam.eye.z -= forward.z / 10;
         }
         // Left
         if (left_flag)
         {
-            // Move along relative x axis
-            vec4 z_prime = subVec(&eye, &at);
-            vec4 x_prime = crossVec(&up, &z_prime);
-
-            eye.x -= x_prime.x / 10;
-            eye.z -= x_prime.z / 10;
-            at.x -= x_prime.x / 10;
-            at.z -= x_prime.z / 10;
+            cam.eye.x -= right.x / 10;
+            cam.eye.z -= right.z / 10;
         }
         // Right
         if (right_flag)
         {
-            // Move along relative x axis
-            vec4 z_prime = subVec(&eye, &at);
-            vec4 x_prime = crossVec(&up, &z_prime);
-
-            eye.x += x_prime.x / 10;
-            eye.z += x_prime.z / 10;
-            at.x += x_prime.x / 10;
-            at.z += x_prime.z / 10;
+            cam.eye.x += right.x / 10;
+            cam.eye.z += right.z / 10;
         }
         // Turn left
         if (turnleft_flag)
         {
-            // Translate at as if moving eye to origin,
-            // rotate, then translate along same vector
-            mat4 tr = translate(-eye.x, -eye.y, -eye.z);
-            mat4 r = y_rotate(0.0055);
-            r = multMat(&r, &tr);
-            tr = translate(eye.x, eye.y, eye.z);
-            r = multMat(&tr, &r);
-            at = multMatVec(&r, &at);
+            cam.yaw += 0.0055;
         }
         // Turn right
         if (turnright_flag)
         {
-            // Translate at as if moving eye to origin,
-            // rotate, then translate along same vector
-            mat4 tr = translate(-eye.x, -eye.y, -eye.z);
-            mat4 r = y_rotate(-0.0055);
-            r = multMat(&r, &tr);
-            tr = translate(eye.x, eye.y, eye.z);
-            r = multMat(&tr, &r);
-            at = multMatVec(&r, &at);
+            cam.yaw -= 0.0055;
         }
         // Look up
-        if (lookup_flag)
+        // Stop short of straight up or orientation is lost
+        if (lookup_flag && cam.pitch < M_PI / 2 - 0.015)
         {
-            rx = identity();
-            ry = identity();
-            rz = identity();
-            // Calculate rotational axis as the cross
-            // product of [eye -> at] and [eye -> at + some y]
-            vec4 at_offset = v4(at.x, at.y + 0.005, at.z, at.w);
-            vec4 v1 = subVec(&at, &eye);
-            vec4 v2 = subVec(&at_offset, &eye);
-
-            vec4 axis = crossVec(&v1, &v2);
-            // vec4 axis = crossVec(&at, &at_offset);
-            axis = normalize(&axis);
-
-            // Calculate translation matrix to
-            // move fixed point (eye) to origin
-            mat4 t1 = translate(-eye.x, -eye.y, -eye.z);
-
-            // Rotate a small amount each time
-            rz = z_rotate(0.0055);
-
-            // If angle less than threshold, don't rotate
-            // if angle hits 0, orientation is lost
-            if (angleBetween(&v1, &up) < 0.015)
-            {
-                rz = identity();
-            }
-
-            // Rotate axis to plane y = 0
-            GLfloat d = sqrtf(axis.y * axis.y + axis.z * axis.z);
-
-            if (d != 0)
-            {
-                rx.y = v4(0, axis.z / d, axis.y / d, 0);
-                rx.z = v4(0, -axis.y / d, axis.z / d, 0);
-            }
-
-            // Rotate axis to plane x = 0
-            ry.x = v4(d, 0, axis.x, 0);
-            ry.z = v4(-axis.x, 0, d, 0);
-
-            // Put together translation matrix
-            mat4 m = t1;
-            m = multMat(&rx, &m);
-            m = multMat(&ry, &m);
-            m = multMat(&rz, &m);
-            // Invert t1, rx, and ry
-            t1 = invMat(&t1);
-            rx = invMat(&rx);
-            ry = invMat(&ry);
-            // Continue making m
-            m = multMat(&ry, &m);
-            m = multMat(&rx, &m);
-            m = multMat(&t1, &m);
-
-            // Apply m to 'at'
-            at = multMatVec(&m, &at);
+            cam.pitch += 0.0055;
         }
         // Look down
-        if (lookdown_flag)
+        if (lookdown_flag && cam.pitch > -(M_PI / 2 - 0.015))
         {
-            rx = identity();
-            ry = identity();
-            rz = identity();
-            // Calculate rotational axis as the cross
-            // product of [eye -> at] and [eye -> at + some y]
-            vec4 at_offset = v4(at.x, at.y + 0.005, at.z, at.w);
-            vec4 v1 = subVec(&at, &eye);
-            vec4 v2 = subVec(&at_offset, &eye);
-
-            vec4 axis = crossVec(&v1, &v2);
-            // vec4 axis = crossVec(&at, &at_offset);
-            axis = normalize(&axis);
-
-            // Calculate translation matrix to
-            // move fixed point (eye) to origin
-            mat4 t1 = translate(-eye.x, -eye.y, -eye.z);
-
-            // Rotate a small amount each time
-            rz = z_rotate(-0.0055);
-
-            // If looking almost straight down,
-            // don't rotate or orientation is lost
-            if (angleBetween(&v1, &up) >= M_PI - 0.015)
-            {
-                rz = identity();
-            }
-
-            // Rotate axis to plane y = 0
-            GLfloat d = sqrtf(axis.y * axis.y + axis.z * axis.z);
-
-            if (d != 0)
-            {
-                rx.y = v4(0, axis.z / d, axis.y / d, 0);
-                rx.z = v4(0, -axis.y / d, axis.z / d, 0);
-            }
-
-            // Rotate axis to plane x = 0
-            ry.x = v4(d, 0, axis.x, 0);
-            ry.z = v4(-axis.x, 0, d, 0);
-
-            // Put together translation matrix
-            mat4 m = t1;
-            m = multMat(&rx, &m);
-            m = multMat(&ry, &m);
-            m = multMat(&rz, &m);
-            // Invert t1, rx, and ry
-            t1 = invMat(&t1);
-            rx = invMat(&rx);
-            ry = invMat(&ry);
-            // Continue making m
-            m = multMat(&ry, &m);
-            m = multMat(&rx, &m);
-            m = multMat(&t1, &m);
-
-            // Apply m to 'at'
-            at = multMatVec(&m, &at);
+            cam.pitch -= 0.0055;
         }
     }
 
-    model_view = look_at(eye, at, up);
+    model_view = cameraView(&cam);
     glutPostRedisplay();
 }
 
+/**
+ * Set up everything that doesn't depend on the city:
+ * shader, texture, uniforms, and the placeholder ground
+ * drawn until the city is ready
+ */
 void init(void)
 {
 
-    // Load texture data
-    GLubyte my_texels[texw][texh][3];
+    // Texture is uploaded straight from the file mapping
+    textureFile tex;
+    textureOpen(&tex, "city.data", texw, texh);
 
-    // Load texture from file
-    FILE *f = fopen("city.data", "r");
-    if (f == NULL)
-    {
-        printf("Error: couldn't open file city.data\n");
-        exit(0);
-    }
-    fread(my_texels, texw * texh * 3, 1, f);
-    fclose(f);
-
-    GLuint program = initShader("vshader.glsl", "fshader.glsl");
+    program = initShader("vshader.glsl", "fshader.glsl");
     glUseProgram(program);
 
     if (has_colors)
@@ -554,36 +286,45 @@ void init(void)
         GLuint mytex[1];
         glGenTextures(1, mytex);
         glBindTexture(GL_TEXTURE_2D, mytex[0]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texw, texh, 0, GL_RGB, GL_UNSIGNED_BYTE, my_texels);
+        // Mip levels from the cache next to the texture,
+        // or made now and cached, compressed if the GL can
+        struct timespec tex_start;
+        clock_gettime(CLOCK_MONOTONIC, &tex_start);
+        int cached = textureUpload(&tex, "city.data");
+        printf("%s texture levels in %.1f ms\n", cached ? "Mapped" : "Made", msSince(&tex_start));
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
         int param;
         glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &param);
-    }
 
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    // Buffer setup
-    GLuint buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors + sizeof(vec2) * num_tex_coords, NULL, GL_STATIC_DRAW);
-    // Buffer sections
-    int buff_offset = 0;
-    // Vertices
-    glBufferSubData(GL_ARRAY_BUFFER, buff_offset, sizeof(vec4) * num_vertices, vertices);
-    buff_offset += sizeof(vec4) * num_vertices;
-    // Colors
-    glBufferSubData(GL_ARRAY_BUFFER, buff_offset, sizeof(vec4) * num_colors, colors);
-    buff_offset += sizeof(vec4) * num_colors;
-    // Texture coords
-    glBufferSubData(GL_ARRAY_BUFFER, buff_offset, sizeof(vec2) * num_tex_coords, tex_coords);
-    buff_offset += sizeof(vec4) * num_tex_coords;
+        // Locate texture
+        GLuint texture_location = glGetUniformLocation(program, "texture");
+        glUniform1i(texture_location, 0);
+        printf("texture_location: %i\n", texture_location);
+    }
+    textureClose(&tex);
+
+    // Placeholder: a patch of ground around where the
+    // camera starts, in the same green as the real one
+    vec4 green = v4(0.11, 0.647, 0.188, 1);
+    vec4 ground[12] = {
+        {-PLACEHOLDER_SIZE, 0, PLACEHOLDER_SIZE, 1},
+        {PLACEHOLDER_SIZE, 0, PLACEHOLDER_SIZE, 1},
+        {PLACEHOLDER_SIZE, 0, -PLACEHOLDER_SIZE, 1},
+        {PLACEHOLDER_SIZE, 0, -PLACEHOLDER_SIZE, 1},
+        {-PLACEHOLDER_SIZE, 0, -PLACEHOLDER_SIZE, 1},
+        {-PLACEHOLDER_SIZE, 0, PLACEHOLDER_SIZE, 1},
+        green, green, green, green, green, green};
+
+    glGenVertexArrays(1, &placeholder_vao);
+    glBindVertexArray(placeholder_vao);
+    GLuint placeholder_buffer;
+    glGenBuffers(1, &placeholder_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, placeholder_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(ground), ground, GL_STATIC_DRAW);
 
     GLuint vPosition = glGetAttribLocation(program, "vPosition");
     glEnableVertexAttribArray(vPosition);
@@ -591,19 +332,7 @@ void init(void)
 
     GLuint vColor = glGetAttribLocation(program, "vColor");
     glEnableVertexAttribArray(vColor);
-    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid *)(sizeof(vec4) * num_vertices));
-
-    // Texture stuff
-    if (!has_colors)
-    {
-        GLuint vTexCoord = glGetAttribLocation(program, "vTexCoord");
-        glEnableVertexAttribArray(vTexCoord);
-        glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)(sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors));
-        // Locate texture
-        GLuint texture_location = glGetUniformLocation(program, "texture");
-        glUniform1i(texture_location, 0);
-        printf("texture_location: %i\n", texture_location);
-    }
+    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(vec4) * 6));
 
     // Locate CTM
     ctm_location = glGetUniformLocation(program, "ctm");
@@ -624,6 +353,76 @@ void init(void)
     glDepthRange(1, 0);
 }
 
+/**
+ * Set up the GL buffers the city streams into. Called
+ * on the main thread once the loading thread is done
+ */
+void uploadCity(void)
+{
+    glGenVertexArrays(1, &city_vao);
+    glBindVertexArray(city_vao);
+
+    // Buffers are made at full size and filled a few
+    // chunks a frame from display
+    meshUploadStart(&city_upload, vertices, colors, tex_coords, num_vertices, indices, index_type, num_indices);
+
+    GLuint vPosition = glGetAttribLocation(program, "vPosition");
+    glEnableVertexAttribArray(vPosition);
+    glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    GLuint vColor = glGetAttribLocation(program, "vColor");
+    glEnableVertexAttribArray(vColor);
+    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid *)(sizeof(vec4) * num_vertices));
+
+    // Texture stuff
+    if (!has_colors)
+    {
+        GLuint vTexCoord = glGetAttribLocation(program, "vTexCoord");
+        glEnableVertexAttribArray(vTexCoord);
+        glVertexAttribPointer(vTexCoord, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)(sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors));
+    }
+}
+
+/**
+ * Let go of the city's arrays once they're all in GL
+ * buffers: unmap the cache file, or free what readFile
+ * built
+ */
+void releaseCity(void)
+{
+    if (city_cache.map)
+    {
+        meshCacheClose(&city_cache);
+    }
+    else
+    {
+        free(vertices);
+        free(colors);
+        free(tex_coords);
+        free(indices);
+    }
+    vertices = colors = NULL;
+    tex_coords = NULL;
+    indices = NULL;
+}
+
+/**
+ * Timer callback that waits for the loading thread,
+ * then swaps the placeholder for the city
+ */
+void checkLoad(int value)
+{
+    if (!asyncLoadDone(&city_load))
+    {
+        glutTimerFunc(LOAD_POLL_MS, checkLoad, 0);
+        return;
+    }
+    printf("Loaded the city in %.1f ms on its own thread\n", city_load.elapsed);
+    uploadCity();
+    city_ready = GL_TRUE;
+    glutPostRedisplay();
+}
+
 void display(void)
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -636,22 +435,65 @@ void display(void)
     glUniformMatrix4fv(projection_location, 1, GL_FALSE, (GLfloat *)&projection);
     glUniformMatrix4fv(arrow_tr_location, 1, GL_FALSE, (GLfloat *)&arrow_tr);
 
+    // Just the ground until the city is loaded, and under
+    // it until the real ground is uploaded
+    GLboolean uploading = !city_ready || !meshUploadDone(&city_upload);
+    if (uploading)
+    {
+        glUniform1i(draw_arrow_location, 0);
+        glUniform1i(colorflag_location, 1);
+        glBindVertexArray(placeholder_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+    if (!city_ready)
+    {
+        glutSwapBuffers();
+        if (!shown_first_frame)
+        {
+            printf("First frame after %.1f ms\n", msSince(&program_start));
+            shown_first_frame = GL_TRUE;
+        }
+        return;
+    }
+
+    // Upload some more, then draw what's there so far
+    glBindVertexArray(city_vao);
+    if (uploading)
+    {
+        num_drawn = meshUploadStep(&city_upload, UPLOAD_CHUNK_SIZE, UPLOAD_BUDGET_MS);
+        upload_frames++;
+        glutPostRedisplay();
+        if (meshUploadDone(&city_upload))
+            releaseCity();
+    }
+
     // Draw city
     glUniform1i(draw_arrow_location, 0);
     glUniform1i(colorflag_location, 0);
-    glDrawArrays(GL_TRIANGLES, 0, num_vertices - 9);
-    // Draw ground
-    glUniform1i(colorflag_location, 1);
-    glDrawArrays(GL_TRIANGLES, num_vertices - 9, 6);
-    // If in map mode, draw triangle
-    if (curMode == MAP)
+    glDrawElements(GL_TRIANGLES, num_drawn < num_indices - 9 ? num_drawn : num_indices - 9, index_type, BUFFER_OFFSET(0));
+    // The ground and arrow are the last to go up
+    if (meshUploadDone(&city_upload))
     {
-        // Set draw_arrow
-        glUniform1i(draw_arrow_location, 1);
-        glDrawArrays(GL_TRIANGLES, num_vertices - 3, 3);
+        // Draw ground
+        glUniform1i(colorflag_location, 1);
+        glDrawElements(GL_TRIANGLES, 6, index_type, BUFFER_OFFSET(indexSize(index_type) * (num_indices - 9)));
+        // If in map mode, draw triangle
+        if (curMode == MAP)
+        {
+            // Set draw_arrow
+            glUniform1i(draw_arrow_location, 1);
+            glDrawElements(GL_TRIANGLES, 3, index_type, BUFFER_OFFSET(indexSize(index_type) * (num_indices - 3)));
+        }
     }
 
     glutSwapBuffers();
+    if (!shown_city && meshUploadDone(&city_upload))
+    {
+        printf("Uploaded over %d frames\n", upload_frames);
+        printf("Whole city on screen after %.1f ms\n", msSince(&program_start));
+        shown_first_frame = GL_TRUE;
+        shown_city = GL_TRUE;
+    }
 }
 
 void keyboard(unsigned char key, int mousex, int mousey)
@@ -664,10 +506,10 @@ void keyboard(unsigned char key, int mousex, int mousey)
     {
         ctm = identity();
         anim_d = base_eye_level;
-        camera_theta = 0;
-        eye = v4(0, EYE_LEVEL, 0, 1);
-        at = v4(0, EYE_LEVEL, -1, 1);
-        model_view = look_at(eye, at, up);
+        cam.eye = v4(0, EYE_LEVEL, 0, 1);
+        cam.yaw = 0;
+        cam.pitch = 0;
+        model_view = cameraView(&cam);
         to_map_flag = GL_FALSE;
         from_map_flag = GL_FALSE;
         curMode = WALK;
@@ -690,28 +532,21 @@ void keyboard(unsigned char key, int mousex, int mousey)
         // then translate to eye
 
         mat4 r, tr;
-        // Get angle between -z axis and eye->at vec
-        vec4 facing = subVec(&at, &eye);
-        // Remove y element of facing
-        facing.y = 0.0;
-        vec4 z_axis = v4(0, 0, -1, 0);
-        GLfloat theta = angleBetween(&facing, &z_axis);
-        // Rotate clockwise or counterclockwise
-        if (facing.x > 0)
-        {
-            theta = -theta;
-        }
+        // Yaw is already the angle between -z and
+        // the direction we're facing
+        GLfloat theta = cam.yaw;
 #if DEBUG
         printf("Rotate arrow %f\n", theta);
         printf("Eye:\n");
-        printVec(&eye);
+        printVec(&cam.eye);
         printf("Point of arrow:\n");
-        printVec(&vertices[num_vertices - 3]);
+        if (vertices)
+            printVec(&vertices[num_vertices - 3]);
 #endif
         r = y_rotate(theta);
         // r = identity();
         // Move to eye
-        tr = translate(eye.x, 0, eye.z);
+        tr = translate(cam.eye.x, 0, cam.eye.z);
         // tr = identity();
         // Combine transformations
         arrow_tr = multMat(&tr, &r);
@@ -825,216 +660,158 @@ void reshape(int width, int height)
 }
 
 /**
- * Read and parse city.obj
+ * Read and parse the city's OBJ file
  */
-void readFile()
+void readFile(const char *filename)
 {
-    FILE *f = fopen("city.obj", "r");
-    const char delim[2] = " "; // Delimiter for tokenizing strings
-    char *token;               // Token
-    size_t buf_len = 1024;
-    char *line = (char *)malloc(buf_len);                 // Buffer to read one line
-    char **faces = (char **)malloc(sizeof(char *) * 100); // Buffer to read face values
-
-    // Use a dynamically resizing list to load
-    // values since file size is unknown
-    // Raw vertices
-    v4List vertTemp;
-    v4ListNew(&vertTemp);
-
-    // Vertices ordered according to faces
-    v4List vertOrdered;
-    v4ListNew(&vertOrdered);
-
-    // Raw texture coords
-    v2List texTemp;
-    v2ListNew(&texTemp);
-
-    // Ordered texture coords according to faces
-    v2List texOrdered;
-    v2ListNew(&texOrdered);
-
-    // Read file one line at a time until EOF
-    GLfloat x, y, z, s, t;
-    vec4 v;
-    vec2 vt;
-    while (fgets(line, buf_len, f) != NULL)
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    objMesh obj;
+    objLoad(&obj, filename, 0);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    printf("Parsed %s in %.1f ms: %d positions, %d tex coords, %d triangles\n", filename,
+           (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6,
+           obj.num_positions, obj.num_tex_coords, obj.num_corners / 3);
+
+    minx = obj.min.x < minx ? obj.min.x : minx;
+    maxx = obj.max.x > maxx ? obj.max.x : maxx;
+    miny = obj.min.y < miny ? obj.min.y : miny;
+    maxy = obj.max.y > maxy ? obj.max.y : maxy;
+    minz = obj.min.z < minz ? obj.min.z : minz;
+    maxz = obj.max.z > maxz ? obj.max.z : maxz;
+
+    // Unique (position, tex coord, color) vertices and an index
+    // per face corner. Corners can't outnumber the larger of
+    // the position and tex coord counts by much, so start there
+    welder city;
+    welderNew(&city, (obj.num_positions > obj.num_tex_coords ? obj.num_positions : obj.num_tex_coords) + 9,
+              GL_TRUE, GL_TRUE);
+    u32ListReserve(&city.indices, obj.num_corners + 9);
+    vec2 no_tex = v2(0, 0);
+    vec4 green = v4(0.11, 0.647, 0.188, 1);
+    vec4 blue = v4(0, 0, 1, 1);
+
+    // Faces come already split into triangles
+    for (int i = 0; i < obj.num_corners; i++)
     {
-        // Check line type - first token
-        token = strtok(line, delim);
-
-        // Handle different line types
-        // Vertex
-        if (!strcmp(token, "v"))
+        objCorner c = obj.corners[i];
+        vec2 vt = no_tex;
+        if (c.vt >= 0)
         {
-            // Read x, y, and z
-            token = strtok(NULL, delim);
-            sscanf(token, "%f", &x);
-            token = strtok(NULL, delim);
-            sscanf(token, "%f", &y);
-            token = strtok(NULL, delim);
-            sscanf(token, "%f", &z);
-            v = v4(x, y, z, 1.0);
-
-            // Add to vertTemp
-            v4ListPush(&vertTemp, v);
-
-            minx = x < minx ? x : minx;
-            maxx = x > maxx ? x : maxx;
-            miny = y < miny ? y : miny;
-            maxy = y > maxy ? y : maxy;
-            minz = z < minz ? z : minz;
-            maxz = z > maxz ? z : maxz;
-        }
-        // Texture vertex
-        else if (!strcmp(token, "vt"))
-        {
-            // Read s and t
-            token = strtok(NULL, delim);
-            sscanf(token, "%f", &s);
-            token = strtok(NULL, delim);
-            sscanf(token, "%f", &t);
             // Unflip t
-            t = 1.0 - t;
-            vt = v2(s, t);
-
-            // Add to texTemp
-            v2ListPush(&texTemp, vt);
-        }
-        // Face
-        else if (!strcmp(token, "f"))
-        {
-            // Load vert indeces into faces and count
-            int numfaces = 0;
-            token = strtok(NULL, delim);
-            while (token != NULL)
-            {
-                faces[numfaces++] = token;
-                token = strtok(NULL, delim);
-            }
-            // If numfaces < 3 something went wrong
-            if (numfaces < 3)
-            {
-                printf("Error: less than 3 indices on face line\n");
-                exit(1);
-            }
-#if DEBUG_FILE_INPUT
-            char tempflag = (vertOrdered.length == 0);
-            0 if (tempflag)
-            {
-                printf("numfaces: %d\n", numfaces);
-                for (int i = 0; i < numfaces; i++)
-                {
-                    printf("%s ", faces[i]);
-                }
-                printf("\n");
-            }
-#endif
-
-            // Loop over faces in pattern specified in instructions
-            // 1,2,3; 1,3,4; 1,4,5; etc.
-            int vi, ti; // Vert index, tex index
-            for (int i = 0; i < numfaces - 2; i++)
-            {
-                // Entry 0
-                sscanf(faces[0], "%d/%d", &vi, &ti);
-#if DEBUG_FILE_INPUT
-                0 if (tempflag)
-                    printf("vi: %d\tvt: %d\n", vi, ti);
-#endif
-                v4ListPush(&vertOrdered, vertTemp.items[vi - 1]);
-                v2ListPush(&texOrdered, texTemp.items[ti - 1]); // Texture index starts at 1
-
-                // Entry 1 + i
-                sscanf(faces[1 + i], "%d/%d", &vi, &ti);
-#if DEBUG_FILE_INPUT
-                0 if (tempflag)
-                    printf("vi: %d\tvt: %d\n", vi, ti);
-#endif
-                v4ListPush(&vertOrdered, vertTemp.items[vi - 1]);
-                v2ListPush(&texOrdered, texTemp.items[ti - 1]); // Texture index starts at 1
-
-                // Entry 2 + i
-                sscanf(faces[2 + i], "%d/%d", &vi, &ti);
-#if DEBUG_FILE_INPUT
-                0 if (tempflag)
-                    printf("vi: %d\tvt: %d\n\n", vi, ti);
-#endif
-                v4ListPush(&vertOrdered, vertTemp.items[vi - 1]);
-                v2ListPush(&texOrdered, texTemp.items[ti - 1]); // Texture index starts at 1
-            }
+            vt = v2(obj.tex_coords[c.vt].x, 1.0 - obj.tex_coords[c.vt].y);
         }
+        welderAdd(&city, obj.positions[c.v], vt, green);
     }
+    objFree(&obj);
 
 #if DEBUG_FILE_INPUT
-    0 printf("vertTemp capacity:\t%d\n", vertTemp.capacity);
-    printf("vertTemp length:\t%d\n", vertTemp.length);
-    printf("texTemp capacity:\t%d\n", texTemp.capacity);
-    printf("texTemp length:\t\t%d\n\n", texTemp.length);
-
-    printf("vertOrdered capacity:\t%d\n", vertOrdered.capacity);
-    printf("vertOrdered length:\t%d\n", vertOrdered.length);
-    printf("texOrdered capacity:\t%d\n", texOrdered.capacity);
-    printf("texOrdered length:\t%d\n", texOrdered.length);
+    printf("unique vertices:\t%d\n", city.positions.length);
+    printf("indices:\t%d\n", city.indices.length);
 
     printf("\nminx: %f\t", minx);
     printf("maxx: %f\t", maxx);
-
-    printf("\n\nFirst vertex SHOULD BE:\n");
-    printVec(&vertTemp.items[882]);
-    printf("First vertex is:\n");
-    printVec(&vertOrdered.items[0]);
-
 #endif
     // Add ground
-    v4ListPush(&vertOrdered, v4(minx - GROUND_PADDING, miny, maxz + GROUND_PADDING, 1));
-    v4ListPush(&vertOrdered, v4(maxx + GROUND_PADDING, miny, maxz + GROUND_PADDING, 1));
-    v4ListPush(&vertOrdered, v4(maxx + GROUND_PADDING, miny, minz - GROUND_PADDING, 1));
+    welderAdd(&city, v4(minx - GROUND_PADDING, miny, maxz + GROUND_PADDING, 1), no_tex, green);
+    welderAdd(&city, v4(maxx + GROUND_PADDING, miny, maxz + GROUND_PADDING, 1), no_tex, green);
+    welderAdd(&city, v4(maxx + GROUND_PADDING, miny, minz - GROUND_PADDING, 1), no_tex, green);
 
-    v4ListPush(&vertOrdered, v4(maxx + GROUND_PADDING, miny, minz - GROUND_PADDING, 1));
-    v4ListPush(&vertOrdered, v4(minx - GROUND_PADDING, miny, minz - GROUND_PADDING, 1));
-    v4ListPush(&vertOrdered, v4(minx - GROUND_PADDING, miny, maxz + GROUND_PADDING, 1));
+    welderAdd(&city, v4(maxx + GROUND_PADDING, miny, minz - GROUND_PADDING, 1), no_tex, green);
+    welderAdd(&city, v4(minx - GROUND_PADDING, miny, minz - GROUND_PADDING, 1), no_tex, green);
+    welderAdd(&city, v4(minx - GROUND_PADDING, miny, maxz + GROUND_PADDING, 1), no_tex, green);
 
     // Translate so all x >= 0, y >= 0, z <= 0
     mat4 m1 = translate(-minx, -miny, -maxz);
     // Scale by 100
     mat4 m2 = scale(100, 100, 100);
     mat4 m3 = multMat(&m2, &m1);
-    for (int i = 0; i < vertOrdered.length; i++)
-    {
-        vertOrdered.items[i] = multMatVec(&m3, &vertOrdered.items[i]);
-    }
-    // Add triangle - start with dummy values
-    v4ListPush(&vertOrdered, v4(0, 0.1, 0, 1));
-    v4ListPush(&vertOrdered, v4(-1, 0.1, 4, 1));
-    v4ListPush(&vertOrdered, v4(1, 0.1, 4, 1));
-
-    // Transfer vertOrdered and texOrdered to vertices and tex_coords
-    vertices = vertOrdered.items;
-    num_vertices += vertOrdered.length;
-    tex_coords = texOrdered.items;
-    num_tex_coords += texOrdered.length;
-
-    // Fill colors with green for ground, blue for triangle
+    transformVec4ArrayInPlace(&m3, city.positions.items, city.positions.length);
+    // Add triangle in blue - start with dummy values.
+    // Being blue keeps these the last 3 vertices
+    welderAdd(&city, v4(0, 0.1, 0, 1), no_tex, blue);
+    welderAdd(&city, v4(-1, 0.1, 4, 1), no_tex, blue);
+    welderAdd(&city, v4(1, 0.1, 4, 1), no_tex, blue);
+
+    // Hand the welded vertices over. Every attribute
+    // has one entry per unique vertex
+    vertices = v4ListRelease(&city.positions, &num_vertices);
+    tex_coords = v2ListRelease(&city.tex_coords, &num_tex_coords);
+    colors = v4ListRelease(&city.colors, &num_colors);
+    indices = u32ListRelease(&city.indices, &num_indices);
+    welderFree(&city);
+    printf("City: %d unique vertices for %d corners\n", num_vertices, num_indices);
+
+    // Only the city's triangles get reordered, the ground
+    // and arrow are drawn on their own from the last 9
+    // indices. Fetch order follows the index order, so
+    // the arrow stays the last 3 vertices
+    printCacheStats("Before optimizing", indices, num_indices - 9, num_vertices);
+    optimizeVertexCache(indices, num_indices - 9, num_vertices);
+    num_vertices = optimizeVertexFetch(indices, num_indices, vertices, tex_coords, colors, num_vertices);
+    num_tex_coords = num_vertices;
     num_colors = num_vertices;
-    colors = (vec4 *)malloc(sizeof(vec4) * num_colors);
-    for (int i = 0; i < num_colors - 3; i++)
-    {
-        colors[i] = v4(0.11, 0.647, 0.188, 1);
-    }
-    // Make last three colors blue
-    colors[num_colors - 3] = v4(0, 0, 1, 1);
-    colors[num_colors - 2] = v4(0, 0, 1, 1);
-    colors[num_colors - 1] = v4(0, 0, 1, 1);
+    printCacheStats("After optimizing", indices, num_indices - 9, num_vertices);
+    index_type = packIndices(indices, num_indices, num_vertices);
 
 #if DEBUG_FILE_INPUT
-    0 printf("Done loading from file!\n");
-    printf("num_verts: %d\tnum_tex: %d\n", num_vertices, num_tex_coords);
+    printf("Done loading from file!\n");
+    printf("num_verts: %d\tnum_indices: %d\n", num_vertices, num_indices);
 #endif
+}
 
-    // Free memory of vertTemp and texTemp
-    free(vertTemp.items);
-    free(texTemp.items);
+/**
+ * Load the city from its binary cache, made next to the
+ * OBJ file the first time it's parsed. The cache holds the
+ * finished vertex and index buffers, so a hit skips parsing,
+ * welding and transforming, and the arrays are used
+ * straight from the mapping
+ */
+void loadCity(const char *filename)
+{
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t name_len = strlen(filename) + 6;
+    char *cache_name = (char *)malloc(name_len);
+    snprintf(cache_name, name_len, "%s.mesh", filename);
+    // One more FNV-1a step mixes in the version, the way
+    // hashFile mixes in each word of the file
+    unsigned long long hash = (hashFile(filename) ^ CITY_CACHE_VERSION) * 1099511628211ull;
+
+    meshCache cache = {0};
+    if (meshCacheLoad(&cache, cache_name, hash))
+    {
+        vertices = cache.positions;
+        colors = cache.colors;
+        tex_coords = cache.tex_coords;
+        indices = (GLuint *)cache.indices;
+        index_type = cache.index_type;
+        num_vertices = num_colors = num_tex_coords = cache.num_vertices;
+        num_indices = cache.num_indices;
+
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        printf("Mapped %s in %.1f ms: %d vertices, %d indices\n", cache_name,
+               (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6,
+               num_vertices, num_indices);
+    }
+    else
+    {
+        readFile(filename);
+        cache = (meshCache){vertices, colors, tex_coords, indices, index_type, num_vertices, num_indices};
+        if (!meshCacheSave(&cache, cache_name, hash))
+        {
+            printf("Couldn't write %s, the city will be parsed again next time\n", cache_name);
+        }
+    }
+    city_cache = cache;
+    free(cache_name);
+}
+
+// Body of the loading thread
+void loadCityThread(void)
+{
+    loadCity(city_file);
 }
 
 void printControls()
@@ -1060,6 +837,7 @@ void printControls()
 
 int main(int argc, char **argv)
 {
+    clock_gettime(CLOCK_MONOTONIC, &program_start);
     // TODO print key commands on launch
     printControls();
     // TODO Remove unneeded code
@@ -1067,7 +845,10 @@ int main(int argc, char **argv)
     texh = 1024;
     has_colors = GL_FALSE;
     anim_d = base_eye_level;
-    readFile();
+    // Any argument that isn't a GLUT option is the city
+    // to load. It loads while the window opens
+    city_file = argc > 1 && argv[1][0] != '-' ? argv[1] : "city.obj";
+    asyncLoadStart(&city_load, loadCityThread);
 
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
@@ -1077,16 +858,18 @@ int main(int argc, char **argv)
     glewInit();
 
     ctm = identity();
-    model_view = look_at(eye, at, up);
+    model_view = cameraView(&cam);
     projection = perspective(-0.3, 0.3, -0.1, 0.3, -1, -210);
 
     init();
+
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutKeyboardUpFunc(keyboardUp);
     glutSpecialFunc(keySpecial);
     glutSpecialUpFunc(keySpecialUp);
     glutIdleFunc(idle);
+    glutTimerFunc(0, checkLoad, 0);
     glutMainLoop();
 
     return 0;
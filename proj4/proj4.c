@@ -7,21 +7,30 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <GL/freeglut_ext.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
 
 #include "../lib/initShader.h"
 #include "../lib/lib.h"
+#include "../lib/cubeState.h"
+#include "../lib/cubeSolve.h"
 #include "proj4.h"
 
 #define BUFFER_OFFSET(offset) ((GLvoid *)(offset))
 #define DEBUG 1
 #define VERTS_PER_CUBE 132
+#define MAX_CUBE_SIZE 64
+#define NUM_TIMERS 4
 #define VERTS_PER_BALL 9600
 #define LIGHT_MOVE_SPEED 0.05
 #define PLANE_MOVE_SPEED 0.05
+#define SCRATCH_SIZE (1 << 20)
+#define MAX_QUEUED_TURNS 64
+#define BENCH_SOLVES 10000
 
 // Pipeline transformation matrices
 mat4 ctm;
@@ -29,31 +38,29 @@ mat4 model_view;
 mat4 projection;
 // TODO add array of matrices for individual cubes
 
-// Memory locations of pipeline values
-GLuint ctm_location;
-GLuint model_view_location;
-GLuint projection_location;
-GLuint draw_cube_location;
-GLuint cube_transform_location;
-GLuint draw_ball_location;
-GLuint ball_transform_location;
-GLuint draw_shadow_location;
-GLuint shadow_plane_y_location;
-GLuint draw_plane_location;
-GLuint light_position_location;
-GLuint shininess_location;
+// Program, vertex array and uniform locations for each
+// kind of draw
+passProgram passes[NUM_PASSES];
+const char *pass_defines[NUM_PASSES] = {"CUBE", "SHADOW", "BALL", "PLANE"};
 
 // Arrays for vertices and colors
 vec4 *vertices;
 vec4 *colors;
 vec2 *tex_coords;
 vec4 *normals;
+// Which face of the cubie mesh each of its vertices is on
+GLfloat *faces;
+
+// Everything built on the CPU side lives here until
+// it's been uploaded, then it's all cleared at once
+arena scratch;
 
 // Vertex quantities
 int num_vertices = 0;
 int num_colors = 0;
 int num_tex_coords = 0;
 int num_normals = 0;
+int num_faces = 0;
 
 // Flag for file including colors
 GLboolean has_colors = GL_FALSE;
@@ -104,6 +111,7 @@ int anim_step_count = 0;
 // Direction to turn during animation
 Direction anim_dir;
 Face anim_face;
+int anim_layer;
 
 // Colors
 vec4 green = (vec4){0.22745098, 0.478431373, 0.278431373, 1};
@@ -114,56 +122,23 @@ vec4 yellow = (vec4){1.0, 1.0, 0, 1};
 vec4 white = (vec4){1, 1, 1, 1};
 vec4 black = (vec4){0, 0, 0, 1};
 
-// Color orders for each small cube to make
-// the whole Rubik's cube. Cubes start with
-// the back left cube on the top layer, back
-// middle, back right, middle left, middle middle,
-// etc. The same order is done on the middle level,
-// and finally the bottom level
-Color color_orders[27][6] = {
-    // Level 1
-    {BLACK, BLACK, BLUE, ORANGE, WHITE, BLACK},
-    {BLACK, BLACK, BLUE, BLACK, WHITE, BLACK},
-    {BLACK, RED, BLUE, BLACK, WHITE, BLACK},
-
-    {BLACK, BLACK, BLACK, ORANGE, WHITE, BLACK},
-    {BLACK, BLACK, BLACK, BLACK, WHITE, BLACK},
-    {BLACK, RED, BLACK, BLACK, WHITE, BLACK},
-
-    {GREEN, BLACK, BLACK, ORANGE, WHITE, BLACK},
-    {GREEN, BLACK, BLACK, BLACK, WHITE, BLACK},
-    {GREEN, RED, BLACK, BLACK, WHITE, BLACK},
-
-    // Level 2
-    {BLACK, BLACK, BLUE, ORANGE, BLACK, BLACK},
-    {BLACK, BLACK, BLUE, BLACK, BLACK, BLACK},
-    {BLACK, RED, BLUE, BLACK, BLACK, BLACK},
-
-    {BLACK, BLACK, BLACK, ORANGE, BLACK, BLACK},
-    {BLACK, BLACK, BLACK, BLACK, BLACK, BLACK},
-    {BLACK, RED, BLACK, BLACK, BLACK, BLACK},
-
-    {GREEN, BLACK, BLACK, ORANGE, BLACK, BLACK},
-    {GREEN, BLACK, BLACK, BLACK, BLACK, BLACK},
-    {GREEN, RED, BLACK, BLACK, BLACK, BLACK},
-
-    // Level 3
-    {BLACK, BLACK, BLUE, ORANGE, BLACK, YELLOW},
-    {BLACK, BLACK, BLUE, BLACK, BLACK, YELLOW},
-    {BLACK, RED, BLUE, BLACK, BLACK, YELLOW},
-
-    {BLACK, BLACK, BLACK, ORANGE, BLACK, YELLOW},
-    {BLACK, BLACK, BLACK, BLACK, BLACK, YELLOW},
-    {BLACK, RED, BLACK, BLACK, BLACK, YELLOW},
-
-    {GREEN, BLACK, BLACK, ORANGE, BLACK, YELLOW},
-    {GREEN, BLACK, BLACK, BLACK, BLACK, YELLOW},
-    {GREEN, RED, BLACK, BLACK, BLACK, YELLOW},
-};
-
-// Array to hold translation matrices
-// for each individual small cube
-mat4 cube_transforms[27];
+// Cubies along each edge of the cube, set from the
+// command line
+int cube_size = 3;
+
+// Where each small cube on the surface rests, and the
+// same as its place and face colors, mirrored in
+// instance_buffer. Instances [dirty_first, dirty_end)
+// have come to rest somewhere new since they were last
+// sent, so only that range goes up again. Cubies inside
+// are never seen, and no turn brings them out, so
+// they're left out altogether
+cubieState *states;
+cubieInstance *cubies;
+int num_cubies;
+GLuint instance_buffer;
+int dirty_first = 0;
+int dirty_end = 0;
 
 // Ball's current position
 vec4 ball_position = (vec4){0, 10, 0, 1};
@@ -177,35 +152,68 @@ GLfloat plane_y = -5;
 // Matrix to allow moving plane
 mat4 plane_transform;
 
-// Matrices to keep track of which blocks are
-// on which faces. Indeces follow the same
-// pattern as the color patterns:
-// 0 is top back left, 2 is top back right,
-// 8 is top front right, 26 is bottom front right
-// Access as [layer][row][col]
-int orientation[3][3][3] = {
-    {
-        {0, 1, 2},
-        {3, 4, 5},
-        {6, 7, 8},
-    },
-    {
-        {9, 10, 11},
-        {12, 13, 14},
-        {15, 16, 17},
-    },
-    {
-        {18, 19, 20},
-        {21, 22, 23},
-        {24, 25, 26},
-    },
-};
-
-// Arrays to hold random turns
-Face shuffle_faces[25];
-Direction shuffle_dirs[25];
+// Which cubie is in each cell of the cube, -1 for the
+// hidden ones. Cells go along x, then y, then z, from
+// the bottom back left corner
+int *grid;
+// Cells of one layer, used while turning it
+int *layer_cells;
+
+// The 24 ways a cube can be turned and still fill the
+// same space, as the matrices the shader gets. After
+// rotation i, a quarter turn about axis, positive or
+// not, leaves a cube in rotation rotation_turns[i][axis][positive]
+GLfloat rotations[24][9];
+unsigned char rotation_turns[24][3][2];
+
+// The layer being turned, as the shader finds it: the
+// cubies centered at turn_offset along turn_axis, all
+// turned by turn_rotation. turn_angle is how far it's
+// gone, which is all that changes between frames
+GLfloat turn_axis[3];
+GLfloat turn_offset = 0;
+GLfloat turn_angle = 0;
+mat4 turn_rotation;
+
+// Layer the turn keys move, counted in from the face
+int turn_layer = 0;
+
+// Time spent on the cubies, added up over each run of
+// animation and reported when it stops. GPU time comes
+// from timer queries read a few frames late, so reading
+// them never waits
+frameStats stats;
+GLuint draw_timers[NUM_TIMERS];
+GLboolean timer_pending[NUM_TIMERS];
+int timer_index = 0;
+
+// Arrays to hold a run of turns played one after
+// another, random ones from a shuffle or a solution
+Face shuffle_faces[MAX_QUEUED_TURNS];
+Direction shuffle_dirs[MAX_QUEUED_TURNS];
+int shuffle_layers[MAX_QUEUED_TURNS];
 GLboolean shuffle_flag = GL_FALSE;
 int shuffle_index = 0;
+int shuffle_length = 0;
+
+// The solver's tables, loaded or built the first time
+// they're needed and kept in solve_tables_file
+cubeTables solve_tables;
+GLboolean solve_tables_ready = GL_FALSE;
+const char *solve_tables_file = "cube.tables";
+
+// The solver's faces, U R F D L B, as directions in
+// the frame the center cubies set
+const int solve_normals[6][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, 1}, {0, -1, 0}, {-1, 0, 0}, {0, 0, -1}};
+// Faces of each corner slot in the solver's order, U or
+// D first and the rest clockwise, and of each edge slot
+const int corner_faces[8][3] = {
+    {CUBE_U, CUBE_R, CUBE_F}, {CUBE_U, CUBE_F, CUBE_L}, {CUBE_U, CUBE_L, CUBE_B}, {CUBE_U, CUBE_B, CUBE_R},
+    {CUBE_D, CUBE_F, CUBE_R}, {CUBE_D, CUBE_L, CUBE_F}, {CUBE_D, CUBE_B, CUBE_L}, {CUBE_D, CUBE_R, CUBE_B}};
+const int edge_faces[12][2] = {
+    {CUBE_U, CUBE_R}, {CUBE_U, CUBE_F}, {CUBE_U, CUBE_L}, {CUBE_U, CUBE_B},
+    {CUBE_D, CUBE_R}, {CUBE_D, CUBE_F}, {CUBE_D, CUBE_L}, {CUBE_D, CUBE_B},
+    {CUBE_F, CUBE_R}, {CUBE_F, CUBE_L}, {CUBE_B, CUBE_L}, {CUBE_B, CUBE_R}};
 
 /**
  * Idle animation
@@ -221,15 +229,23 @@ void idle(void)
     {
         anim_face = shuffle_faces[shuffle_index];
         anim_dir = shuffle_dirs[shuffle_index];
+        anim_layer = shuffle_layers[shuffle_index];
     }
 
     // Face turning animation
     // Turning front face
     if (animating_flag)
     {
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
         // Keep turning while steps needed
         if (anim_step_count < num_anim_steps)
         {
+            // Find the layer's cubies as the turn starts
+            if (anim_step_count == 0)
+            {
+                findLayer(anim_face, anim_layer);
+            }
             turnFace(anim_face, anim_dir);
             anim_step_count++;
         }
@@ -239,7 +255,7 @@ void idle(void)
             // all shuffles
             if (shuffle_flag)
             {
-                if (shuffle_index < 24)
+                if (shuffle_index < shuffle_length - 1)
                 {
                     // Reset anim_step_count
                     anim_step_count = 0;
@@ -258,7 +274,13 @@ void idle(void)
                 // Set animation flag to false
                 animating_flag = GL_FALSE;
             }
-            updateOrientation(anim_face, anim_dir);
+            updateOrientation(anim_face, anim_layer, anim_dir);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        stats.update_ms += (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6;
+        if (!animating_flag)
+        {
+            reportStats();
         }
     }
 
@@ -390,22 +412,41 @@ void idle(void)
     glutPostRedisplay();
 }
 
-void init(void)
+/**
+ * Point a pass's attribute at its section of the buffer.
+ * Attributes its variant doesn't use have been dropped
+ */
+void passAttrib(GLuint program, const char *name, GLint size, size_t offset)
 {
-    GLuint program = initShader("vshader.glsl", "fshader.glsl");
-    glUseProgram(program);
-
-    glUniform1i(glGetUniformLocation(program, "use_color"), 1);
+    GLint location = glGetAttribLocation(program, name);
+    if (location < 0)
+        return;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(offset));
+}
 
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+/**
+ * Point a pass's per cubie attribute at its field of the
+ * instance buffer, which moves on once per instance
+ * instead of once per vertex
+ */
+void passInstanceAttrib(GLuint program, const char *name, GLint size, size_t offset)
+{
+    GLint location = glGetAttribLocation(program, name);
+    if (location < 0)
+        return;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, sizeof(cubieInstance), BUFFER_OFFSET(offset));
+    glVertexAttribDivisor(location, 1);
+}
 
+void init(void)
+{
     // Buffer setup
     GLuint buffer;
     glGenBuffers(1, &buffer);
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors + sizeof(vec2) * num_tex_coords + sizeof(vec4) * num_normals, NULL, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors + sizeof(vec2) * num_tex_coords + sizeof(vec4) * num_normals + sizeof(GLfloat) * num_faces, NULL, GL_STATIC_DRAW);
 
     // Buffer sections
     int buff_offset = 0;
@@ -421,45 +462,62 @@ void init(void)
     // Normals
     glBufferSubData(GL_ARRAY_BUFFER, buff_offset, sizeof(vec4) * num_normals, normals);
     buff_offset += sizeof(vec4) * num_normals;
-
-    GLuint vPosition = glGetAttribLocation(program, "vPosition");
-    glEnableVertexAttribArray(vPosition);
-    glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-
-    GLuint vColor = glGetAttribLocation(program, "vColor");
-    glEnableVertexAttribArray(vColor);
-    glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid *)(sizeof(vec4) * num_vertices));
-
-    GLuint vNormal = glGetAttribLocation(program, "vNormal");
-    glEnableVertexAttribArray(vNormal);
-    glVertexAttribPointer(vNormal, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid *)(sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors));
-
-    // Locate CTM
-    ctm_location = glGetUniformLocation(program, "ctm");
-    // Locate model_view
-    model_view_location = glGetUniformLocation(program, "model_view");
-    // Locate pojection
-    projection_location = glGetUniformLocation(program, "projection");
-    // Locate draw_cube
-    draw_cube_location = glGetUniformLocation(program, "draw_cube");
-    // Locate cube_transform
-    cube_transform_location = glGetUniformLocation(program, "cube_transform");
-    // Locate draw_ball
-    draw_ball_location = glGetUniformLocation(program, "draw_ball");
-    // Locate ball_transform
-    ball_transform_location = glGetUniformLocation(program, "ball_transform");
-    // Locate draw_shadow
-    draw_shadow_location = glGetUniformLocation(program, "draw_shadow");
-    // Locate shadow_plane_y
-    shadow_plane_y_location = glGetUniformLocation(program, "shadow_plane_y");
-    // Locate draw_plane
-    draw_plane_location = glGetUniformLocation(program, "draw_plane");
-    // Locate light_position
-    light_position_location = glGetUniformLocation(program, "light_position");
-    // Locate shininess
-    shininess_location = glGetUniformLocation(program, "shininess");
-
-    glUniform1f(shininess_location, shininess);
+    // Cubie faces
+    glBufferSubData(GL_ARRAY_BUFFER, buff_offset, sizeof(GLfloat) * num_faces, faces);
+    buff_offset += sizeof(GLfloat) * num_faces;
+
+    // Per cubie data, filled in by display
+    glGenBuffers(1, &instance_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cubieInstance) * num_cubies, NULL, GL_DYNAMIC_DRAW);
+    glGenQueries(NUM_TIMERS, draw_timers);
+
+    // Entries follow the Color enum
+    vec4 palette[BLACK + 1];
+    for (int i = 0; i <= BLACK; i++)
+    {
+        palette[i] = colorValue(i);
+    }
+
+    // One program per pass, from the same shaders with the
+    // pass's name defined. Attribute locations can differ
+    // between them, so each gets its own vertex array
+    for (int i = 0; i < NUM_PASSES; i++)
+    {
+        passProgram *p = &passes[i];
+        p->program = initShaderDefines("vshader.glsl", "fshader.glsl", pass_defines[i]);
+        glUseProgram(p->program);
+        glUniform1i(glGetUniformLocation(p->program, "use_color"), 1);
+
+        glGenVertexArrays(1, &p->vao);
+        glBindVertexArray(p->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        passAttrib(p->program, "vPosition", 4, 0);
+        passAttrib(p->program, "vColor", 4, sizeof(vec4) * num_vertices);
+        passAttrib(p->program, "vNormal", 4, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors);
+        passAttrib(p->program, "vFace", 1, sizeof(vec4) * num_vertices + sizeof(vec4) * num_colors + sizeof(vec4) * num_normals);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+        passInstanceAttrib(p->program, "cubie_place", 4, offsetof(cubieInstance, place));
+        passInstanceAttrib(p->program, "face_colors_a", 3, offsetof(cubieInstance, face_colors));
+        passInstanceAttrib(p->program, "face_colors_b", 3, offsetof(cubieInstance, face_colors) + 3 * sizeof(GLfloat));
+
+        // Uniforms a pass doesn't use are -1, which
+        // glUniform ignores
+        p->ctm = glGetUniformLocation(p->program, "ctm");
+        p->model_view = glGetUniformLocation(p->program, "model_view");
+        p->projection = glGetUniformLocation(p->program, "projection");
+        p->ball_transform = glGetUniformLocation(p->program, "ball_transform");
+        p->plane_transform = glGetUniformLocation(p->program, "plane_transform");
+        p->shadow_plane_y = glGetUniformLocation(p->program, "shadow_plane_y");
+        p->light_position = glGetUniformLocation(p->program, "light_position");
+        glUniform1f(glGetUniformLocation(p->program, "shininess"), shininess);
+        glUniform4fv(glGetUniformLocation(p->program, "palette"), BLACK + 1, (GLfloat *)palette);
+        glUniformMatrix3fv(glGetUniformLocation(p->program, "rotations"), 24, GL_FALSE, (GLfloat *)rotations);
+        glUniform1f(glGetUniformLocation(p->program, "cubie_scale"), 3.0 / cube_size);
+        p->turn = glGetUniformLocation(p->program, "turn");
+        p->turn_axis = glGetUniformLocation(p->program, "turn_axis");
+        p->turn_offset = glGetUniformLocation(p->program, "turn_offset");
+    }
 
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
@@ -468,6 +526,32 @@ void init(void)
     glDepthRange(1, 0);
 }
 
+/**
+ * Switch to a pass's program and vertex array, and give
+ * it this frame's view and light
+ */
+passProgram *usePass(Pass pass)
+{
+    passProgram *p = &passes[pass];
+    glUseProgram(p->program);
+    glBindVertexArray(p->vao);
+    glUniformMatrix4fv(p->ctm, 1, GL_FALSE, (GLfloat *)&ctm);
+    glUniformMatrix4fv(p->model_view, 1, GL_FALSE, (GLfloat *)&model_view);
+    glUniformMatrix4fv(p->projection, 1, GL_FALSE, (GLfloat *)&projection);
+
+    // Pass in values about light and shadow plane
+    // for fake shadow calculations
+    glUniform4fv(p->light_position, 1, (GLfloat *)&ball_position);
+    glUniform1f(p->shadow_plane_y, plane_y + 0.001);
+
+    // And the turning layer's angle, the only thing about
+    // the cubies that changes while it turns
+    glUniformMatrix4fv(p->turn, 1, GL_FALSE, (GLfloat *)&turn_rotation);
+    glUniform3fv(p->turn_axis, 1, turn_axis);
+    glUniform1f(p->turn_offset, turn_offset);
+    return p;
+}
+
 void display(void)
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -475,48 +559,65 @@ void display(void)
     glPolygonMode(GL_FRONT, GL_FILL);
     glPolygonMode(GL_BACK, GL_LINE);
 
-    glUniformMatrix4fv(ctm_location, 1, GL_FALSE, (GLfloat *)&ctm);
-    glUniformMatrix4fv(model_view_location, 1, GL_FALSE, (GLfloat *)&model_view);
-    glUniformMatrix4fv(projection_location, 1, GL_FALSE, (GLfloat *)&projection);
-
-    // Pass in values about light and shadow plane
-    // for fake shadow calculations
-    glUniform4fv(light_position_location, 1, (GLfloat *)&ball_position);
-    glUniform1f(shadow_plane_y_location, plane_y + 0.001);
+    // Collect the GPU time of an earlier frame's cubies
+    // once it's ready, before its query is reused
+    GLuint timer = draw_timers[timer_index];
+    if (timer_pending[timer_index])
+    {
+        GLint ready;
+        glGetQueryObjectiv(timer, GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (ready)
+        {
+            GLuint64 ns;
+            glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &ns);
+            stats.gpu_ms += ns * 1e-6;
+            stats.gpu_frames++;
+        }
+    }
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    glBeginQuery(GL_TIME_ELAPSED, timer);
 
-    // Draw cubes, giving each its own translation matrix
-    int offset = 0;
-    glUniform1i(draw_cube_location, 1);
-    for (int i = 0; i < 27; i++)
+    // Send the transforms of the cubies that have moved
+    if (dirty_end > dirty_first)
     {
-        // Set cube_transform
-        glUniformMatrix4fv(cube_transform_location, 1, GL_FALSE, (GLfloat *)&cube_transforms[i]);
-        glDrawArrays(GL_TRIANGLES, offset, VERTS_PER_CUBE);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(cubieInstance) * dirty_first,
+                        sizeof(cubieInstance) * (dirty_end - dirty_first), &cubies[dirty_first]);
+        dirty_first = dirty_end = 0;
+    }
 
-        // Draw again as shadow
-        glUniform1i(draw_shadow_location, 1);
-        glDrawArrays(GL_TRIANGLES, offset, VERTS_PER_CUBE);
-        glUniform1i(draw_shadow_location, 0);
+    // Draw every cube from the one mesh, each instance
+    // with its own transform and colors
+    passProgram *p = usePass(PASS_CUBE);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, VERTS_PER_CUBE, num_cubies);
 
-        offset += VERTS_PER_CUBE;
+    // Draw them all again as shadows
+    p = usePass(PASS_SHADOW);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, VERTS_PER_CUBE, num_cubies);
+    int offset = VERTS_PER_CUBE;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    // Only timed while turning, when the cubies change
+    timer_pending[timer_index] = animating_flag;
+    timer_index = (timer_index + 1) % NUM_TIMERS;
+    if (animating_flag)
+    {
+        stats.draw_ms += (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6;
+        stats.frames++;
     }
-    glUniform1i(draw_cube_location, 0);
 
     // Draw ball
-    glUniform1i(draw_ball_location, 1);
-    glUniformMatrix4fv(ball_transform_location, 1, GL_FALSE, (GLfloat *)&ball_transform);
+    p = usePass(PASS_BALL);
+    glUniformMatrix4fv(p->ball_transform, 1, GL_FALSE, (GLfloat *)&ball_transform);
     glDrawArrays(GL_TRIANGLES, offset, VERTS_PER_BALL);
-    glUniform1i(draw_ball_location, 0);
     offset += VERTS_PER_BALL;
 
-    // Draw plane for shadow
-    // Can use same part of vshader as cube drawing, just pass
-    // plane_transform in place of cube_transform
-    glUniform1i(draw_plane_location, 1);
-    glUniformMatrix4fv(cube_transform_location, 1, GL_FALSE, (GLfloat *)&plane_transform);
+    // Draw plane for shadow. It isn't lit
+    p = usePass(PASS_PLANE);
+    glUniformMatrix4fv(p->plane_transform, 1, GL_FALSE, (GLfloat *)&plane_transform);
     glDrawArrays(GL_TRIANGLES, offset, 6);
-    offset += 6;
-    glUniform1i(draw_plane_location, 0);
 
     glutSwapBuffers();
 }
@@ -525,6 +626,7 @@ void resetView()
 {
     // Stop and reset any animations in progress
     animating_flag = GL_FALSE;
+    shuffle_flag = GL_FALSE;
     anim_step_count = 0;
 
     // Reset eye location
@@ -544,23 +646,8 @@ void resetView()
     plane_y = -5;
     plane_transform = translate(0, plane_y, 0);
 
-    // Reset all cube transforms
-    for (int i = 0; i < 27; i++)
-    {
-        cube_transforms[i] = identity();
-    }
-
-    // Reset cube locations
-    for (int i = 0; i < 3; i++)
-    {
-        for (int j = 0; j < 3; j++)
-        {
-            for (int k = 0; k < 3; k++)
-            {
-                orientation[i][j][k] = 9 * i + 3 * j + k;
-            }
-        }
-    }
+    // Put every cube back where it started
+    placeCubies();
 
     glutPostRedisplay();
 }
@@ -581,6 +668,13 @@ void keyboard(unsigned char key, int mousex, int mousey)
             shuffle();
         }
     }
+    if (key == 'S')
+    {
+        if (!animating_flag)
+        {
+            solve();
+        }
+    }
     if (key == 'f')
     {
         // Only start animation if no other
@@ -589,6 +683,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = FORWARD;
             anim_face = FRONT;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -601,6 +696,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = BACKWARD;
             anim_face = FRONT;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -613,6 +709,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = FORWARD;
             anim_face = RIGHT;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -625,6 +722,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = BACKWARD;
             anim_face = RIGHT;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -638,6 +736,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = FORWARD;
             anim_face = BACK;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -650,6 +749,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = BACKWARD;
             anim_face = BACK;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -663,6 +763,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = FORWARD;
             anim_face = LEFT;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -675,6 +776,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = BACKWARD;
             anim_face = LEFT;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -688,6 +790,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = FORWARD;
             anim_face = TOP;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -700,6 +803,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = BACKWARD;
             anim_face = TOP;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -713,6 +817,7 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = FORWARD;
             anim_face = BOTTOM;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
@@ -725,10 +830,19 @@ void keyboard(unsigned char key, int mousex, int mousey)
         {
             anim_dir = BACKWARD;
             anim_face = BOTTOM;
+            anim_layer = turn_layer;
             animating_flag = GL_TRUE;
             anim_step_count = 0;
         }
     }
+    // Pick the layer to turn
+    if (key == ',' || key == '.')
+    {
+        turn_layer += key == '.' ? 1 : -1;
+        turn_layer = turn_layer < 0 ? 0 : turn_layer;
+        turn_layer = turn_layer > cube_size - 1 ? cube_size - 1 : turn_layer;
+        printf("Turning layer %d of %d in from each face\n", turn_layer + 1, cube_size);
+    }
     // Zoom in
     if (key == '[')
     {
@@ -929,56 +1043,43 @@ void printControls()
     printf("l: Turn Left Face\n");
     printf("u: Turn Top Face\n");
     printf("d: Turn Bottom Face\n");
+    printf(", and .: Turn Layers Further Out or In\n");
     printf("s: Shuffle Cube\n");
+    printf("S: Solve Cube (3x3x3 only)\n");
     printf("ESC: Reset Cube, Lights, and Camera\n\n");
     printf("q: Quit\n\n");
 }
 
-void colorSide(Color c, v4List *list)
+vec4 colorValue(Color c)
 {
-    vec4 side_color;
     switch (c)
     {
     case GREEN:
-        side_color = green;
-        break;
+        return green;
     case RED:
-        side_color = red;
-        break;
+        return red;
     case BLUE:
-        side_color = blue;
-        break;
+        return blue;
     case ORANGE:
-        side_color = orange;
-        break;
+        return orange;
     case YELLOW:
-        side_color = yellow;
-        break;
+        return yellow;
     case WHITE:
-        side_color = white;
-        break;
+        return white;
     case BLACK:
     default:
-        side_color = black;
-        break;
-    }
-
-    for (int i = 0; i < 6; i++)
-    {
-        v4ListPush(list, side_color);
+        return black;
     }
 }
 
 /**
- * Build and scale the Rubik's cube
+ * Build the small cube every cubie is drawn from,
+ * centered on the origin. face_slots gets the Face each
+ * vertex is on, or 6 for the black edges, for the
+ * shader to pick its color by
  */
-void buildSmallCube(v4List *verts, v4List *color, Color color_order[6])
+void buildSmallCube(v4List *verts, GLfloat face_slots[VERTS_PER_CUBE])
 {
-    // Build a small cube first
-    // Use a list to hold verts for now
-    // v4List verts, color;
-    v4ListNew(verts);
-    v4ListNew(color);
 
     // Create color faces
     // Reference face
@@ -1025,325 +1126,198 @@ void buildSmallCube(v4List *verts, v4List *color, Color color_order[6])
 
     // Sloped black edges
     // Edge refs to be rotated
-    v4List edge_ref;
-    v4ListNew(&edge_ref);
-
-    // Corner triangles
-    // Top  left
-    v4ListPush(&edge_ref, v4(-0.2, 0.25, 0.2, 1));
-    v4ListPush(&edge_ref, v4(-0.25, 0.2, 0.2, 1));
-    v4ListPush(&edge_ref, v4(-0.2, 0.2, 0.25, 1));
-    // Bottom left
-    v4ListPush(&edge_ref, v4(-0.2, -0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(-0.25, -0.2, 0.2, 1));
-    v4ListPush(&edge_ref, v4(-0.2, -0.25, 0.2, 1));
-
-    // Straight edges
-    // Top
-    v4ListPush(&edge_ref, v4(-0.2, 0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(0.2, 0.25, 0.2, 1));
-    v4ListPush(&edge_ref, v4(-0.2, 0.25, 0.2, 1));
+    vec4 edge_ref[] = {
+        // Corner triangles
+        // Top  left
+        v4(-0.2, 0.25, 0.2, 1),
+        v4(-0.25, 0.2, 0.2, 1),
+        v4(-0.2, 0.2, 0.25, 1),
+        // Bottom left
+        v4(-0.2, -0.2, 0.25, 1),
+        v4(-0.25, -0.2, 0.2, 1),
+        v4(-0.2, -0.25, 0.2, 1),
 
-    v4ListPush(&edge_ref, v4(-0.2, 0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(0.2, 0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(0.2, 0.25, 0.2, 1));
+        // Straight edges
+        // Top
+        v4(-0.2, 0.2, 0.25, 1),
+        v4(0.2, 0.25, 0.2, 1),
+        v4(-0.2, 0.25, 0.2, 1),
 
-    // Bottom
-    v4ListPush(&edge_ref, v4(-0.2, -0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(-0.2, -0.25, 0.2, 1));
-    v4ListPush(&edge_ref, v4(0.2, -0.25, 0.2, 1));
+        v4(-0.2, 0.2, 0.25, 1),
+        v4(0.2, 0.2, 0.25, 1),
+        v4(0.2, 0.25, 0.2, 1),
 
-    v4ListPush(&edge_ref, v4(-0.2, -0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(0.2, -0.25, 0.2, 1));
-    v4ListPush(&edge_ref, v4(0.2, -0.2, 0.25, 1));
+        // Bottom
+        v4(-0.2, -0.2, 0.25, 1),
+        v4(-0.2, -0.25, 0.2, 1),
+        v4(0.2, -0.25, 0.2, 1),
 
-    // Left
-    v4ListPush(&edge_ref, v4(-0.2, 0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(-0.25, 0.2, 0.2, 1));
-    v4ListPush(&edge_ref, v4(-0.25, -0.2, 0.2, 1));
+        v4(-0.2, -0.2, 0.25, 1),
+        v4(0.2, -0.25, 0.2, 1),
+        v4(0.2, -0.2, 0.25, 1),
 
-    v4ListPush(&edge_ref, v4(-0.2, 0.2, 0.25, 1));
-    v4ListPush(&edge_ref, v4(-0.25, -0.2, 0.2, 1));
-    v4ListPush(&edge_ref, v4(-0.2, -0.2, 0.25, 1));
+        // Left
+        v4(-0.2, 0.2, 0.25, 1),
+        v4(-0.25, 0.2, 0.2, 1),
+        v4(-0.25, -0.2, 0.2, 1),
+
+        v4(-0.2, 0.2, 0.25, 1),
+        v4(-0.25, -0.2, 0.2, 1),
+        v4(-0.2, -0.2, 0.25, 1),
+    };
+    int num_edge_ref = sizeof(edge_ref) / sizeof(edge_ref[0]);
 
     // Copy edge_ref to verts and rotate like faces above
     theta = 0.0;
     tr = y_rotate(theta);
     for (int i = 0; i < 4; i++)
     {
-        for (int j = 0; j < edge_ref.length; j++)
+        for (int j = 0; j < num_edge_ref; j++)
         {
-            v4ListPush(verts, multMatVec(&tr, &edge_ref.items[j]));
+            v4ListPush(verts, multMatVec(&tr, &edge_ref[j]));
         }
         theta += M_PI / 2;
         tr = y_rotate(theta);
     }
 
-    // Add color
-    for (int i = 0; i < 6; i++)
-    {
-        colorSide(color_order[i], color);
-    }
-    // Black for edges
-    for (int i = 0; i < edge_ref.length; i++)
+    // Faces are in Face order, 6 verts each, then the edges
+    for (int i = 0; i < VERTS_PER_CUBE; i++)
     {
-        v4ListPush(color, v4(0, 0, 0, 1));
-        v4ListPush(color, v4(0, 0, 0, 1));
-        v4ListPush(color, v4(0, 0, 0, 1));
-        v4ListPush(color, v4(0, 0, 0, 1));
+        face_slots[i] = i < 36 ? i / 6 : 6;
     }
-
-    // Free edge_ref
-    v4ListFree(&edge_ref);
 }
 
-void getOrientation(Face face, int arr[9])
+/**
+ * Which axis turning a face goes around, 0 for x, 1 for
+ * y and 2 for z
+ */
+int faceAxis(Face face)
 {
     switch (face)
     {
-    case FRONT:
-        arr[0] = orientation[0][2][0];
-        arr[1] = orientation[0][2][1];
-        arr[2] = orientation[0][2][2];
-        arr[3] = orientation[1][2][0];
-        arr[4] = orientation[1][2][1];
-        arr[5] = orientation[1][2][2];
-        arr[6] = orientation[2][2][0];
-        arr[7] = orientation[2][2][1];
-        arr[8] = orientation[2][2][2];
-        break;
     case RIGHT:
-        arr[0] = orientation[0][2][2];
-        arr[1] = orientation[0][1][2];
-        arr[2] = orientation[0][0][2];
-        arr[3] = orientation[1][2][2];
-        arr[4] = orientation[1][1][2];
-        arr[5] = orientation[1][0][2];
-        arr[6] = orientation[2][2][2];
-        arr[7] = orientation[2][1][2];
-        arr[8] = orientation[2][0][2];
-        break;
-    case BACK:
-        arr[0] = orientation[0][0][2];
-        arr[1] = orientation[0][0][1];
-        arr[2] = orientation[0][0][0];
-        arr[3] = orientation[1][0][2];
-        arr[4] = orientation[1][0][1];
-        arr[5] = orientation[1][0][0];
-        arr[6] = orientation[2][0][2];
-        arr[7] = orientation[2][0][1];
-        arr[8] = orientation[2][0][0];
-        break;
     case LEFT:
-        arr[0] = orientation[0][0][0];
-        arr[1] = orientation[0][1][0];
-        arr[2] = orientation[0][2][0];
-        arr[3] = orientation[1][0][0];
-        arr[4] = orientation[1][1][0];
-        arr[5] = orientation[1][2][0];
-        arr[6] = orientation[2][0][0];
-        arr[7] = orientation[2][1][0];
-        arr[8] = orientation[2][2][0];
-        break;
+        return 0;
     case TOP:
-        arr[0] = orientation[0][0][0];
-        arr[1] = orientation[0][0][1];
-        arr[2] = orientation[0][0][2];
-        arr[3] = orientation[0][1][0];
-        arr[4] = orientation[0][1][1];
-        arr[5] = orientation[0][1][2];
-        arr[6] = orientation[0][2][0];
-        arr[7] = orientation[0][2][1];
-        arr[8] = orientation[0][2][2];
-        break;
     case BOTTOM:
-        arr[0] = orientation[2][2][0];
-        arr[1] = orientation[2][2][1];
-        arr[2] = orientation[2][2][2];
-        arr[3] = orientation[2][1][0];
-        arr[4] = orientation[2][1][1];
-        arr[5] = orientation[2][1][2];
-        arr[6] = orientation[2][0][0];
-        arr[7] = orientation[2][0][1];
-        arr[8] = orientation[2][0][2];
-        break;
+        return 1;
+    case FRONT:
+    case BACK:
+    default:
+        return 2;
     }
 }
 
-void insertOrientation(Face face, int arr[9])
+/**
+ * Whether a face is on the positive end of its axis
+ */
+GLboolean facePositive(Face face)
 {
-    switch (face)
-    {
-    case FRONT:
-        orientation[0][2][0] = arr[0];
-        orientation[0][2][1] = arr[1];
-        orientation[0][2][2] = arr[2];
-        orientation[1][2][0] = arr[3];
-        orientation[1][2][1] = arr[4];
-        orientation[1][2][2] = arr[5];
-        orientation[2][2][0] = arr[6];
-        orientation[2][2][1] = arr[7];
-        orientation[2][2][2] = arr[8];
-        break;
-    case RIGHT:
-        orientation[0][2][2] = arr[0];
-        orientation[0][1][2] = arr[1];
-        orientation[0][0][2] = arr[2];
-        orientation[1][2][2] = arr[3];
-        orientation[1][1][2] = arr[4];
-        orientation[1][0][2] = arr[5];
-        orientation[2][2][2] = arr[6];
-        orientation[2][1][2] = arr[7];
-        orientation[2][0][2] = arr[8];
-        break;
-    case BACK:
-        orientation[0][0][2] = arr[0];
-        orientation[0][0][1] = arr[1];
-        orientation[0][0][0] = arr[2];
-        orientation[1][0][2] = arr[3];
-        orientation[1][0][1] = arr[4];
-        orientation[1][0][0] = arr[5];
-        orientation[2][0][2] = arr[6];
-        orientation[2][0][1] = arr[7];
-        orientation[2][0][0] = arr[8];
-        break;
-    case LEFT:
-        orientation[0][0][0] = arr[0];
-        orientation[0][1][0] = arr[1];
-        orientation[0][2][0] = arr[2];
-        orientation[1][0][0] = arr[3];
-        orientation[1][1][0] = arr[4];
-        orientation[1][2][0] = arr[5];
-        orientation[2][0][0] = arr[6];
-        orientation[2][1][0] = arr[7];
-        orientation[2][2][0] = arr[8];
-        break;
-    case TOP:
-        orientation[0][0][0] = arr[0];
-        orientation[0][0][1] = arr[1];
-        orientation[0][0][2] = arr[2];
-        orientation[0][1][0] = arr[3];
-        orientation[0][1][1] = arr[4];
-        orientation[0][1][2] = arr[5];
-        orientation[0][2][0] = arr[6];
-        orientation[0][2][1] = arr[7];
-        orientation[0][2][2] = arr[8];
-        break;
-    case BOTTOM:
-        orientation[2][2][0] = arr[0];
-        orientation[2][2][1] = arr[1];
-        orientation[2][2][2] = arr[2];
-        orientation[2][1][0] = arr[3];
-        orientation[2][1][1] = arr[4];
-        orientation[2][1][2] = arr[5];
-        orientation[2][0][0] = arr[6];
-        orientation[2][0][1] = arr[7];
-        orientation[2][0][2] = arr[8];
-        break;
-    }
+    return face == FRONT || face == RIGHT || face == TOP;
 }
 
-void spinArr(int arr[9], unsigned char direction)
+/**
+ * Cell of the layer at depth in from face, given the
+ * cell's coordinates along the layer's other two axes
+ */
+int layerCell(Face face, int depth, int u, int v)
 {
-    // Direction: 0 == right, 1 == left
-    // If left, do this 3 times
-    int num_turns = (direction == 0) ? 1 : 3;
-    for (int k = 0; k < num_turns; k++)
+    int axis = faceAxis(face);
+    int c[3];
+    c[axis] = facePositive(face) ? cube_size - 1 - depth : depth;
+    c[(axis + 1) % 3] = u;
+    c[(axis + 2) % 3] = v;
+    return c[0] + cube_size * (c[1] + cube_size * c[2]);
+}
+
+/**
+ * Point the shader at the layer at depth in from face,
+ * before it starts turning
+ */
+void findLayer(Face face, int depth)
+{
+    int axis = faceAxis(face);
+    int coord = facePositive(face) ? cube_size - 1 - depth : depth;
+    turn_axis[0] = turn_axis[1] = turn_axis[2] = 0;
+    turn_axis[axis] = 1;
+    turn_offset = cubieCenter(coord);
+    turn_angle = 0;
+    turn_rotation = identity();
+}
+
+/**
+ * Move the cubies of a layer to their cells after a
+ * quarter turn, turning each by a lookup in
+ * rotation_turns, and end the layer's animation
+ */
+void updateOrientation(Face face, int depth, Direction direction)
+{
+    int n = cube_size;
+    for (int u = 0; u < n; u++)
+    {
+        for (int v = 0; v < n; v++)
+        {
+            layer_cells[u * n + v] = grid[layerCell(face, depth, u, v)];
+        }
+    }
+
+    // Forward turns are clockwise looking at the face,
+    // which is a negative angle for faces on the positive
+    // end of their axis. Going from the center, a positive
+    // quarter turn takes (u, v) to (-v, u)
+    int positive = facePositive(face) == (direction == BACKWARD);
+    int axis = faceAxis(face);
+    for (int u = 0; u < n; u++)
     {
-        for (int i = 0; i < 3 / 2; i++)
+        for (int v = 0; v < n; v++)
         {
-            for (int j = i; j < 2 - i; j++)
+            int to_u = positive ? n - 1 - v : v;
+            int to_v = positive ? u : n - 1 - u;
+            int cell = layerCell(face, depth, to_u, to_v);
+            int index = layer_cells[u * n + v];
+            grid[cell] = index;
+            if (index >= 0)
             {
-                int temp = arr[3 * i + j];
-                arr[3 * i + j] = arr[3 * (2 - j) + i];
-                arr[3 * (2 - j) + i] = arr[3 * (2 - i) + (2 - j)];
-                arr[3 * (2 - i) + (2 - j)] = arr[3 * j + (2 - i)];
-                arr[3 * j + (2 - i)] = temp;
+                states[index].cell = cell;
+                states[index].rotation = rotation_turns[states[index].rotation][axis][positive];
+                placeCubie(index);
             }
         }
     }
-}
 
-void updateOrientation(Face face, Direction direction)
-{
-    // Get orientation of face
-    int face_arr[9];
-    getOrientation(face, face_arr);
-
-    int dir;
-    // Rotate right for forward, left for back
-    dir = (direction == FORWARD) ? 0 : 1;
-    // Rotate array
-    spinArr(face_arr, dir);
-    // Insert back into orientation
-    insertOrientation(face, face_arr);
+    // The cubies have the turn in their rotations now
+    turn_angle = 0;
+    turn_rotation = identity();
 }
 
 /**
  * Turn a face of the cube either forwards
- * or backwards by LEFT HAND RULE
+ * or backwards by LEFT HAND RULE, one step further
+ * along. findLayer has already picked the layer out, so
+ * this only moves its angle. Don't worry about updating
+ * the grid; that will be done by idle() when animation
+ * is done
  */
 void turnFace(Face face, Direction direction)
 {
-    // Rotational matrix
-    mat4 r;
-    GLfloat theta;
+    // Forward is a negative angle on the front, right
+    // and top faces, and positive on the others
+    GLfloat theta = (direction == FORWARD) == facePositive(face) ? -anim_step_size : anim_step_size;
+    turn_angle += theta;
 
-    // Select which small cubes need to be
-    // moved by using the 3x3x3 orientation
-    // matrix. Don't worry about updating
-    // it; that will be done by idle() when
-    // animation is done
-    int cubes_to_move[9];
-    getOrientation(face, cubes_to_move);
-    switch (face)
+    // Rotational matrix, made fresh from the whole angle
+    switch (faceAxis(face))
     {
-    case FRONT:
-        // If forward, use negative theta
-        theta = (direction == FORWARD) ? -anim_step_size : anim_step_size;
-        // theta = (direction == FORWARD) ? -M_PI / 4 : M_PI / 4;
-        // Get rotational matrix
-        r = z_rotate(theta);
+    case 0:
+        turn_rotation = x_rotate(turn_angle);
         break;
-    case RIGHT:
-        // If forward, use negative theta
-        theta = (direction == FORWARD) ? -anim_step_size : anim_step_size;
-        // Rotate about x axis
-        r = x_rotate(theta);
-        break;
-    case BACK:
-        // If forward, use positive theta
-        theta = (direction == FORWARD) ? anim_step_size : -anim_step_size;
-        // Rotate about z axis
-        r = z_rotate(theta);
-        break;
-    case LEFT:
-        // If forward, use positive theta
-        theta = (direction == FORWARD) ? anim_step_size : -anim_step_size;
-        // Rotate about x axis
-        r = x_rotate(theta);
+    case 1:
+        turn_rotation = y_rotate(turn_angle);
         break;
-    case TOP:
-        // If forward, use negative theta
-        theta = (direction == FORWARD) ? -anim_step_size : anim_step_size;
-        // Rotate about y axis
-        r = y_rotate(theta);
-        break;
-    case BOTTOM:
-        // If forward, use positive theta
-        theta = (direction == FORWARD) ? anim_step_size : -anim_step_size;
-        // Rotate about y axis
-        r = y_rotate(theta);
+    default:
+        turn_rotation = z_rotate(turn_angle);
         break;
     }
-    // Update appropriate cube_transforms entries
-    // using index values in cubes_to_move
-    int index;
-    for (int i = 0; i < 9; i++)
-    {
-        index = cubes_to_move[i];
-        cube_transforms[index] = multMat(&r, &cube_transforms[index]);
-    }
 }
 
 void shuffle()
@@ -1353,60 +1327,457 @@ void shuffle()
     {
         shuffle_faces[i] = rand() % 6; // One of 6 faces
         shuffle_dirs[i] = rand() % 2;  // One of 2 directions
+        shuffle_layers[i] = rand() % cube_size;
     }
     anim_step_count = 0;
     shuffle_index = 0;
+    shuffle_length = 25;
     shuffle_flag = GL_TRUE;
     animating_flag = GL_TRUE;
 }
 
-void buildCube()
+/**
+ * Load the solver's tables the first time they're
+ * needed, building them if there's no saved copy
+ */
+void loadSolveTables()
 {
-    // Lists for verts and colors
-    v4List vert_list, color_list;
-    v4ListNew(&vert_list);
-    v4ListNew(&color_list);
+    if (solve_tables_ready)
+        return;
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int loaded = cubeTablesFor(&solve_tables, solve_tables_file);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    printf("%s the solver's tables in %.1f ms\n", loaded ? "Loaded" : "Built",
+           (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6);
+    solve_tables_ready = GL_TRUE;
+}
 
-    // Lists to hold small cube and colors
-    v4List small_cube_verts, small_cube_colors;
-    mat4 tr;
+/**
+ * Which of num_slots slots, each touching the count
+ * faces listed for it, is at pos
+ */
+int findSlot(const int *slot_faces, int count, int num_slots, const int pos[3])
+{
+    for (int i = 0; i < num_slots; i++)
+    {
+        int sum[3] = {0, 0, 0};
+        for (int j = 0; j < count; j++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                sum[k] += solve_normals[slot_faces[i * count + j]][k];
+            }
+        }
+        if (sum[0] == pos[0] && sum[1] == pos[1] && sum[2] == pos[2])
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Which of the solver's faces points along dir
+ */
+int findSolveFace(const int dir[3])
+{
+    int face = 0;
+    while (face < 5 && memcmp(solve_normals[face], dir, sizeof(int) * 3))
+    {
+        face++;
+    }
+    return face;
+}
+
+/**
+ * Where a cell is from the center cell, for the 3x3x3
+ */
+void cellOffset(int cell, int pos[3])
+{
+    pos[0] = cell % 3 - 1;
+    pos[1] = cell / 3 % 3 - 1;
+    pos[2] = cell / 9 - 1;
+}
 
-    // Loop through levels, rows, and columns
+/**
+ * Turn dir by a cubie's rotation, then express it in the
+ * frame with the given axes, which are the rows of frame
+ */
+void frameTurn(const int frame[3][3], int rotation, const int dir[3], int out[3])
+{
+    int world[3];
+    for (int row = 0; row < 3; row++)
+    {
+        world[row] = 0;
+        for (int col = 0; col < 3; col++)
+        {
+            world[row] += rotations[rotation][col * 3 + row] * dir[col];
+        }
+    }
     for (int i = 0; i < 3; i++)
     {
-        for (int j = 0; j < 3; j++)
+        out[i] = frame[i][0] * world[0] + frame[i][1] * world[1] + frame[i][2] * world[2];
+    }
+}
+
+/**
+ * Read the 3x3x3 cube into the solver's cubie model.
+ * Turning a middle layer moves the centers, so the
+ * frame is set by the top and front centers, and its
+ * axes are left in frame to map the solver's faces back
+ */
+void readCube(cubeState *c, int frame[3][3])
+{
+    int center[2][3];
+    for (int i = 0; i < num_cubies; i++)
+    {
+        // Top and front centers
+        if (states[i].home == 1 + 3 * (2 + 3 * 1))
+            cellOffset(states[i].cell, center[0]);
+        if (states[i].home == 1 + 3 * (1 + 3 * 2))
+            cellOffset(states[i].cell, center[1]);
+    }
+    int *y = center[0], *z = center[1];
+    int x[3] = {y[1] * z[2] - y[2] * z[1], y[2] * z[0] - y[0] * z[2], y[0] * z[1] - y[1] * z[0]};
+    memcpy(frame[0], x, sizeof(x));
+    memcpy(frame[1], y, sizeof(int) * 3);
+    memcpy(frame[2], z, sizeof(int) * 3);
+
+    c->corners = c->edges[0] = c->edges[1] = 0;
+    for (int i = 0; i < num_cubies; i++)
+    {
+        int home[3], pos[3], cell[3];
+        cellOffset(states[i].home, home);
+        cellOffset(states[i].cell, cell);
+        for (int k = 0; k < 3; k++)
         {
-            for (int k = 0; k < 3; k++)
+            pos[k] = frame[k][0] * cell[0] + frame[k][1] * cell[1] + frame[k][2] * cell[2];
+        }
+        int moved = abs(home[0]) + abs(home[1]) + abs(home[2]);
+        // The cubie's first face where it started, U or
+        // D for corners, and which face it's on now
+        int dir[3];
+        if (moved == 3)
+        {
+            int cubie = findSlot(&corner_faces[0][0], 3, 8, home);
+            int slot = findSlot(&corner_faces[0][0], 3, 8, pos);
+            frameTurn(frame, states[i].rotation, solve_normals[corner_faces[cubie][0]], dir);
+            int face = findSolveFace(dir);
+            int twist = 0;
+            while (twist < 2 && corner_faces[slot][twist] != face)
             {
-                // Move:
-                // +x by 0.5*k - 0.5
-                // -y by 0.5*i + 0.5
-                // +z by 0.5*j - 0.5
-                tr = translate(0.5 * k - 0.5, -0.5 * i + 0.5, 0.5 * j - 0.5);
-
-                // Get the next cube using
-                // color order 9*i + 3*j + k
-                buildSmallCube(&small_cube_verts, &small_cube_colors, color_orders[9 * i + 3 * j + k]);
-
-                // Translate small cube by tr and add to vert list
-                for (int l = 0; l < small_cube_verts.length; l++)
+                twist++;
+            }
+            c->corners |= (uint64_t)(cubie | twist << 4) << 8 * slot;
+        }
+        else if (moved == 2)
+        {
+            int cubie = findSlot(&edge_faces[0][0], 2, 12, home);
+            int slot = findSlot(&edge_faces[0][0], 2, 12, pos);
+            frameTurn(frame, states[i].rotation, solve_normals[edge_faces[cubie][0]], dir);
+            int flip = edge_faces[slot][0] != findSolveFace(dir);
+            c->edges[slot / 8] |= (uint64_t)(cubie | flip << 4) << 8 * (slot % 8);
+        }
+    }
+}
+
+/**
+ * Find a short solution for the 3x3x3 cube and play it
+ * back through the shuffle's turns. Each of the solver's
+ * faces is turned as whichever face of the cube it's
+ * pointing out of now
+ */
+void solve()
+{
+    if (cube_size != 3)
+    {
+        printf("Only the 3x3x3 cube can be solved\n");
+        return;
+    }
+    loadSolveTables();
+
+    cubeState c;
+    int frame[3][3];
+    readCube(&c, frame);
+    if (!cubeCheck(&c))
+    {
+        printf("Error: the cube doesn't read back as a possible cube\n");
+        exit(1);
+    }
+
+    int solution[SOLVE_MAX_MOVES];
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int length = cubeSolve(&solve_tables, &c, SOLVE_MAX_MOVES, solution);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (length < 0)
+    {
+        printf("No solution in %d moves\n", SOLVE_MAX_MOVES);
+        return;
+    }
+    if (length == 0)
+    {
+        printf("The cube is already solved\n");
+        return;
+    }
+    printf("Solved in %d moves, found in %.3f ms:", length,
+           (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6);
+    for (int i = 0; i < length; i++)
+    {
+        printf(" %s", cubeMoveName(solution[i]));
+    }
+    printf("\n");
+
+    // Face along the solver's face, as the frame has it.
+    // Half turns go as two forward turns
+    const int world_normals[6][3] = {{0, 0, 1}, {1, 0, 0}, {0, 0, -1}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}};
+    int num_turns = 0;
+    for (int i = 0; i < length; i++)
+    {
+        const int *n = solve_normals[solution[i] / 3];
+        int dir[3];
+        for (int k = 0; k < 3; k++)
+        {
+            dir[k] = frame[0][k] * n[0] + frame[1][k] * n[1] + frame[2][k] * n[2];
+        }
+        Face face = FRONT;
+        while (face < BOTTOM && memcmp(world_normals[face], dir, sizeof(dir)))
+        {
+            face++;
+        }
+        int quarters = solution[i] % 3 + 1;
+        for (int j = 0; j < (quarters == 2 ? 2 : 1); j++)
+        {
+            shuffle_faces[num_turns] = face;
+            shuffle_dirs[num_turns] = quarters == 3 ? BACKWARD : FORWARD;
+            shuffle_layers[num_turns++] = 0;
+        }
+    }
+    anim_step_count = 0;
+    shuffle_index = 0;
+    shuffle_length = num_turns;
+    shuffle_flag = GL_TRUE;
+    animating_flag = GL_TRUE;
+}
+
+/**
+ * Solve count random cubes without opening a window,
+ * check every solution, and report how fast and how
+ * long they were
+ */
+void benchSolve(int count)
+{
+    loadSolveTables();
+    unsigned int seed = 1;
+    int solution[SOLVE_MAX_MOVES];
+    int total_moves = 0, most_moves = 0;
+    double total_ms = 0, worst_ms = 0;
+    for (int i = 0; i < count; i++)
+    {
+        cubeState c;
+        cubeRandom(&c, &seed);
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int length = cubeSolve(&solve_tables, &c, SOLVE_MAX_MOVES, solution);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) * 1e-6;
+        total_ms += ms;
+        worst_ms = ms > worst_ms ? ms : worst_ms;
+
+        if (length >= 0)
+            cubeApply(&c, solution, length);
+        if (length < 0 || !cubeIsSolved(&c))
+        {
+            printf("Error: no solution found for random cube %d\n", i);
+            exit(1);
+        }
+        total_moves += length;
+        most_moves = length > most_moves ? length : most_moves;
+    }
+    printf("%d random cubes: %.0f solves/sec, %.3f ms each, %.3f ms worst\n", count,
+           count / (total_ms / 1e3), total_ms / count, worst_ms);
+    printf("%.2f moves on average, %d most\n", (double)total_moves / count, most_moves);
+}
+
+/**
+ * Where the centers of the cells at coord along an axis
+ * are, with the cube sized the same whatever cube_size is
+ */
+GLfloat cubieCenter(int coord)
+{
+    return 1.5 / cube_size * (coord - (cube_size - 1) / 2.0);
+}
+
+/**
+ * Copy a cubie's resting state into its instance
+ */
+void placeCubie(int index)
+{
+    int n = cube_size;
+    int cell = states[index].cell;
+    GLfloat *place = cubies[index].place;
+    place[0] = cubieCenter(cell % n);
+    place[1] = cubieCenter(cell / n % n);
+    place[2] = cubieCenter(cell / (n * n));
+    place[3] = states[index].rotation;
+
+    // Grow the range that has to be sent again
+    if (dirty_end <= dirty_first)
+    {
+        dirty_first = index;
+        dirty_end = index + 1;
+    }
+    else
+    {
+        if (index < dirty_first)
+            dirty_first = index;
+        if (index >= dirty_end)
+            dirty_end = index + 1;
+    }
+}
+
+/**
+ * Fill in rotations and rotation_turns by turning the
+ * unturned cube every way a quarter turn at a time until
+ * no new rotations turn up. Columns are where x, y and z
+ * end up, and only ever hold 0, 1 or -1
+ */
+void buildRotations()
+{
+    int found[24][3][3] = {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
+    int num_found = 1;
+    for (int i = 0; i < num_found; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int positive = 0; positive < 2; positive++)
+            {
+                // A positive quarter turn about axis takes
+                // the next axis round to the one after
+                int b = (axis + 1) % 3, c = (axis + 2) % 3;
+                int next[3][3];
+                for (int col = 0; col < 3; col++)
+                {
+                    int *from = found[i][col];
+                    next[col][axis] = from[axis];
+                    next[col][b] = positive ? -from[c] : from[c];
+                    next[col][c] = positive ? from[b] : -from[b];
+                }
+
+                int j = 0;
+                while (j < num_found && memcmp(found[j], next, sizeof(next)))
+                {
+                    j++;
+                }
+                if (j == num_found)
                 {
-                    v4ListPush(&vert_list, multMatVec(&tr, &small_cube_verts.items[l]));
-                    v4ListPush(&color_list, small_cube_colors.items[l]);
+                    memcpy(found[num_found++], next, sizeof(next));
                 }
+                rotation_turns[i][axis][positive] = j;
             }
         }
     }
 
+    for (int i = 0; i < 24; i++)
+    {
+        for (int j = 0; j < 9; j++)
+        {
+            rotations[i][j] = found[i][j / 3][j % 3];
+        }
+    }
+}
+
+/**
+ * Put every small cube on the surface in its cell,
+ * unturned, and color the faces that are outside
+ */
+void placeCubies()
+{
+    int n = cube_size;
+    int index = 0;
+    for (int z = 0; z < n; z++)
+    {
+        for (int y = 0; y < n; y++)
+        {
+            for (int x = 0; x < n; x++)
+            {
+                int cell = x + n * (y + n * z);
+                if (x > 0 && x < n - 1 && y > 0 && y < n - 1 && z > 0 && z < n - 1)
+                {
+                    grid[cell] = -1;
+                    continue;
+                }
+                grid[cell] = index;
+                states[index] = (cubieState){cell, 0, cell};
+                placeCubie(index);
+                cubieInstance *c = &cubies[index++];
+                c->face_colors[FRONT] = z == n - 1 ? GREEN : BLACK;
+                c->face_colors[RIGHT] = x == n - 1 ? RED : BLACK;
+                c->face_colors[BACK] = z == 0 ? BLUE : BLACK;
+                c->face_colors[LEFT] = x == 0 ? ORANGE : BLACK;
+                c->face_colors[TOP] = y == n - 1 ? WHITE : BLACK;
+                c->face_colors[BOTTOM] = y == 0 ? YELLOW : BLACK;
+            }
+        }
+    }
+    turn_angle = 0;
+    turn_rotation = identity();
+}
+
+/**
+ * Print what the cubies cost per frame over the last run
+ * of turns, and start counting again
+ */
+void reportStats()
+{
+    if (stats.frames)
+    {
+        printf("%dx%dx%d cube, %d cubies: %d frames, %.3f ms update, %.3f ms upload and draw",
+               cube_size, cube_size, cube_size, num_cubies, stats.frames,
+               stats.update_ms / stats.frames, stats.draw_ms / stats.frames);
+        if (stats.gpu_frames)
+        {
+            printf(", %.3f ms on the GPU", stats.gpu_ms / stats.gpu_frames);
+        }
+        printf(" per frame\n");
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+void buildCube()
+{
+    // Lists for verts and colors, sized for the one small
+    // cube, the ball, and the plane
+    v4List vert_list, color_list;
+    v4ListNewArena(&vert_list, &scratch);
+    v4ListNewArena(&color_list, &scratch);
+    v4ListReserve(&vert_list, VERTS_PER_CUBE + VERTS_PER_BALL + 6);
+    v4ListReserve(&color_list, VERTS_PER_CUBE + VERTS_PER_BALL + 6);
+
+    // The small cube's colors come from its instance, so
+    // its place in the color list is only filler
+    faces = (GLfloat *)arenaAlloc(&scratch, sizeof(GLfloat) * VERTS_PER_CUBE);
+    num_faces = VERTS_PER_CUBE;
+    buildSmallCube(&vert_list, faces);
+    vec4 *cube_colors = v4ListExtend(&color_list, VERTS_PER_CUBE);
+    for (int i = 0; i < VERTS_PER_CUBE; i++)
+    {
+        cube_colors[i] = black;
+    }
+
+    // Everything after this is only needed while building
+    arenaPos temp_mark = arenaMark(&scratch);
+    mat4 tr;
+
     // Build ball
     v4List ball;
-    v4ListNew(&ball);
+    v4ListNewArena(&ball, &scratch);
+    v4ListReserve(&ball, VERTS_PER_BALL);
     GLfloat theta;
     mat4 r;
     int segments = 40, rings = 40;
 
-    vec4 *ref1 = (vec4 *)malloc(sizeof(vec4) * (rings + 1));
-    vec4 *ref2 = (vec4 *)malloc(sizeof(vec4) * (rings + 1));
+    vec4 *ref1 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (rings + 1));
+    vec4 *ref2 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (rings + 1));
     theta = M_PI / rings;
     ref1[0] = v4(0, 1, 0, 1);
     r = z_rotate(-theta);
@@ -1464,14 +1835,17 @@ void buildCube()
     tr = scale(0.25, 0.25, 0.25);
 
     // Copy ball verts to list, scaling and moving
+    transformVec4Array(&tr, ball.items, v4ListExtend(&vert_list, ball.length), ball.length);
+    vec4 *ball_colors = v4ListExtend(&color_list, ball.length);
     for (int i = 0; i < ball.length; i++)
     {
-        v4ListPush(&vert_list, multMatVec(&tr, &ball.items[i]));
-
         // Add white for all ball verts
-        v4ListPush(&color_list, white);
+        ball_colors[i] = white;
     }
 
+    // Done with the ball and refs
+    arenaReset(&scratch, temp_mark);
+
     // Create large plane for shadow
     v4ListPush(&vert_list, v4(-10, 0, -10, 1.0));
     v4ListPush(&vert_list, v4(-10, 0, 10, 1.0));
@@ -1487,10 +1861,8 @@ void buildCube()
     }
 
     // Transfer lists
-    vertices = vert_list.items;
-    colors = color_list.items;
-    num_vertices = vert_list.length;
-    num_colors = color_list.length;
+    vertices = v4ListRelease(&vert_list, &num_vertices);
+    colors = v4ListRelease(&color_list, &num_colors);
 }
 
 /**
@@ -1502,7 +1874,8 @@ void getNormals()
 {
     // Array list to add normals to
     v4List norm_list;
-    v4ListNew(&norm_list);
+    v4ListNewArena(&norm_list, &scratch);
+    v4ListReserve(&norm_list, num_vertices);
 
     vec4 p1, p2, p3, v1, v2, n;
     // Iterate over vertices 3 at a time
@@ -1528,20 +1901,53 @@ void getNormals()
     }
 
     // Transfer array list to normals
-    normals = norm_list.items;
-    num_normals = norm_list.length;
+    normals = v4ListRelease(&norm_list, &num_normals);
 }
 
 int main(int argc, char **argv)
 {
     // TODO user menu, set texw & texh, set hasColors
+    // Time the solver and stop, without a window
+    if (argc > 1 && !strcmp(argv[1], "--bench"))
+    {
+        int count = argc > 2 ? atoi(argv[2]) : BENCH_SOLVES;
+        if (count < 1)
+        {
+            printf("Error: need at least one cube to solve\n");
+            exit(1);
+        }
+        benchSolve(count);
+        return 0;
+    }
     printControls();
 
-    // Set all cube transformation matrices to identity
-    for (int i = 0; i < 27; i++)
+    // Cube size from the command line
+    if (argc > 1)
     {
-        cube_transforms[i] = identity();
+        cube_size = atoi(argv[1]);
+        if (cube_size < 2 || cube_size > MAX_CUBE_SIZE)
+        {
+            printf("Error: cube size must be 2 to %d\n", MAX_CUBE_SIZE);
+            exit(1);
+        }
     }
+
+    // Room for the cubies on the surface, then put each
+    // in its place
+    int n = cube_size;
+    num_cubies = n * n * n - (n - 2) * (n - 2) * (n - 2);
+    states = (cubieState *)malloc(sizeof(cubieState) * num_cubies);
+    cubies = (cubieInstance *)malloc(sizeof(cubieInstance) * num_cubies);
+    grid = (int *)malloc(sizeof(int) * n * n * n);
+    layer_cells = (int *)malloc(sizeof(int) * n * n);
+    if (!states || !cubies || !grid || !layer_cells)
+    {
+        printf("Error: not enough memory for a %dx%dx%d cube\n", n, n, n);
+        exit(1);
+    }
+    buildRotations();
+    placeCubies();
+    printf("%dx%dx%d cube, %d cubies on the surface\n", n, n, n, num_cubies);
     // Set ball transform to identity
     ball_transform = identity();
     // Set plane transform
@@ -1559,15 +1965,27 @@ int main(int argc, char **argv)
     glutInitWindowPosition(100, 100);
     glutCreateWindow("Project 4");
     glewInit();
+    if (!GLEW_VERSION_3_3)
+    {
+        printf("Error: drawing the cubies needs OpenGL 3.3 for instancing\n");
+        exit(1);
+    }
 
     ctm = identity();
     model_view = look_at(eye, at, up);
     projection = perspective(-0.5, 0.5, -0.5, 0.5, -0.5, -100);
 
+    arenaNew(&scratch, SCRATCH_SIZE);
     buildCube();
     getNormals();
 
     init();
+
+    // Geometry is on the GPU now, so release the CPU copy
+    printArena(&scratch, "Geometry");
+    arenaClear(&scratch);
+    vertices = colors = normals = NULL;
+    faces = NULL;
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutKeyboardUpFunc(keyboardUp);
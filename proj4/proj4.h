@@ -27,10 +27,83 @@ typedef enum
 	BACKWARD
 } Direction;
 
+// Kinds of draw, each with its own build of the shaders
+typedef enum 
+{
+	PASS_CUBE,
+	PASS_SHADOW,
+	PASS_BALL,
+	PASS_PLANE,
+	NUM_PASSES
+} Pass;
+
+typedef struct
+{
+	GLuint program;
+	GLuint vao;
+	GLint ctm;
+	GLint model_view;
+	GLint projection;
+	GLint ball_transform;
+	GLint plane_transform;
+	GLint shadow_plane_y;
+	GLint light_position;
+	GLint turn;
+	GLint turn_axis;
+	GLint turn_offset;
+} passProgram;
+
+// Where a cubie rests between turns: its cell of the
+// grid, and which of the 24 rotations of a cube it's
+// turned by. home is the cell it started in
+typedef struct
+{
+	int cell;
+	int rotation;
+	int home;
+} cubieState;
+
+// One cubie's copy of the shared cubie mesh, as it
+// sits in the instance buffer
+typedef struct
+{
+	GLfloat place[4]; // Center of its cell, then its rotation
+	GLfloat face_colors[6]; // The Color of each Face
+} cubieInstance;
+
+// What the cubies cost over a run of frames
+typedef struct
+{
+	int frames;
+	double update_ms;
+	double draw_ms;
+	int gpu_frames;
+	double gpu_ms;
+} frameStats;
+
 void setCurPoint(int x, int y);
 void printControls();
+vec4 colorValue(Color c);
 void turnFace(Face face, Direction direction);
-void updateOrientation(Face face, Direction direction);
-void getOrientation(Face face, int arr[9]);
-void insertOrientation(Face face, int arr[9]);
+int faceAxis(Face face);
+GLboolean facePositive(Face face);
+int layerCell(Face face, int depth, int u, int v);
+void findLayer(Face face, int depth);
+void updateOrientation(Face face, int depth, Direction direction);
 void shuffle();
+void loadSolveTables();
+int findSlot(const int *slot_faces, int count, int num_slots, const int pos[3]);
+int findSolveFace(const int dir[3]);
+void cellOffset(int cell, int pos[3]);
+void frameTurn(const int frame[3][3], int rotation, const int dir[3], int out[3]);
+void readCube(cubeState *c, int frame[3][3]);
+void solve();
+void benchSolve(int count);
+GLfloat cubieCenter(int coord);
+void placeCubie(int index);
+void buildRotations();
+void placeCubies();
+void reportStats();
+void passAttrib(GLuint program, const char *name, GLint size, size_t offset);
+void passInstanceAttrib(GLuint program, const char *name, GLint size, size_t offset);
+passProgram *usePass(Pass pass);
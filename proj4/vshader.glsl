@@ -1,88 +1,116 @@
 #version 120
 
+// Built once per kind of draw with one of CUBE, SHADOW,
+// BALL or PLANE defined, so each vertex only runs the
+// code for what it's part of
+
 attribute vec4 vPosition;
 attribute vec4 vColor;
 attribute vec4 vNormal;
 varying vec4 color;
 
+#if defined(CUBE) || defined(SHADOW)
+// Every cubie is an instance of one mesh. vFace is which
+// face of it a vertex is on, 6 for the black edges. The
+// rest change once per cubie: where it rests, and the
+// palette entry each of its faces shows. It rests in a
+// cell, turned by one of the 24 rotations of a cube, so
+// cubie_place is the cell's center then the rotation
+attribute float vFace;
+attribute vec4 cubie_place;
+attribute vec3 face_colors_a; // Faces 0 to 2
+attribute vec3 face_colors_b; // Faces 3 to 5
+uniform vec4 palette[7];
+uniform mat3 rotations[24];
+uniform float cubie_scale;
+
+// The layer being turned is the cubies centered at
+// turn_offset along turn_axis, and turn is how far
+// it's gone
+uniform vec3 turn_axis;
+uniform float turn_offset;
+uniform mat4 turn;
+#endif
+
 uniform mat4 ctm;
 uniform mat4 model_view;
 uniform mat4 projection;
 
-uniform int draw_cube;
-uniform mat4 cube_transform;
-
-uniform int draw_ball;
 uniform mat4 ball_transform;
+uniform mat4 plane_transform;
 
 uniform float shininess;
 vec4 ambient, diffuse, specular;
 
-uniform int draw_shadow;
 uniform vec4 light_position;
 uniform float shadow_plane_y;
-uniform int draw_plane;
+
+#if defined(CUBE) || defined(SHADOW)
+mat4 cubieTransform()
+{
+	mat3 r = rotations[int(cubie_place.w + 0.5)] * cubie_scale;
+	mat4 m = mat4(vec4(r[0], 0.0), vec4(r[1], 0.0), vec4(r[2], 0.0), vec4(cubie_place.xyz, 1.0));
+	if (abs(dot(cubie_place.xyz, turn_axis) - turn_offset) < 0.001)
+		m = turn * m;
+	return m;
+}
+#endif
+
+#if defined(CUBE)
+vec4 cubieColor()
+{
+	vec3 a = vec3(equal(vec3(vFace), vec3(0.0, 1.0, 2.0)));
+	vec3 b = vec3(equal(vec3(vFace), vec3(3.0, 4.0, 5.0)));
+	float entry = vFace > 5.5 ? 6.0 : dot(a, face_colors_a) + dot(b, face_colors_b);
+	return palette[int(entry + 0.5)];
+}
+#endif
 
 void main()
 {
 	color = vColor;
-	if(draw_cube == 0 && draw_plane == 0)
-	{
-		if(draw_ball == 1)
-		{
-			gl_Position = projection * model_view * ball_transform * vPosition;
-		}
-		else 
-		{
-			gl_Position = projection * model_view * vPosition;
-		}
-	}
-	else
-	{
-		if(draw_shadow == 0)
-		{
-			gl_Position = projection * model_view * cube_transform * vPosition;
-			
-			// Calculate color based on lighting
-			ambient = vColor * 0.5;
-
-			// Get relative normal
-			vec4 N = normalize(model_view * cube_transform * vNormal);
-			
-			// Light source position fixed to object frame
-			vec4 L_temp = model_view * (light_position - (cube_transform * vPosition));
-			vec4 L = normalize(L_temp);
-			diffuse = max(dot(L, N), 0.0) * vColor;
-
-			vec4 eye_position = vec4(0.0, 0.0, 0.0, 1.0);
-			vec4 V = normalize(eye_position - (model_view * cube_transform * vPosition));
-			vec4 H = normalize(L + V);
-			specular = pow(max(dot(N,H), 0.0), shininess) * vec4(1,1,1,1);
-
-			// float distance = length(L_temp);
-			// For now, set attenuation to 1
-			float attenuation = 1.0;
-
-			color = ambient + (attenuation * (diffuse + specular));
-
-			// If plane, ignore lighting
-			if(draw_plane == 1)
-			{
-				color = vColor;
-			}
-		}
-		else 
-		{
-			// First apply cube_transform
-			vec4 p = cube_transform * vPosition;
-			// Do calculations to flatten for shadow
-			float x, z;
-
-			x = light_position.x - (light_position.y - shadow_plane_y) * ((light_position.x - p.x) / (light_position.y - p.y));
-
-			z = light_position.z - (light_position.y - shadow_plane_y) * ((light_position.z - p.z) / (light_position.y - p.y));
-
-			gl_Position = projection * model_view  * vec4(x, shadow_plane_y, z, 1.0);
-		}
-	}
+#if defined(CUBE)
+	mat4 cube_transform = cubieTransform();
+	gl_Position = projection * model_view * cube_transform * vPosition;
+
+	// Calculate color based on lighting
+	vec4 face_color = cubieColor();
+	ambient = face_color * 0.5;
+
+	// Get relative normal
+	vec4 N = normalize(model_view * cube_transform * vNormal);
+
+	// Light source position fixed to object frame
+	vec4 L_temp = model_view * (light_position - (cube_transform * vPosition));
+	vec4 L = normalize(L_temp);
+	diffuse = max(dot(L, N), 0.0) * face_color;
+
+	vec4 eye_position = vec4(0.0, 0.0, 0.0, 1.0);
+	vec4 V = normalize(eye_position - (model_view * cube_transform * vPosition));
+	vec4 H = normalize(L + V);
+	specular = pow(max(dot(N,H), 0.0), shininess) * vec4(1,1,1,1);
+
+	// float distance = length(L_temp);
+	// For now, set attenuation to 1
+	float attenuation = 1.0;
+
+	color = ambient + (attenuation * (diffuse + specular));
+#elif defined(SHADOW)
+	// First apply the cubie's transform
+	vec4 p = cubieTransform() * vPosition;
+	// Do calculations to flatten for shadow
+	float x, z;
+
+	x = light_position.x - (light_position.y - shadow_plane_y) * ((light_position.x - p.x) / (light_position.y - p.y));
+
+	z = light_position.z - (light_position.y - shadow_plane_y) * ((light_position.z - p.z) / (light_position.y - p.y));
+
+	gl_Position = projection * model_view  * vec4(x, shadow_plane_y, z, 1.0);
+#elif defined(BALL)
+	gl_Position = projection * model_view * ball_transform * vPosition;
+#elif defined(PLANE)
+	gl_Position = projection * model_view * plane_transform * vPosition;
+#else
+	gl_Position = projection * model_view * vPosition;
+#endif
 }
@@ -14,10 +14,13 @@
 
 #include "../lib/initShader.h"
 #include "../lib/lib.h"
+#include "../lib/textureFile.h"
+#include "../lib/textureUpload.h"
 #include "template.h"
 
 #define BUFFER_OFFSET(offset) ((GLvoid *)(offset))
 #define DEBUG 0
+#define SCRATCH_SIZE (4 << 20)
 
 GLuint ctm_location;
 
@@ -32,6 +35,10 @@ GLboolean idle_spin = GL_FALSE;
 GLboolean has_colors = GL_FALSE;
 int texw, texh;
 
+// Everything built on the CPU side lives here until
+// it's been uploaded, then it's all cleared at once
+arena scratch;
+
 mat4 ctm;
 
 // Variables for mouse movements/dragging
@@ -87,11 +94,12 @@ void unitSphere(void)
 
     // Allocate space for vertices
     int numVerts = ((numRings)*6) * numSegments;
-    vertices = (vec4 *)malloc(sizeof(vec4) * numVerts);
+    vertices = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * numVerts);
 
     // Form reference edges of segment
-    vec4 *ref1 = (vec4 *)malloc(sizeof(vec4) * (numRings + 1));
-    vec4 *ref2 = (vec4 *)malloc(sizeof(vec4) * (numRings + 1));
+    arenaPos temp_mark = arenaMark(&scratch);
+    vec4 *ref1 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (numRings + 1));
+    vec4 *ref2 = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * (numRings + 1));
     theta = M_PI / numRings;
     r = z_rotate(-theta);
     ref1[0] = v4(0, 1, 0, 1);
@@ -146,6 +154,9 @@ void unitSphere(void)
             ref2[j] = multMatVec(&r, &ref1[j]);
         }
     }
+
+    // Done with ref1 and ref2
+    arenaReset(&scratch, temp_mark);
 }
 
 /**
@@ -158,7 +169,7 @@ void randColors(void)
     GLfloat r, g, b;
 
     // Allocate memory for color vectors
-    colors = (vec4 *)malloc(sizeof(vec4) * num_vertices);
+    colors = (vec4 *)arenaAlloc(&scratch, sizeof(vec4) * num_vertices);
 
     // Seed random number generator
     srand((unsigned)time(NULL));
@@ -182,21 +193,11 @@ void randColors(void)
 void init(void)
 {
 
-    // Load texture data
-    GLubyte my_texels[texw][texh][3];
-
     // TODO
-    // Load texture from file
-    char *fn = (char *)malloc(sizeof(char) * 25);
-    fn = "filename_here";
-    FILE *f = fopen(fn, "r");
-    if (f == NULL)
-    {
-        printf("Error: couldn't open file %s\n", fn);
-        exit(0);
-    }
-    fread(my_texels, texw * texh * 3, 1, f);
-    fclose(f);
+    // Load texture from file. It's uploaded
+    // straight from the mapping
+    textureFile tex;
+    textureOpen(&tex, "filename_here", texw, texh);
 
     GLuint program = initShader("vshader.glsl", "fshader.glsl");
     glUseProgram(program);
@@ -216,15 +217,18 @@ void init(void)
         GLuint mytex[1];
         glGenTextures(1, mytex);
         glBindTexture(GL_TEXTURE_2D, mytex[0]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texw, texh, 0, GL_RGB, GL_UNSIGNED_BYTE, my_texels);
+        // Mip levels from the cache next to the texture,
+        // or made now and cached, compressed if the GL can
+        textureUpload(&tex, "filename_here");
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
         int param;
         glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &param);
     }
+    textureClose(&tex);
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
@@ -454,10 +458,7 @@ void centerScale()
     mat4 tr = multMat(&s, &t);
 
     // Translate and scale all vertices
-    for (int i = 0; i < num_vertices; i++)
-    {
-        vertices[i] = multMatVec(&tr, &vertices[i]);
-    }
+    transformVec4ArrayInPlace(&tr, vertices, num_vertices);
 }
 
 void keyboard(unsigned char key, int mousex, int mousey)
@@ -491,11 +492,17 @@ int main(int argc, char **argv)
     glewInit();
 
     ctm = identity();
+    arenaNew(&scratch, SCRATCH_SIZE);
     // INSERT SHAPE DRAWING FUNCTIONS HERE
     unitSphere(); // REPLACE ME
     randColors();
 
     init();
+
+    // Geometry is on the GPU now, so release the CPU copy
+    printArena(&scratch, "Geometry");
+    arenaClear(&scratch);
+    vertices = colors = NULL;
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutMouseFunc(mouse);